@@ -0,0 +1,450 @@
+/*
+ * i1d3bench.cpp
+ *
+ * Benchmarks for the i1d3util protocol and eeprom code
+ *
+ * This material is licenced under the GNU GENERAL PUBLIC LICENSE Version 2 or later :-
+ * see the License.txt file for licencing details.
+ *
+ *
+ */
+
+
+// Notes:
+//
+// i1d3bench links the protocol code in i1d3proto.cpp and drives the same functions against an emulated probe, so it runs
+// on any machine and gives numbers that can be compared from one build to the next.  Each operation is timed under a
+// set of USB latency profiles, from an ideal zero latency link down to a probe behind a busy hub.
+//
+// Results are appended to a CSV file, one row per operation per profile :-
+//
+//   tag,profile,name,iterations,total_s,per_op_us
+//
+// The tag is given on the command line and identifies the build, so results from several builds can be kept in one file.
+//
+// i1d3bench results.csv mybuild
+//
+// With "probe" as a third argument the attached probe is also timed through each transport (see -b), as
+// profiles probe-hid and probe-queued :-
+//
+// i1d3bench results.csv mybuild probe
+//
+// To benchmark against the timing of a real probe without one attached, record a session with i1d3util -y
+// and give it after "trace".  The session is played back at its recorded timing as profile trace, with one
+// row per command code it sent :-
+//
+// i1d3bench results.csv mybuild trace session.trc
+
+
+#include <stdio.h>
+#include <iostream>
+
+#include "i1d3proto.h"
+
+
+using namespace std;
+
+
+struct benchProfile
+{
+	const char*		name;
+	double			latency;	// seconds per command round trip
+	double			jitter;
+};
+
+benchProfile benchProfiles[] =
+{
+	{ "ideal",		0.0,	0.0		},
+	{ "fullspeed",	0.002,	0.0		},
+	{ "hub",		0.004,	0.001	},
+	{ "loaded",		0.008,	0.004	},
+};
+
+#define BENCH_NUM_PROFILES	(sizeof(benchProfiles) / sizeof(benchProfiles[0]))
+#define BENCH_MIN_TIME		0.5		// run each operation for at least this long
+#define BENCH_MAX_ITER		1000000
+#define BENCH_BATCH			1000	// calls between clock reads for operations far quicker than timeNow()
+
+FILE*		benchOut(0);
+const char*	benchTag("");
+
+
+void benchReport(const char* profile, const char* name, int iter, double total)
+{
+	double perOp = total / iter * 1e6;
+
+	printf("  %-28s %8d iterations %12.3f us/op\n", name, iter, perOp);
+	fprintf(benchOut, "%s,%s,%s,%d,%.6f,%.3f\n", benchTag, profile, name, iter, total, perOp);
+}
+
+
+volatile unsigned int	benchSink;
+volatile float			benchSinkF;
+
+// The operations that do not touch the probe only need timing once
+void benchLocal()
+{
+	unsigned char eBuf[8192];
+	unsigned char chal[64];
+	unsigned char resp[64];
+	double start, total;
+	int iter;
+	char name[64];
+
+	for(int i(0); i < 8192; i++) eBuf[i] = (unsigned char)(i * 13);
+	for(int i(0); i < 64; i++) chal[i] = (unsigned char)(i * 29);
+
+	cout << "Profile local" << endl;
+
+	for(iter = 0, start = timeNow(); (total = timeNow() - start) < BENCH_MIN_TIME && iter < BENCH_MAX_ITER; iter++)
+	{
+		benchSink = calcCsum(eBuf);
+	}
+	benchReport("local", "calcCsum", iter, total);
+
+	for(iter = 0, start = timeNow(); (total = timeNow() - start) < BENCH_MIN_TIME && iter < BENCH_MAX_ITER; iter++)
+	{
+		i1d3CreateUnLockResponse(i1d3UnLockKeys[iter % i1d3numUnLockKeys][0], i1d3UnLockKeys[iter % i1d3numUnLockKeys][1], chal, resp);
+		benchSink = resp[24];
+	}
+	benchReport("local", "i1d3CreateUnLockResponse", iter, total);
+
+	const float* a = cmf1931_2deg[1];
+	const float* b = cmf1931_2deg[0];
+
+	// the first call picks the kernel for this processor, named in the results
+	benchSinkF = spectralDot(a, b, CMF_BANDS);
+
+	for(iter = 0, start = timeNow(); (total = timeNow() - start) < BENCH_MIN_TIME && iter < BENCH_MAX_ITER; iter += BENCH_BATCH)
+	{
+		for(int i(0); i < BENCH_BATCH; i++) benchSinkF = spectralDot(a, b, CMF_BANDS);
+	}
+	sprintf(name, "spectralDot %s", spectralKernel);
+	benchReport("local", name, iter, total);
+
+	for(iter = 0, start = timeNow(); (total = timeNow() - start) < BENCH_MIN_TIME && iter < BENCH_MAX_ITER; iter += BENCH_BATCH)
+	{
+		for(int i(0); i < BENCH_BATCH; i++) benchSinkF = spectralDotScalar(a, b, CMF_BANDS);
+	}
+	benchReport("local", "spectralDot scalar", iter, total);
+}
+
+
+void benchProbe(benchProfile& p)
+{
+	hidIdevice dev;
+	hidEmulator emu(0, p.latency, p.jitter);
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+	unsigned char eBuf[8192];
+	double start, total;
+	int iter;
+	char name[64];
+
+	dev.emu = &emu;
+	dev.ProductID = 0x5020;
+
+	// commands are slow enough that a handful give a stable figure on the slower profiles
+	double minTime = p.latency > 0.0 ? BENCH_MIN_TIME * 4 : BENCH_MIN_TIME;
+
+	cout << "Profile " << p.name << endl;
+
+	for(iter = 0, start = timeNow(); (total = timeNow() - start) < minTime && iter < BENCH_MAX_ITER; iter++)
+	{
+		memset(tBuf, 0, 64);
+		i1d3Command(&dev, 0x0000, tBuf, fBuf);
+	}
+	benchReport(p.name, "i1d3Command", iter, total);
+
+	for(iter = 0, start = timeNow(); ((total = timeNow() - start) < minTime || iter < 2) && iter < BENCH_MAX_ITER; iter++)
+	{
+		i1d3ReadExternalEeprom(&dev, eBuf);
+	}
+	benchReport(p.name, "i1d3ReadExternalEeprom", iter, total);
+
+	for(iter = 0, start = timeNow(); ((total = timeNow() - start) < minTime || iter < 2) && iter < BENCH_MAX_ITER; iter++)
+	{
+		i1d3WriteExternalEeprom(&dev, eBuf);
+	}
+	benchReport(p.name, "i1d3WriteExternalEeprom", iter, total);
+
+	// unlock cost grows with the position of the probe's key in the table
+	for(int k(0); k < i1d3numUnLockKeys; k++)
+	{
+		emu.keyIndex = k;
+
+		for(iter = 0, start = timeNow(); (total = timeNow() - start) < minTime && iter < BENCH_MAX_ITER; iter++)
+		{
+			if(i1d3UnLock(&dev) != k)
+			{
+				cout << "Error: Emulated probe did not unlock with key " << k << endl;
+				exit(1);
+			}
+		}
+
+		sprintf(name, "i1d3UnLock key %d", k);
+		benchReport(p.name, name, iter, total);
+	}
+}
+
+
+struct benchDumper
+{
+	probeScheduler*	sched;
+	hidIdevice*		dev;
+	volatile bool	stop;
+	int				dumps;
+};
+
+
+DWORD WINAPI benchDumpThread(LPVOID param)
+{
+	benchDumper* d = (benchDumper*)param;
+	unsigned char eBuf[8192];
+
+	while(!d->stop)
+	{
+		eepromReadOp op(true, 0, 8192, eBuf, d->dev->caps);
+		d->sched->run(&op, SCHED_BULK);
+		d->dumps++;
+	}
+
+	return 0;
+}
+
+
+// Measurements through the scheduler while another thread dumps the eeprom back to back.  The measurement
+// figure is the time on top of the integration, its own round trip plus at most one eeprom packet.
+void benchSched(benchProfile& p)
+{
+	hidIdevice dev;
+	hidEmulator emu(0, p.latency, p.jitter);
+	unsigned char eBuf[8192];
+	double start, total, wait(0.0);
+	int iter;
+
+	dev.emu = &emu;
+	dev.ProductID = 0x5020;
+
+	double minTime = p.latency > 0.0 ? BENCH_MIN_TIME * 4 : BENCH_MIN_TIME;
+
+	probeScheduler sched(&dev);
+
+	for(iter = 0, start = timeNow(); ((total = timeNow() - start) < minTime || iter < 2) && iter < BENCH_MAX_ITER; iter++)
+	{
+		eepromReadOp op(true, 0, 8192, eBuf, dev.caps);
+		sched.run(&op, SCHED_BULK);
+	}
+	benchReport(p.name, "scheduled dump alone", iter, total);
+
+	benchDumper dumper;
+	dumper.sched = &sched;
+	dumper.dev = &dev;
+	dumper.stop = false;
+	dumper.dumps = 0;
+	HANDLE th = CreateThread(NULL, 0, benchDumpThread, &dumper, 0, NULL);
+
+	for(iter = 0, start = timeNow(); (total = timeNow() - start) < minTime && iter < BENCH_MAX_ITER; iter++)
+	{
+		measureBurstOp op(1, REFRESH_INTTIME);
+		double t0 = timeNow();
+		sched.run(&op, SCHED_MEASURE);
+		wait += timeNow() - t0 - (double)op.intclks / I1D3_CLK_FREQ;
+	}
+	benchReport(p.name, "scheduled measure wait", iter, wait);
+
+	dumper.stop = true;
+	WaitForSingleObject(th, INFINITE);
+	CloseHandle(th);
+
+	if(dumper.dumps > 0) benchReport(p.name, "scheduled dump shared", dumper.dumps, total);
+}
+
+
+// Reads only, so it is safe on any probe
+void benchRealProbe(const char* profile, int queueDepth)
+{
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+	unsigned char eBuf[8192];
+	double start, total;
+	int iter;
+
+	hidQueueDepth = queueDepth;
+
+	hidIdevice* dev = findHIDdevice();
+	if(!dev || !openHIDdevice(dev))
+	{
+		cout << "Error: failed to open USB HID device" << endl;
+		exit(1);
+	}
+
+	i1d3DetectCaps(dev);
+
+	if(i1d3UnLock(dev) < 0)
+	{
+		cout << "Error: Failed to unlock the i1d3" << endl;
+		exit(1);
+	}
+
+	cout << "Profile " << profile << endl;
+
+	for(iter = 0, start = timeNow(); (total = timeNow() - start) < BENCH_MIN_TIME * 4; iter++)
+	{
+		memset(tBuf, 0, 64);
+		i1d3Command(dev, 0x0000, tBuf, fBuf);
+	}
+	benchReport(profile, "i1d3Command", iter, total);
+
+	for(iter = 0, start = timeNow(); (total = timeNow() - start) < BENCH_MIN_TIME * 4 || iter < 2; iter++)
+	{
+		i1d3ReadExternalEeprom(dev, eBuf);
+	}
+	benchReport(profile, "i1d3ReadExternalEeprom", iter, total);
+
+	for(iter = 0, start = timeNow(); (total = timeNow() - start) < BENCH_MIN_TIME * 4; iter++)
+	{
+		double inttime(REFRESH_INTTIME);
+		double counts[3];
+		i1d3Measure(dev, &inttime, counts);
+	}
+	benchReport(profile, "i1d3Measure 1ms", iter, total);
+
+	closeHIDdevice(dev);
+	delete dev;
+}
+
+
+#define BENCH_TRACE_CMDS	64
+
+// Sends the reports of probe 0 in a recorded session again through i1d3Command.  The clock of the trace is
+// moved up to each report as it is sent, so the time between commands in the session does not count.
+void benchTrace(const char* fileName)
+{
+	hidTrace trace;
+	if(!trace.load(fileName, true))
+	{
+		cout << "Error: Failed to load HID trace " << fileName << endl;
+		exit(1);
+	}
+
+	hidIdevice dev;
+	dev.replay = &trace;
+	dev.ProductID = trace.ProductID;
+
+	unsigned short cmds[BENCH_TRACE_CMDS];
+	int counts[BENCH_TRACE_CMDS];
+	double totals[BENCH_TRACE_CMDS];
+	int numCmds(0);
+
+	cout << "Profile trace" << endl;
+
+	while(true)
+	{
+		unsigned char* rec(0);
+		for(unsigned int p(trace.pos); p + trace.recHdr <= trace.size; p += trace.recHdr + trace.buf[p + trace.recHdr - 1])
+		{
+			unsigned char* r = trace.buf + p;
+			if(r[4] == TRACE_OUT && (trace.recHdr == 6 || r[5] == 0))
+			{
+				rec = r;
+				break;
+			}
+		}
+
+		if(!rec) break;
+
+		unsigned char tBuf[64];
+		unsigned char fBuf[64];
+		int len = rec[trace.recHdr - 1];
+
+		memset(tBuf, 0, 64);
+		memcpy(tBuf, rec + trace.recHdr, len < 64 ? len : 64);
+		unsigned short cmd = (tBuf[0] << 8) | (tBuf[0] == 0x00 ? tBuf[1] : 0);
+
+		trace.start = timeNow() - (rec[0] | (rec[1] << 8) | (rec[2] << 16) | ((unsigned int)rec[3] << 24)) / 1e6;
+
+		double t0 = timeNow();
+		i1d3Command(&dev, cmd, tBuf, fBuf);
+		double t = timeNow() - t0;
+
+		int c(0);
+		while(c < numCmds && cmds[c] != cmd) c++;
+
+		if(c == numCmds)
+		{
+			if(numCmds == BENCH_TRACE_CMDS) continue;
+
+			cmds[c] = cmd;
+			counts[c] = 0;
+			totals[c] = 0.0;
+			numCmds++;
+		}
+
+		counts[c]++;
+		totals[c] += t;
+	}
+
+	for(int c(0); c < numCmds; c++)
+	{
+		char name[64];
+		sprintf(name, "i1d3Command 0x%04x", cmds[c]);
+		benchReport("trace", name, counts[c], totals[c]);
+	}
+
+	if(trace.numMismatch > 0) cout << "Warning: " << trace.numMismatch << " reports differ from the trace" << endl;
+}
+
+
+int main(int argc, char **argv)
+{
+	if(argc < 2)
+	{
+		cout << "Usage: i1d3bench results.csv [build tag] [probe | trace file]" << endl;
+		exit(1);
+	}
+
+	if(argc > 2) benchTag = argv[2];
+
+	FILE* fp = fopen(argv[1], "r");
+	bool newFile = (fp == 0);
+	if(fp) fclose(fp);
+
+	benchOut = fopen(argv[1], "a");
+	if(!benchOut)
+	{
+		cout << "Error: Could not open " << argv[1] << endl;
+		exit(1);
+	}
+
+	if(newFile) fprintf(benchOut, "tag,profile,name,iterations,total_s,per_op_us\n");
+
+	benchLocal();
+
+	for(unsigned int p(0); p < BENCH_NUM_PROFILES; p++)
+	{
+		benchProbe(benchProfiles[p]);
+		benchSched(benchProfiles[p]);
+	}
+
+	if(argc > 3 && strcmp(argv[3], "probe") == 0)
+	{
+		if(loadDLLfuncs() == 0)
+		{
+			cout << "Error: failed to load USB DLL functions" << endl;
+			exit(1);
+		}
+
+		benchRealProbe("probe-hid", 0);
+		benchRealProbe("probe-queued", HID_QUEUE_DEPTH);
+	}
+
+	if(argc > 4 && strcmp(argv[3], "trace") == 0)
+	{
+		benchTrace(argv[4]);
+	}
+
+	fclose(benchOut);
+
+	return 0;
+}
@@ -0,0 +1,302 @@
+// Colour matching functions, 380nm to 730nm in 1nm steps to match the sensor
+// sensitivity data held in the i1d3 external eeprom.
+//
+// The values are sampled from the analytic fits published by Wyman, Sloan and Shirley,
+// "Simple Analytic Approximations to the CIE XYZ Color Matching Functions", JCGT 2013.
+// They track the tabulated CIE data to within a few percent, which is good enough for
+// display type corrections but not for reference work.  They are only used when the
+// CIE tables, which i1d3LoadCMF reads at run time, are not present.
+
+#ifndef I1D3CMF_H
+#define I1D3CMF_H
+
+#define CMF_START_NM	380
+#define CMF_BANDS		351
+
+// CIE 1931 2 degree observer
+static const float cmf1931_2deg[3][CMF_BANDS] =
+{
+	{
+		0.000199f, 0.000253f, 0.000320f, 0.000404f, 0.000507f, 0.000635f, 0.000792f, 0.000984f,
+		0.001217f, 0.001500f, 0.001841f, 0.002252f, 0.002743f, 0.003328f, 0.004022f, 0.004842f,
+		0.005806f, 0.006935f, 0.008252f, 0.009780f, 0.011547f, 0.013579f, 0.015906f, 0.018560f,
+		0.021572f, 0.024974f, 0.028802f, 0.033086f, 0.037859f, 0.043151f, 0.048992f, 0.055407f,
+		0.062417f, 0.070040f, 0.078287f, 0.087165f, 0.096670f, 0.106794f, 0.117519f, 0.128816f,
+		0.140648f, 0.152968f, 0.165718f, 0.178831f, 0.192228f, 0.205822f, 0.219519f, 0.233212f,
+		0.246793f, 0.260145f, 0.273148f, 0.285681f, 0.297622f, 0.308849f, 0.319247f, 0.328703f,
+		0.337114f, 0.344386f, 0.350435f, 0.355191f, 0.358596f, 0.360609f, 0.361204f, 0.360823f,
+		0.359919f, 0.358492f, 0.356547f, 0.354089f, 0.351125f, 0.347664f, 0.343717f, 0.339297f,
+		0.334418f, 0.329096f, 0.323348f, 0.317193f, 0.310651f, 0.303743f, 0.296491f, 0.288918f,
+		0.281047f, 0.272902f, 0.264510f, 0.255895f, 0.247083f, 0.238100f, 0.228973f, 0.219727f,
+		0.210390f, 0.200987f, 0.191544f, 0.182089f, 0.172647f, 0.163243f, 0.153902f, 0.144650f,
+		0.135511f, 0.126508f, 0.117666f, 0.109007f, 0.100554f, 0.092329f, 0.084352f, 0.076644f,
+		0.069224f, 0.062112f, 0.055325f, 0.048881f, 0.042796f, 0.037085f, 0.031763f, 0.026842f,
+		0.022335f, 0.018253f, 0.014606f, 0.011402f, 0.008649f, 0.006353f, 0.004520f, 0.003152f,
+		0.002253f, 0.001824f, 0.001841f, 0.002265f, 0.003097f, 0.004335f, 0.005977f, 0.008021f,
+		0.010465f, 0.013307f, 0.016544f, 0.020174f, 0.024193f, 0.028600f, 0.033391f, 0.038564f,
+		0.044115f, 0.050041f, 0.056340f, 0.063008f, 0.070043f, 0.077442f, 0.085201f, 0.093319f,
+		0.101791f, 0.110616f, 0.119789f, 0.129309f, 0.139172f, 0.149374f, 0.159914f, 0.170786f,
+		0.181988f, 0.193517f, 0.205367f, 0.217535f, 0.230017f, 0.242807f, 0.255900f, 0.269290f,
+		0.282972f, 0.296940f, 0.311185f, 0.325700f, 0.340478f, 0.355509f, 0.370783f, 0.386292f,
+		0.402024f, 0.417967f, 0.434110f, 0.450438f, 0.466939f, 0.483598f, 0.500399f, 0.517327f,
+		0.534364f, 0.551493f, 0.568695f, 0.585951f, 0.603241f, 0.620544f, 0.637839f, 0.655105f,
+		0.672317f, 0.689454f, 0.706492f, 0.723406f, 0.740172f, 0.756765f, 0.773160f, 0.789331f,
+		0.805253f, 0.820901f, 0.836247f, 0.851268f, 0.865937f, 0.880229f, 0.894120f, 0.907583f,
+		0.920596f, 0.933134f, 0.945175f, 0.956696f, 0.967675f, 0.978092f, 0.987926f, 0.997159f,
+		1.005773f, 1.013750f, 1.021075f, 1.027734f, 1.033713f, 1.039001f, 1.043586f, 1.047459f,
+		1.050613f, 1.053042f, 1.054740f, 1.055704f, 1.055926f, 1.055164f, 1.053305f, 1.050355f,
+		1.046323f, 1.041222f, 1.035068f, 1.027880f, 1.019679f, 1.010492f, 1.000346f, 0.989271f,
+		0.977301f, 0.964472f, 0.950821f, 0.936388f, 0.921215f, 0.905345f, 0.888823f, 0.871696f,
+		0.854009f, 0.835810f, 0.817149f, 0.798073f, 0.778632f, 0.758875f, 0.738849f, 0.718604f,
+		0.698186f, 0.677644f, 0.657021f, 0.636364f, 0.615715f, 0.595116f, 0.574609f, 0.554231f,
+		0.534020f, 0.514010f, 0.494236f, 0.474728f, 0.455516f, 0.436627f, 0.418086f, 0.399916f,
+		0.382138f, 0.364770f, 0.347830f, 0.331331f, 0.315286f, 0.299707f, 0.284601f, 0.269975f,
+		0.255835f, 0.242183f, 0.229021f, 0.216349f, 0.204166f, 0.192469f, 0.181253f, 0.170513f,
+		0.160242f, 0.150434f, 0.141079f, 0.132168f, 0.123691f, 0.115638f, 0.107996f, 0.100755f,
+		0.093901f, 0.087423f, 0.081307f, 0.075540f, 0.070109f, 0.065001f, 0.060202f, 0.055700f,
+		0.051480f, 0.047531f, 0.043840f, 0.040392f, 0.037178f, 0.034183f, 0.031397f, 0.028808f,
+		0.026405f, 0.024178f, 0.022115f, 0.020207f, 0.018445f, 0.016818f, 0.015320f, 0.013940f,
+		0.012671f, 0.011506f, 0.010437f, 0.009458f, 0.008561f, 0.007742f, 0.006993f, 0.006311f,
+		0.005689f, 0.005123f, 0.004608f, 0.004141f, 0.003718f, 0.003334f, 0.002987f, 0.002673f,
+		0.002389f, 0.002134f, 0.001904f, 0.001697f, 0.001510f, 0.001343f, 0.001193f, 0.001059f,
+		0.000939f, 0.000832f, 0.000736f, 0.000650f, 0.000574f, 0.000506f, 0.000446f, 0.000393f,
+		0.000345f, 0.000303f, 0.000266f, 0.000233f, 0.000204f, 0.000179f, 0.000156f
+	},
+	{
+		0.000249f, 0.000271f, 0.000295f, 0.000321f, 0.000349f, 0.000380f, 0.000413f, 0.000448f,
+		0.000487f, 0.000528f, 0.000573f, 0.000622f, 0.000674f, 0.000730f, 0.000791f, 0.000856f,
+		0.000926f, 0.001001f, 0.001082f, 0.001170f, 0.001263f, 0.001364f, 0.001471f, 0.001587f,
+		0.001711f, 0.001843f, 0.001985f, 0.002138f, 0.002300f, 0.002474f, 0.002660f, 0.002858f,
+		0.003070f, 0.003296f, 0.003537f, 0.003795f, 0.004068f, 0.004360f, 0.004671f, 0.005001f,
+		0.005352f, 0.005725f, 0.006122f, 0.006543f, 0.006990f, 0.007464f, 0.007966f, 0.008498f,
+		0.009062f, 0.009659f, 0.010291f, 0.010958f, 0.011664f, 0.012410f, 0.013197f, 0.014028f,
+		0.014905f, 0.015829f, 0.016802f, 0.017828f, 0.018907f, 0.020043f, 0.021237f, 0.022492f,
+		0.023810f, 0.025195f, 0.026647f, 0.028171f, 0.029768f, 0.031442f, 0.033195f, 0.035029f,
+		0.036949f, 0.038955f, 0.041053f, 0.043244f, 0.045531f, 0.047918f, 0.050408f, 0.053003f,
+		0.055708f, 0.058525f, 0.061458f, 0.064510f, 0.067685f, 0.070987f, 0.074418f, 0.077985f,
+		0.081689f, 0.085537f, 0.089532f, 0.093680f, 0.097985f, 0.102455f, 0.107094f, 0.111909f,
+		0.116909f, 0.122100f, 0.127493f, 0.133095f, 0.138919f, 0.144976f, 0.151278f, 0.157839f,
+		0.164674f, 0.171799f, 0.179231f, 0.186990f, 0.195094f, 0.203565f, 0.212424f, 0.221693f,
+		0.231396f, 0.241557f, 0.252198f, 0.263344f, 0.275015f, 0.287234f, 0.300020f, 0.313389f,
+		0.327358f, 0.341935f, 0.357129f, 0.372940f, 0.389366f, 0.406398f, 0.424019f, 0.442207f,
+		0.460933f, 0.480158f, 0.499838f, 0.519919f, 0.540340f, 0.561034f, 0.581925f, 0.602932f,
+		0.623967f, 0.644938f, 0.665750f, 0.686303f, 0.706498f, 0.726235f, 0.745416f, 0.763946f,
+		0.781733f, 0.798692f, 0.814745f, 0.829822f, 0.843862f, 0.856814f, 0.868640f, 0.879316f,
+		0.889285f, 0.898854f, 0.908014f, 0.916754f, 0.925068f, 0.932949f, 0.940391f, 0.947389f,
+		0.953939f, 0.960037f, 0.965681f, 0.970870f, 0.975602f, 0.979878f, 0.983698f, 0.987064f,
+		0.989979f, 0.992444f, 0.994464f, 0.996042f, 0.997183f, 0.997893f, 0.998176f, 0.998039f,
+		0.997487f, 0.996529f, 0.995170f, 0.993419f, 0.991282f, 0.988768f, 0.985883f, 0.982638f,
+		0.979039f, 0.975095f, 0.970814f, 0.966204f, 0.961275f, 0.956031f, 0.950398f, 0.944342f,
+		0.937874f, 0.931002f, 0.923736f, 0.916086f, 0.908062f, 0.899675f, 0.890936f, 0.881856f,
+		0.872446f, 0.862718f, 0.852684f, 0.842356f, 0.831747f, 0.820868f, 0.809734f, 0.798356f,
+		0.786749f, 0.774924f, 0.762896f, 0.750678f, 0.738284f, 0.725727f, 0.713021f, 0.700180f,
+		0.687218f, 0.674148f, 0.660985f, 0.647742f, 0.634432f, 0.621070f, 0.607669f, 0.594242f,
+		0.580802f, 0.567363f, 0.553938f, 0.540538f, 0.527177f, 0.513867f, 0.500619f, 0.487445f,
+		0.474356f, 0.461364f, 0.448479f, 0.435710f, 0.423069f, 0.410563f, 0.398203f, 0.385997f,
+		0.373953f, 0.362079f, 0.350382f, 0.338868f, 0.327546f, 0.316419f, 0.305494f, 0.294775f,
+		0.284268f, 0.273976f, 0.263902f, 0.254051f, 0.244424f, 0.235025f, 0.225854f, 0.216913f,
+		0.208203f, 0.199725f, 0.191478f, 0.183464f, 0.175680f, 0.168127f, 0.160803f, 0.153706f,
+		0.146835f, 0.140187f, 0.133760f, 0.127551f, 0.121558f, 0.115776f, 0.110204f, 0.104837f,
+		0.099671f, 0.094702f, 0.089927f, 0.085341f, 0.080941f, 0.076721f, 0.072676f, 0.068804f,
+		0.065098f, 0.061555f, 0.058170f, 0.054937f, 0.051853f, 0.048912f, 0.046109f, 0.043442f,
+		0.040903f, 0.038490f, 0.036197f, 0.034020f, 0.031954f, 0.029996f, 0.028140f, 0.026383f,
+		0.024721f, 0.023150f, 0.021665f, 0.020263f, 0.018940f, 0.017693f, 0.016518f, 0.015412f,
+		0.014371f, 0.013392f, 0.012472f, 0.011608f, 0.010798f, 0.010038f, 0.009326f, 0.008659f,
+		0.008035f, 0.007451f, 0.006906f, 0.006396f, 0.005921f, 0.005477f, 0.005064f, 0.004679f,
+		0.004320f, 0.003987f, 0.003677f, 0.003389f, 0.003122f, 0.002874f, 0.002644f, 0.002431f,
+		0.002234f, 0.002052f, 0.001883f, 0.001727f, 0.001583f, 0.001451f, 0.001328f, 0.001215f,
+		0.001111f, 0.001016f, 0.000928f, 0.000847f, 0.000772f, 0.000704f, 0.000642f, 0.000584f,
+		0.000532f, 0.000483f, 0.000439f, 0.000399f, 0.000362f, 0.000329f, 0.000298f
+	},
+	{
+		0.006746f, 0.007581f, 0.008508f, 0.009535f, 0.010674f, 0.011935f, 0.013330f, 0.014874f,
+		0.016582f, 0.018472f, 0.020565f, 0.022885f, 0.025459f, 0.028322f, 0.031512f, 0.035076f,
+		0.039067f, 0.043552f, 0.048606f, 0.054318f, 0.060795f, 0.068157f, 0.076546f, 0.086120f,
+		0.097062f, 0.109573f, 0.123877f, 0.140217f, 0.158852f, 0.180057f, 0.204114f, 0.231306f,
+		0.261913f, 0.296195f, 0.334387f, 0.376686f, 0.423234f, 0.474108f, 0.529306f, 0.588735f,
+		0.652200f, 0.719394f, 0.789895f, 0.863160f, 0.938534f, 1.015247f, 1.092437f, 1.169154f,
+		1.244392f, 1.317104f, 1.386237f, 1.450755f, 1.509675f, 1.562096f, 1.607223f, 1.644401f,
+		1.673127f, 1.693074f, 1.707990f, 1.721715f, 1.734199f, 1.745395f, 1.755256f, 1.763740f,
+		1.770806f, 1.776416f, 1.780537f, 1.783139f, 1.784194f, 1.783681f, 1.781581f, 1.777881f,
+		1.772574f, 1.765654f, 1.757123f, 1.746987f, 1.735258f, 1.721953f, 1.707094f, 1.690707f,
+		1.671543f, 1.648383f, 1.621345f, 1.590602f, 1.556376f, 1.518934f, 1.478582f, 1.435659f,
+		1.390527f, 1.343567f, 1.295168f, 1.245722f, 1.195612f, 1.145209f, 1.094868f, 1.044914f,
+		0.995648f, 0.947336f, 0.900211f, 0.854471f, 0.810275f, 0.767752f, 0.726992f, 0.688057f,
+		0.650978f, 0.615761f, 0.582387f, 0.550821f, 0.521010f, 0.492887f, 0.466377f, 0.441398f,
+		0.417864f, 0.395687f, 0.374780f, 0.355056f, 0.336432f, 0.318830f, 0.302177f, 0.286402f,
+		0.271444f, 0.257244f, 0.243750f, 0.230914f, 0.218696f, 0.207056f, 0.195962f, 0.185382f,
+		0.175291f, 0.165664f, 0.156479f, 0.147718f, 0.139362f, 0.131395f, 0.123801f, 0.116568f,
+		0.109681f, 0.103128f, 0.096897f, 0.090976f, 0.085354f, 0.080020f, 0.074963f, 0.070172f,
+		0.065639f, 0.061351f, 0.057300f, 0.053475f, 0.049867f, 0.046467f, 0.043266f, 0.040254f,
+		0.037423f, 0.034765f, 0.032270f, 0.029931f, 0.027741f, 0.025691f, 0.023774f, 0.021983f,
+		0.020311f, 0.018752f, 0.017299f, 0.015947f, 0.014689f, 0.013520f, 0.012434f, 0.011426f,
+		0.010493f, 0.009628f, 0.008827f, 0.008087f, 0.007403f, 0.006772f, 0.006190f, 0.005653f,
+		0.005159f, 0.004705f, 0.004287f, 0.003903f, 0.003551f, 0.003229f, 0.002933f, 0.002662f,
+		0.002415f, 0.002188f, 0.001982f, 0.001793f, 0.001622f, 0.001465f, 0.001323f, 0.001193f,
+		0.001076f, 0.000969f, 0.000872f, 0.000784f, 0.000705f, 0.000633f, 0.000568f, 0.000509f,
+		0.000456f, 0.000408f, 0.000365f, 0.000326f, 0.000292f, 0.000260f, 0.000232f, 0.000207f,
+		0.000184f, 0.000164f, 0.000146f, 0.000129f, 0.000115f, 0.000102f, 0.000090f, 0.000080f,
+		0.000071f, 0.000063f, 0.000055f, 0.000049f, 0.000043f, 0.000038f, 0.000033f, 0.000029f,
+		0.000026f, 0.000023f, 0.000020f, 0.000018f, 0.000015f, 0.000013f, 0.000012f, 0.000010f,
+		0.000009f, 0.000008f, 0.000007f, 0.000006f, 0.000005f, 0.000005f, 0.000004f, 0.000003f,
+		0.000003f, 0.000003f, 0.000002f, 0.000002f, 0.000002f, 0.000001f, 0.000001f, 0.000001f,
+		0.000001f, 0.000001f, 0.000001f, 0.000001f, 0.000001f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f
+	}
+};
+
+// CIE 1964 10 degree observer
+static const float cmf1964_10deg[3][CMF_BANDS] =
+{
+	{
+		0.001995f, 0.002364f, 0.002793f, 0.003291f, 0.003866f, 0.004528f, 0.005288f, 0.006158f,
+		0.007150f, 0.008278f, 0.009557f, 0.011002f, 0.012629f, 0.014456f, 0.016501f, 0.018781f,
+		0.021316f, 0.024126f, 0.027230f, 0.030647f, 0.034397f, 0.038500f, 0.042973f, 0.047833f,
+		0.053097f, 0.058778f, 0.064891f, 0.071444f, 0.078445f, 0.085900f, 0.093810f, 0.102173f,
+		0.110983f, 0.120231f, 0.129902f, 0.139980f, 0.150439f, 0.161254f, 0.172391f, 0.183814f,
+		0.195482f, 0.207348f, 0.219363f, 0.231473f, 0.243620f, 0.255744f, 0.267783f, 0.279670f,
+		0.291340f, 0.302725f, 0.313756f, 0.324367f, 0.334492f, 0.344066f, 0.353027f, 0.361317f,
+		0.368882f, 0.375669f, 0.381635f, 0.386740f, 0.390950f, 0.394238f, 0.396582f, 0.397970f,
+		0.398394f, 0.397855f, 0.396359f, 0.393923f, 0.390565f, 0.386315f, 0.381205f, 0.375275f,
+		0.368569f, 0.361137f, 0.353032f, 0.344310f, 0.335031f, 0.325258f, 0.315054f, 0.304482f,
+		0.293609f, 0.282498f, 0.271214f, 0.259819f, 0.248372f, 0.236933f, 0.225557f, 0.214295f,
+		0.203198f, 0.192311f, 0.181674f, 0.171327f, 0.161302f, 0.151630f, 0.142337f, 0.133444f,
+		0.124971f, 0.116932f, 0.109337f, 0.102196f, 0.095514f, 0.089292f, 0.083531f, 0.078229f,
+		0.073381f, 0.068981f, 0.065022f, 0.061496f, 0.058393f, 0.055702f, 0.053413f, 0.051516f,
+		0.049999f, 0.048852f, 0.048063f, 0.047623f, 0.047521f, 0.047749f, 0.048298f, 0.049160f,
+		0.050328f, 0.051796f, 0.053559f, 0.055613f, 0.057954f, 0.060579f, 0.063486f, 0.066675f,
+		0.070146f, 0.073898f, 0.077934f, 0.082255f, 0.086865f, 0.091765f, 0.096960f, 0.102454f,
+		0.108252f, 0.114358f, 0.120777f, 0.127516f, 0.134578f, 0.141971f, 0.149698f, 0.157767f,
+		0.166182f, 0.174949f, 0.184073f, 0.193558f, 0.203408f, 0.213629f, 0.224222f, 0.235192f,
+		0.246541f, 0.258270f, 0.270380f, 0.282873f, 0.295746f, 0.308999f, 0.322630f, 0.336635f,
+		0.351011f, 0.365751f, 0.380850f, 0.396299f, 0.412092f, 0.428216f, 0.444663f, 0.461418f,
+		0.478470f, 0.495802f, 0.513399f, 0.531244f, 0.549317f, 0.567600f, 0.586069f, 0.604703f,
+		0.623479f, 0.642370f, 0.661352f, 0.680395f, 0.699473f, 0.718555f, 0.737611f, 0.756609f,
+		0.775517f, 0.794301f, 0.812929f, 0.831365f, 0.849574f, 0.867521f, 0.885170f, 0.902485f,
+		0.919429f, 0.935967f, 0.952063f, 0.967680f, 0.982784f, 0.997339f, 1.011311f, 1.024667f,
+		1.037373f, 1.049398f, 1.060711f, 1.071284f, 1.081087f, 1.090095f, 1.098283f, 1.105627f,
+		1.112107f, 1.117702f, 1.122396f, 1.126173f, 1.129019f, 1.130925f, 1.131880f, 1.131880f,
+		1.130920f, 1.128999f, 1.126118f, 1.122279f, 1.117491f, 1.111759f, 1.105096f, 1.097515f,
+		1.089031f, 1.079663f, 1.069430f, 1.058354f, 1.046461f, 1.033777f, 1.020329f, 1.006149f,
+		0.991268f, 0.975720f, 0.959540f, 0.942763f, 0.925428f, 0.907572f, 0.889235f, 0.870457f,
+		0.851279f, 0.831742f, 0.811886f, 0.791755f, 0.771388f, 0.750828f, 0.730115f, 0.709290f,
+		0.688393f, 0.667463f, 0.646539f, 0.625657f, 0.604855f, 0.584168f, 0.563628f, 0.543270f,
+		0.523123f, 0.503218f, 0.483583f, 0.464243f, 0.445224f, 0.426548f, 0.408237f, 0.390309f,
+		0.372783f, 0.355675f, 0.338997f, 0.322764f, 0.306985f, 0.291669f, 0.276823f, 0.262453f,
+		0.248563f, 0.235155f, 0.222231f, 0.209789f, 0.197829f, 0.186346f, 0.175338f, 0.164798f,
+		0.154720f, 0.145097f, 0.135921f, 0.127182f, 0.118871f, 0.110978f, 0.103491f, 0.096399f,
+		0.089690f, 0.083353f, 0.077373f, 0.071739f, 0.066438f, 0.061456f, 0.056782f, 0.052400f,
+		0.048300f, 0.044467f, 0.040890f, 0.037555f, 0.034451f, 0.031564f, 0.028885f, 0.026400f,
+		0.024100f, 0.021973f, 0.020009f, 0.018197f, 0.016529f, 0.014995f, 0.013587f, 0.012295f,
+		0.011111f, 0.010029f, 0.009041f, 0.008139f, 0.007318f, 0.006571f, 0.005893f, 0.005277f,
+		0.004720f, 0.004216f, 0.003761f, 0.003350f, 0.002981f, 0.002648f, 0.002350f, 0.002082f,
+		0.001842f, 0.001628f, 0.001436f, 0.001266f, 0.001114f, 0.000979f, 0.000859f, 0.000752f,
+		0.000658f, 0.000575f, 0.000502f, 0.000437f, 0.000380f, 0.000330f, 0.000287f, 0.000248f,
+		0.000215f, 0.000185f, 0.000160f, 0.000138f, 0.000118f, 0.000102f, 0.000087f
+	},
+	{
+		0.000694f, 0.000754f, 0.000819f, 0.000888f, 0.000963f, 0.001044f, 0.001131f, 0.001225f,
+		0.001326f, 0.001434f, 0.001551f, 0.001677f, 0.001811f, 0.001956f, 0.002111f, 0.002278f,
+		0.002456f, 0.002648f, 0.002852f, 0.003072f, 0.003306f, 0.003557f, 0.003825f, 0.004111f,
+		0.004416f, 0.004742f, 0.005090f, 0.005460f, 0.005855f, 0.006275f, 0.006723f, 0.007199f,
+		0.007705f, 0.008242f, 0.008813f, 0.009419f, 0.010062f, 0.010744f, 0.011467f, 0.012233f,
+		0.013043f, 0.013901f, 0.014808f, 0.015768f, 0.016781f, 0.017851f, 0.018980f, 0.020172f,
+		0.021428f, 0.022751f, 0.024145f, 0.025613f, 0.027156f, 0.028780f, 0.030486f, 0.032278f,
+		0.034159f, 0.036133f, 0.038203f, 0.040373f, 0.042646f, 0.045025f, 0.047516f, 0.050120f,
+		0.052842f, 0.055686f, 0.058656f, 0.061754f, 0.064986f, 0.068355f, 0.071865f, 0.075520f,
+		0.079323f, 0.083279f, 0.087390f, 0.091662f, 0.096098f, 0.100700f, 0.105474f, 0.110422f,
+		0.115548f, 0.120855f, 0.126346f, 0.132025f, 0.137895f, 0.143957f, 0.150216f, 0.156673f,
+		0.163331f, 0.170192f, 0.177258f, 0.184530f, 0.192011f, 0.199701f, 0.207602f, 0.215714f,
+		0.224037f, 0.232572f, 0.241320f, 0.250278f, 0.259447f, 0.268826f, 0.278413f, 0.288207f,
+		0.298205f, 0.308405f, 0.318804f, 0.329399f, 0.340186f, 0.351161f, 0.362320f, 0.373659f,
+		0.385171f, 0.396851f, 0.408694f, 0.420692f, 0.432840f, 0.445128f, 0.457551f, 0.470100f,
+		0.482766f, 0.495540f, 0.508414f, 0.521377f, 0.534419f, 0.547531f, 0.560700f, 0.573917f,
+		0.587170f, 0.600446f, 0.613734f, 0.627022f, 0.640296f, 0.653545f, 0.666754f, 0.679911f,
+		0.693002f, 0.706013f, 0.718931f, 0.731741f, 0.744430f, 0.756984f, 0.769387f, 0.781626f,
+		0.793688f, 0.805556f, 0.817219f, 0.828661f, 0.839868f, 0.850827f, 0.861525f, 0.871947f,
+		0.882081f, 0.891914f, 0.901433f, 0.910626f, 0.919480f, 0.927984f, 0.936128f, 0.943899f,
+		0.951288f, 0.958284f, 0.964878f, 0.971062f, 0.976826f, 0.982163f, 0.987066f, 0.991527f,
+		0.995541f, 0.999101f, 1.002203f, 1.004843f, 1.007016f, 1.008721f, 1.009953f, 1.010713f,
+		1.010998f, 1.010808f, 1.010143f, 1.009005f, 1.007395f, 1.005315f, 1.002768f, 0.999758f,
+		0.996289f, 0.992366f, 0.987994f, 0.983179f, 0.977928f, 0.972249f, 0.966148f, 0.959635f,
+		0.952718f, 0.945407f, 0.937712f, 0.929642f, 0.921209f, 0.912424f, 0.903298f, 0.893843f,
+		0.884072f, 0.873998f, 0.863632f, 0.852988f, 0.842080f, 0.830921f, 0.819525f, 0.807906f,
+		0.796077f, 0.784053f, 0.771848f, 0.759477f, 0.746952f, 0.734289f, 0.721502f, 0.708605f,
+		0.695611f, 0.682535f, 0.669390f, 0.656190f, 0.642949f, 0.629678f, 0.616392f, 0.603103f,
+		0.589823f, 0.576565f, 0.563340f, 0.550160f, 0.537036f, 0.523979f, 0.510999f, 0.498107f,
+		0.485312f, 0.472624f, 0.460051f, 0.447603f, 0.435286f, 0.423110f, 0.411081f, 0.399207f,
+		0.387494f, 0.375947f, 0.364574f, 0.353378f, 0.342366f, 0.331541f, 0.320907f, 0.310469f,
+		0.300229f, 0.290190f, 0.280355f, 0.270727f, 0.261306f, 0.252095f, 0.243094f, 0.234305f,
+		0.225727f, 0.217361f, 0.209207f, 0.201264f, 0.193532f, 0.186010f, 0.178696f, 0.171589f,
+		0.164687f, 0.157989f, 0.151491f, 0.145193f, 0.139092f, 0.133184f, 0.127467f, 0.121938f,
+		0.116595f, 0.111433f, 0.106450f, 0.101641f, 0.097005f, 0.092536f, 0.088232f, 0.084088f,
+		0.080102f, 0.076268f, 0.072584f, 0.069046f, 0.065649f, 0.062390f, 0.059265f, 0.056270f,
+		0.053401f, 0.050655f, 0.048027f, 0.045514f, 0.043113f, 0.040819f, 0.038629f, 0.036539f,
+		0.034546f, 0.032647f, 0.030837f, 0.029114f, 0.027475f, 0.025915f, 0.024433f, 0.023024f,
+		0.021687f, 0.020418f, 0.019213f, 0.018072f, 0.016990f, 0.015966f, 0.014996f, 0.014079f,
+		0.013211f, 0.012391f, 0.011617f, 0.010886f, 0.010196f, 0.009545f, 0.008931f, 0.008354f,
+		0.007809f, 0.007297f, 0.006816f, 0.006363f, 0.005937f, 0.005537f, 0.005162f, 0.004810f,
+		0.004480f, 0.004170f, 0.003880f, 0.003609f, 0.003355f, 0.003117f, 0.002895f, 0.002687f,
+		0.002494f, 0.002313f, 0.002144f, 0.001986f, 0.001840f, 0.001703f, 0.001576f, 0.001457f,
+		0.001347f, 0.001244f, 0.001149f, 0.001061f, 0.000979f, 0.000903f, 0.000832f
+	},
+	{
+		0.002562f, 0.003298f, 0.004217f, 0.005355f, 0.006754f, 0.008464f, 0.010540f, 0.013044f,
+		0.016043f, 0.019616f, 0.023845f, 0.028821f, 0.034641f, 0.041410f, 0.049239f, 0.058243f,
+		0.068542f, 0.080258f, 0.093519f, 0.108448f, 0.125171f, 0.143808f, 0.164477f, 0.187287f,
+		0.212338f, 0.239721f, 0.269512f, 0.301772f, 0.336546f, 0.373859f, 0.413717f, 0.456102f,
+		0.500976f, 0.548274f, 0.597908f, 0.649766f, 0.703709f, 0.759578f, 0.817186f, 0.876325f,
+		0.936768f, 0.998265f, 1.060554f, 1.123352f, 1.186368f, 1.249300f, 1.311838f, 1.373668f,
+		1.434476f, 1.493950f, 1.551782f, 1.607671f, 1.661329f, 1.712480f, 1.760862f, 1.806234f,
+		1.848372f, 1.887077f, 1.922169f, 1.953497f, 1.980932f, 2.004372f, 2.023742f, 2.038992f,
+		2.050099f, 2.057066f, 2.059919f, 2.058710f, 2.053512f, 2.044422f, 2.031554f, 2.015041f,
+		1.995035f, 1.971699f, 1.945212f, 1.915763f, 1.883550f, 1.848778f, 1.811659f, 1.772406f,
+		1.731236f, 1.688366f, 1.644013f, 1.598388f, 1.551701f, 1.504157f, 1.455952f, 1.407277f,
+		1.358315f, 1.309240f, 1.260215f, 1.211396f, 1.162928f, 1.114944f, 1.067567f, 1.020912f,
+		0.975080f, 0.930164f, 0.886245f, 0.843395f, 0.801676f, 0.761140f, 0.721832f, 0.683787f,
+		0.647032f, 0.611587f, 0.577463f, 0.544668f, 0.513200f, 0.483055f, 0.454221f, 0.426682f,
+		0.400420f, 0.375410f, 0.351627f, 0.329042f, 0.307621f, 0.287333f, 0.268141f, 0.250009f,
+		0.232900f, 0.216774f, 0.201594f, 0.187319f, 0.173911f, 0.161332f, 0.149543f, 0.138505f,
+		0.128182f, 0.118537f, 0.109534f, 0.101140f, 0.093320f, 0.086042f, 0.079275f, 0.072988f,
+		0.067153f, 0.061742f, 0.056729f, 0.052087f, 0.047794f, 0.043827f, 0.040162f, 0.036781f,
+		0.033664f, 0.030792f, 0.028147f, 0.025715f, 0.023478f, 0.021424f, 0.019538f, 0.017809f,
+		0.016223f, 0.014770f, 0.013440f, 0.012223f, 0.011111f, 0.010094f, 0.009166f, 0.008319f,
+		0.007546f, 0.006842f, 0.006200f, 0.005616f, 0.005085f, 0.004602f, 0.004162f, 0.003763f,
+		0.003401f, 0.003072f, 0.002774f, 0.002503f, 0.002258f, 0.002036f, 0.001836f, 0.001654f,
+		0.001490f, 0.001341f, 0.001207f, 0.001086f, 0.000976f, 0.000878f, 0.000789f, 0.000708f,
+		0.000636f, 0.000571f, 0.000512f, 0.000459f, 0.000412f, 0.000369f, 0.000331f, 0.000296f,
+		0.000265f, 0.000238f, 0.000213f, 0.000190f, 0.000170f, 0.000152f, 0.000136f, 0.000121f,
+		0.000108f, 0.000097f, 0.000086f, 0.000077f, 0.000069f, 0.000061f, 0.000055f, 0.000049f,
+		0.000044f, 0.000039f, 0.000035f, 0.000031f, 0.000027f, 0.000024f, 0.000022f, 0.000019f,
+		0.000017f, 0.000015f, 0.000014f, 0.000012f, 0.000011f, 0.000010f, 0.000008f, 0.000008f,
+		0.000007f, 0.000006f, 0.000005f, 0.000005f, 0.000004f, 0.000004f, 0.000003f, 0.000003f,
+		0.000003f, 0.000002f, 0.000002f, 0.000002f, 0.000002f, 0.000001f, 0.000001f, 0.000001f,
+		0.000001f, 0.000001f, 0.000001f, 0.000001f, 0.000001f, 0.000001f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f,
+		0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f, 0.000000f
+	}
+};
+
+#endif
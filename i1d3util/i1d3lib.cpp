@@ -0,0 +1,312 @@
+/*
+ * i1d3lib.cpp
+ *
+ * C interface to the i1d3util probe code, see i1d3lib.h
+ *
+ * This material is licenced under the GNU GENERAL PUBLIC LICENSE Version 2 or later :-
+ * see the License.txt file for licencing details.
+ *
+ *
+ */
+
+
+// Notes:
+//
+// The library links i1d3proto.cpp, as does the command line tool, so the dll and i1d3util always share the same protocol
+// code.  Nothing here may print or exit, errors are returned to the caller.
+//
+// Everything that talks to a probe goes through the device's probeScheduler, whose worker thread owns the hid handle.
+// That is what lets several threads share a handle, and lets a measurement overtake an eeprom transfer.
+
+
+#include "i1d3proto.h"
+
+#define I1D3LIB_EXPORTS
+#include "i1d3lib.h"
+
+
+struct i1d3libDevice
+{
+	hidIdevice*		hid;
+	probeScheduler*	sched;
+	int				key;		// index of the key that unlocked the probe, -1 until unlocked
+};
+
+
+static i1d3libDevice* i1d3libWrap(hidIdevice* hid)
+{
+	if(!openHIDdevice(hid))
+	{
+		delete hid;
+		return 0;
+	}
+
+	// transfer sizes for the probe's firmware
+	i1d3DetectCaps(hid);
+
+	i1d3libDevice* dev = new i1d3libDevice;
+	dev->hid = hid;
+	dev->sched = new probeScheduler(hid);
+	dev->key = -1;
+
+	if(!dev->sched->valid())
+	{
+		i1d3libClose(dev);
+		return 0;
+	}
+
+	return dev;
+}
+
+
+int I1D3LIB_CALL i1d3libVersion(void)
+{
+	return I1D3LIB_VERSION;
+}
+
+
+int I1D3LIB_CALL i1d3libEnumerate(i1d3libDevice** devs, int maxDevs)
+{
+	if(!devs || maxDevs <= 0) return I1D3LIB_ERR_ARG;
+	if(maxDevs > I1D3LIB_MAX_DEVICES) maxDevs = I1D3LIB_MAX_DEVICES;
+
+	if(loadDLLfuncs() == 0) return I1D3LIB_ERR_NO_HID;
+
+	hidIdevice* hids[I1D3LIB_MAX_DEVICES];
+	int numHids = findHIDdevices(hids, maxDevs);
+	if(numHids < 0) return I1D3LIB_ERR_NOT_FOUND;
+
+	// a probe that will not open is most likely held by another program, skip it
+	int numDevs(0);
+	for(int i(0); i < numHids; i++)
+	{
+		i1d3libDevice* dev = i1d3libWrap(hids[i]);
+		if(dev) devs[numDevs++] = dev;
+	}
+
+	if(numHids > 0 && numDevs == 0) return I1D3LIB_ERR_OPEN;
+
+	return numDevs;
+}
+
+
+int I1D3LIB_CALL i1d3libOpen(i1d3libDevice** dev)
+{
+	if(!dev) return I1D3LIB_ERR_ARG;
+	*dev = 0;
+
+	if(loadDLLfuncs() == 0) return I1D3LIB_ERR_NO_HID;
+
+	hidIdevice* hid = findHIDdevice();
+	if(!hid) return I1D3LIB_ERR_NOT_FOUND;
+
+	*dev = i1d3libWrap(hid);
+	if(!*dev) return I1D3LIB_ERR_OPEN;
+
+	return I1D3LIB_OK;
+}
+
+
+void I1D3LIB_CALL i1d3libClose(i1d3libDevice* dev)
+{
+	if(!dev) return;
+
+	delete dev->sched;
+	closeHIDdevice(dev->hid);
+	delete dev->hid;
+	delete dev;
+}
+
+
+int I1D3LIB_CALL i1d3libProductID(i1d3libDevice* dev)
+{
+	if(!dev) return I1D3LIB_ERR_ARG;
+
+	return (int)dev->hid->ProductID;
+}
+
+
+const char* I1D3LIB_CALL i1d3libPath(i1d3libDevice* dev)
+{
+	if(!dev) return 0;
+
+	return dev->hid->dpath;
+}
+
+
+int I1D3LIB_CALL i1d3libGetInfo(i1d3libDevice* dev, char* info, int infoLen)
+{
+	if(!dev || !info || infoLen <= 0) return I1D3LIB_ERR_ARG;
+
+	infoOp op;
+	if(dev->sched->run(&op, SCHED_MEASURE) != OP_DONE) return I1D3LIB_ERR_COMMAND;
+
+	strncpy(info, op.info, infoLen - 1);
+	info[infoLen - 1] = 0;
+
+	return I1D3LIB_OK;
+}
+
+
+int I1D3LIB_CALL i1d3libGetSerial(i1d3libDevice* dev, char* serNum, int serLen)
+{
+	if(!dev || !serNum || serLen <= 0) return I1D3LIB_ERR_ARG;
+	if(dev->key < 0) return I1D3LIB_ERR_LOCKED;
+
+	// the serial number lives at offset 16 of the internal eeprom
+	unsigned char sBuf[21];
+	memset(sBuf, 0x00, 21);
+	eepromReadOp op(false, 16, 20, sBuf, dev->hid->caps);
+	if(dev->sched->run(&op, SCHED_MEASURE) != OP_DONE) return I1D3LIB_ERR_COMMAND;
+
+	strncpy(serNum, (char*)sBuf, serLen - 1);
+	serNum[serLen - 1] = 0;
+
+	return I1D3LIB_OK;
+}
+
+
+// As i1d3ProbeCaps, but through the scheduler.  Unknown firmware keeps the safe read sizes unless the full ones
+// read back the same data.
+static void i1d3libProbeCaps(i1d3libDevice* dev)
+{
+	i1d3Caps& caps = dev->hid->caps;
+	if(caps.maxVersion != 0) return;
+
+	unsigned char safeBuf[256];
+	unsigned char fullBuf[256];
+
+	for(int ext(0); ext < 2; ext++)
+	{
+		eepromReadOp safeOp(ext != 0, 0, 256, safeBuf, caps);
+		if(dev->sched->run(&safeOp, SCHED_MEASURE) != OP_DONE) continue;
+
+		i1d3Caps full = caps;
+		if(ext) full.extRead = i1d3CapsTable[0].extRead;
+		else full.intRead = i1d3CapsTable[0].intRead;
+
+		eepromReadOp fullOp(ext != 0, 0, 256, fullBuf, full);
+		if(dev->sched->run(&fullOp, SCHED_MEASURE) != OP_DONE || memcmp(safeBuf, fullBuf, 256) != 0) continue;
+
+		if(ext) caps.extRead = full.extRead;
+		else caps.intRead = full.intRead;
+	}
+}
+
+
+int I1D3LIB_CALL i1d3libUnLock(i1d3libDevice* dev)
+{
+	if(!dev) return I1D3LIB_ERR_ARG;
+
+	if(dev->key < 0)
+	{
+		unlockOp op;
+		if(dev->sched->run(&op, SCHED_MEASURE) != OP_DONE) return I1D3LIB_ERR_LOCKED;
+		dev->key = op.key;
+
+		// the eeproms can only be read once the probe is unlocked
+		i1d3libProbeCaps(dev);
+	}
+
+	return dev->key;
+}
+
+
+const char* I1D3LIB_CALL i1d3libKeyName(int key)
+{
+	if(key < 0 || key >= i1d3numUnLockKeys) return 0;
+
+	return i1d3KeyNames[key];
+}
+
+
+static int i1d3libCheckRange(int eeprom, unsigned int addr, unsigned int len)
+{
+	unsigned int size;
+
+	if(eeprom == I1D3LIB_EEPROM_INTERNAL) size = 256;
+	else if(eeprom == I1D3LIB_EEPROM_EXTERNAL) size = 8192;
+	else return I1D3LIB_ERR_ARG;
+
+	if(addr > size || len > size - addr) return I1D3LIB_ERR_RANGE;
+
+	return I1D3LIB_OK;
+}
+
+
+int I1D3LIB_CALL i1d3libReadEeprom(i1d3libDevice* dev, int eeprom, unsigned int addr, unsigned int len, unsigned char* buf)
+{
+	if(!dev || !buf) return I1D3LIB_ERR_ARG;
+
+	int res = i1d3libCheckRange(eeprom, addr, len);
+	if(res < 0) return res;
+
+	if(dev->key < 0) return I1D3LIB_ERR_LOCKED;
+
+	eepromReadOp op(eeprom == I1D3LIB_EEPROM_EXTERNAL, addr, len, buf, dev->hid->caps);
+
+	return dev->sched->run(&op, SCHED_BULK) == OP_DONE ? I1D3LIB_OK : I1D3LIB_ERR_COMMAND;
+}
+
+
+int I1D3LIB_CALL i1d3libWriteEeprom(i1d3libDevice* dev, int eeprom, unsigned int addr, unsigned int len, const unsigned char* buf)
+{
+	if(!dev || !buf) return I1D3LIB_ERR_ARG;
+
+	int res = i1d3libCheckRange(eeprom, addr, len);
+	if(res < 0) return res;
+
+	if(dev->key < 0) return I1D3LIB_ERR_LOCKED;
+
+	eepromWriteOp op(eeprom == I1D3LIB_EEPROM_EXTERNAL, addr, len, buf, dev->hid->caps);
+
+	return dev->sched->run(&op, SCHED_BULK) == OP_DONE ? I1D3LIB_OK : I1D3LIB_ERR_COMMAND;
+}
+
+
+int I1D3LIB_CALL i1d3libEnableWrite(i1d3libDevice* dev)
+{
+	if(!dev) return I1D3LIB_ERR_ARG;
+	if(dev->key < 0) return I1D3LIB_ERR_LOCKED;
+
+	unsigned char tBuf[64];
+	i1d3MakeEnWrite(tBuf);
+
+	commandOp op(0xab00, tBuf);
+	if(dev->sched->run(&op, SCHED_MEASURE) != OP_DONE || !op.accepted) return I1D3LIB_ERR_COMMAND;
+
+	return I1D3LIB_OK;
+}
+
+
+int I1D3LIB_CALL i1d3libMeasure(i1d3libDevice* dev, double* inttime, double* counts)
+{
+	if(!dev || !inttime || !counts || *inttime <= 0.0) return I1D3LIB_ERR_ARG;
+	if(dev->key < 0) return I1D3LIB_ERR_LOCKED;
+
+	measureBurstOp op(1, *inttime);
+	if(dev->sched->run(&op, SCHED_MEASURE) != OP_DONE) return I1D3LIB_ERR_COMMAND;
+
+	*inttime = (double)op.intclks / I1D3_CLK_FREQ;
+	for(int ch(0); ch < 3; ch++) counts[ch] = op.vals[ch];
+
+	return I1D3LIB_OK;
+}
+
+
+unsigned int I1D3LIB_CALL i1d3libChecksum(const unsigned char* eeprom, int alt)
+{
+	if(!eeprom) return 0;
+
+	return calcCsum((unsigned char*)eeprom, alt != 0);
+}
+
+
+int I1D3LIB_CALL i1d3libChecksumValid(const unsigned char* eeprom)
+{
+	if(!eeprom) return 0;
+
+	unsigned int fsum = eeprom[2] | (eeprom[3] << 8);
+
+	return (calcCsum((unsigned char*)eeprom) == fsum || calcCsum((unsigned char*)eeprom, true) == fsum) ? 1 : 0;
+}
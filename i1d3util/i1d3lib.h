@@ -0,0 +1,124 @@
+/*
+ * i1d3lib.h
+ *
+ * C interface to the i1d3util probe code, for use from other programs
+ *
+ * This material is licenced under the GNU GENERAL PUBLIC LICENSE Version 2 or later :-
+ * see the License.txt file for licencing details.
+ *
+ *
+ */
+
+
+// Notes:
+//
+// i1d3lib.dll holds the same device code as i1d3util.exe behind a plain C interface, so a program can keep a probe open
+// and unlocked for as long as it likes instead of running i1d3util for every query.
+//
+// The interface only uses C types and an opaque device handle, and is versioned by I1D3LIB_VERSION.  Functions are only
+// ever added, existing ones keep their signature and behaviour, so a program built against an older header keeps working
+// with a newer dll.  Check i1d3libVersion() >= the version the program was built against.
+//
+// All functions return I1D3LIB_OK (0) or a negative I1D3LIB_ERR_ code unless stated otherwise.  None of them print or exit.
+//
+// A device handle may be used from several threads at once.  Requests to one probe are queued and measurements go
+// ahead of eeprom transfers, so a measurement made while another thread dumps or restores the eeprom waits for at
+// most one eeprom packet rather than the whole transfer.
+//
+// A typical session :-
+//
+//   i1d3libDevice* devs[8];
+//   int n = i1d3libEnumerate(devs, 8);
+//   int key = i1d3libUnLock(devs[0]);                           // key index, see i1d3libKeyName()
+//   i1d3libReadEeprom(devs[0], I1D3LIB_EEPROM_EXTERNAL, 0, 8192, buf);
+//   i1d3libClose(devs[0]);
+
+
+#ifndef I1D3LIB_H
+#define I1D3LIB_H
+
+#ifdef I1D3LIB_EXPORTS
+#define I1D3LIB_API		__declspec(dllexport)
+#else
+#define I1D3LIB_API		__declspec(dllimport)
+#endif
+
+#define I1D3LIB_CALL	__cdecl
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define I1D3LIB_VERSION				2
+
+#define I1D3LIB_OK					0
+#define I1D3LIB_ERR_NO_HID			-1		// hid.dll could not be loaded
+#define I1D3LIB_ERR_NOT_FOUND		-2		// no probe attached
+#define I1D3LIB_ERR_OPEN			-3		// the probe could not be opened, it may be in use
+#define I1D3LIB_ERR_COMMAND			-4		// the probe did not answer or rejected a command
+#define I1D3LIB_ERR_LOCKED			-5		// none of the known keys unlock the probe
+#define I1D3LIB_ERR_RANGE			-6		// address or length outside the eeprom
+#define I1D3LIB_ERR_ARG				-7		// bad argument
+
+#define I1D3LIB_EEPROM_INTERNAL		0		// 256 bytes, holds the serial number
+#define I1D3LIB_EEPROM_EXTERNAL		1		// 8192 bytes, holds the calibration and signature
+
+#define I1D3LIB_MAX_DEVICES			32
+
+typedef struct i1d3libDevice i1d3libDevice;
+
+
+I1D3LIB_API int				I1D3LIB_CALL i1d3libVersion(void);
+
+// Opens every attached probe, up to maxDevs.  Returns the number opened, 0 if there are none, or an error.
+I1D3LIB_API int				I1D3LIB_CALL i1d3libEnumerate(i1d3libDevice** devs, int maxDevs);
+
+// Opens the first attached probe
+I1D3LIB_API int				I1D3LIB_CALL i1d3libOpen(i1d3libDevice** dev);
+
+I1D3LIB_API void			I1D3LIB_CALL i1d3libClose(i1d3libDevice* dev);
+
+// USB product id, 0x5020 normally or 0x5021 if the internal eeprom is corrupt
+I1D3LIB_API int				I1D3LIB_CALL i1d3libProductID(i1d3libDevice* dev);
+
+// System path of the device, valid until i1d3libClose
+I1D3LIB_API const char*		I1D3LIB_CALL i1d3libPath(i1d3libDevice* dev);
+
+// Firmware information string, at most 63 characters plus terminator
+I1D3LIB_API int				I1D3LIB_CALL i1d3libGetInfo(i1d3libDevice* dev, char* info, int infoLen);
+
+// Serial number, at most 20 characters plus terminator.  The probe must be unlocked.
+I1D3LIB_API int				I1D3LIB_CALL i1d3libGetSerial(i1d3libDevice* dev, char* serNum, int serLen);
+
+// Unlocks the probe.  Returns the index of the key that worked, which identifies the flavour of the probe, or an error.
+// The result is remembered, so calling it again does not talk to the probe.
+I1D3LIB_API int				I1D3LIB_CALL i1d3libUnLock(i1d3libDevice* dev);
+
+// Name of the probe flavour for a key index, e.g. "I1D3 OEM", or 0 if the index is out of range
+I1D3LIB_API const char*		I1D3LIB_CALL i1d3libKeyName(int key);
+
+// Reads len bytes starting at addr from either eeprom.  The probe must be unlocked.
+I1D3LIB_API int				I1D3LIB_CALL i1d3libReadEeprom(i1d3libDevice* dev, int eeprom, unsigned int addr, unsigned int len, unsigned char* buf);
+
+// Writes len bytes starting at addr to either eeprom.  The probe must be unlocked and writing enabled.
+I1D3LIB_API int				I1D3LIB_CALL i1d3libWriteEeprom(i1d3libDevice* dev, int eeprom, unsigned int addr, unsigned int len, const unsigned char* buf);
+
+// Allows eeprom writes until the probe is unplugged.  Returns I1D3LIB_ERR_COMMAND if the probe refused.
+I1D3LIB_API int				I1D3LIB_CALL i1d3libEnableWrite(i1d3libDevice* dev);
+
+// Version 2.  Frequency measurement, the raw sensor edge counts of the three channels.  inttime is the integration
+// time in seconds and is rounded to the probe's clock.  The probe must be unlocked.
+I1D3LIB_API int				I1D3LIB_CALL i1d3libMeasure(i1d3libDevice* dev, double* inttime, double* counts);
+
+// Checksum of an 8192 byte external eeprom image, stored little endian at offset 2.
+// alt selects the layout of early (rev1) probes.
+I1D3LIB_API unsigned int	I1D3LIB_CALL i1d3libChecksum(const unsigned char* eeprom, int alt);
+
+// Returns 1 if the image's stored checksum matches either layout, otherwise 0
+I1D3LIB_API int				I1D3LIB_CALL i1d3libChecksumValid(const unsigned char* eeprom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
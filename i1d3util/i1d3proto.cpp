@@ -0,0 +1,2915 @@
+/*
+ * i1d3proto.cpp
+ *
+ * i1d3 probe protocol, see i1d3proto.h
+ *
+ * This material is licenced under the GNU GENERAL PUBLIC LICENSE Version 2 or later :-
+ * see the License.txt file for licencing details.
+ *
+ *
+ */
+
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <setupapi.h>
+#include <cfgmgr32.h>
+
+#include <math.h>
+#include <ctype.h>
+#include <iostream>
+#include <fstream>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SPECTRAL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#include <cpuid.h>
+#define AVX2_TARGET		__attribute__((target("avx2,fma")))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include "i1d3proto.h"
+
+
+using namespace std;
+
+
+// Every revision seen so far takes the sizes this tool has always used
+const i1d3Caps i1d3CapsTable[] =
+{
+	{ 100, 299,		59, 32, 32,		60, 32, 32 },
+};
+
+#define I1D3_NUM_CAPS	(sizeof(i1d3CapsTable) / sizeof(i1d3CapsTable[0]))
+
+// For unknown firmware.  Reads are raised to the full size if a readback shows they work.
+const i1d3Caps i1d3CapsSafe = { 0, 0,	16, 16, 16,		16, 16, 16 };
+
+
+/* Declartions to enable HID access without using the DDK */
+typedef struct _HIDD_ATTRIBUTES
+{
+	ULONG	Size;
+	USHORT	VendorID;
+	USHORT	ProductID;
+	USHORT	VersionNumber;
+} HIDD_ATTRIBUTES, *PHIDD_ATTRIBUTES;
+
+typedef void (__stdcall *FP_HidD_GetHidGuid)   (LPGUID HidGuid);
+typedef BOOL (__stdcall *FP_HidD_GetAttributes)(HANDLE , PHIDD_ATTRIBUTES Attributes);
+typedef BOOLEAN (__stdcall *FP_HidD_SetNumInputBuffers)(HANDLE, ULONG NumberBuffers);
+typedef BOOLEAN (__stdcall *FP_HidD_FlushQueue)(HANDLE);
+FP_HidD_GetHidGuid    HidD_GetHidGuid;
+FP_HidD_GetAttributes HidD_GetAttributes;
+FP_HidD_SetNumInputBuffers HidD_SetNumInputBuffers;	// optional, only used by the queued transport
+FP_HidD_FlushQueue    HidD_FlushQueue;
+
+int hidQueueDepth(0);
+
+HINSTANCE loadDLLfuncs()
+{
+	static HINSTANCE lib(0);
+
+	if(!lib)
+	{
+		lib = LoadLibrary("HID");
+		if(lib)
+		{
+			HidD_GetHidGuid    = (FP_HidD_GetHidGuid)    GetProcAddress(lib, "HidD_GetHidGuid");
+			HidD_GetAttributes = (FP_HidD_GetAttributes) GetProcAddress(lib, "HidD_GetAttributes");
+			HidD_SetNumInputBuffers = (FP_HidD_SetNumInputBuffers) GetProcAddress(lib, "HidD_SetNumInputBuffers");
+			HidD_FlushQueue    = (FP_HidD_FlushQueue)    GetProcAddress(lib, "HidD_FlushQueue");
+		}
+
+		if((HidD_GetHidGuid == 0) || (HidD_GetAttributes == 0)) lib = 0;
+	}
+
+	return lib;
+}
+
+
+// The device instance id is the middle of an interface path with \ for #, e.g.
+// \\?\hid#vid_0765&pid_5020#7&1a2b3c4d&0&0000#{4d1e55b2-f16f-11cf-88cb-001111000030}
+bool hidInstanceId(const char* path, char* instanceId, int len)
+{
+	if(strncmp(path, "\\\\?\\", 4) != 0) return false;
+	path += 4;
+
+	const char* end = strrchr(path, '#');
+	if(!end || end - path >= len) return false;
+
+	int n(0);
+	for(; path < end; path++, n++) instanceId[n] = (*path == '#') ? '\\' : *path;
+	instanceId[n] = 0;
+
+	return true;
+}
+
+
+// Makes a device from a HID interface path if it is an i1d3's, otherwise returns 0.  The case of the path varies.
+hidIdevice* hidProbeFromPath(const char* path)
+{
+	const char* cPtr = path;
+	for(; *cPtr; cPtr++)
+	{
+		if(_strnicmp(cPtr, "vid_0765&pid_", 13) == 0) break;
+	}
+	if(!*cPtr) return 0;
+
+	//Is it an X-Rite i1DisplayPro, ColorMunki Display (HID)
+	unsigned int ProductID(0);
+	if(sscanf(cPtr + 13, "%4x", &ProductID) != 1) return 0;
+	if((ProductID != 0x5020) && (ProductID != 0x5021)) return 0;
+
+	char instanceId[MAX_DEVICE_ID_LEN];
+	DEVINST devInst(0);
+	if(!hidInstanceId(path, instanceId, MAX_DEVICE_ID_LEN)) return 0;
+	if(CM_Locate_DevNode(&devInst, instanceId, CM_LOCATE_DEVNODE_NORMAL) != CR_SUCCESS) return 0;
+
+	hidIdevice* hidDev = new hidIdevice;
+	hidDev->dpath = new char[strlen(path) + 1];
+	strcpy(hidDev->dpath, path);
+	hidDev->ProductID = ProductID;
+	hidDev->devInst = devInst;
+
+	return hidDev;
+}
+
+
+// Path of fileName in the directory of the executable
+bool exeDirPath(const char* fileName, char* path, int len)
+{
+	DWORD n = GetModuleFileName(NULL, path, len);
+	if(n == 0 || n >= (DWORD)len) return false;
+
+	char* slash = strrchr(path, '\\');
+	if(!slash || (slash - path) + strlen(fileName) + 2 > (size_t)len) return false;
+	strcpy(slash + 1, fileName);
+
+	return true;
+}
+
+
+// The cache is kept per user in %LOCALAPPDATA%, or next to the executable without it, rather than in whatever
+// directory the tool or the program using the dll happens to be run from
+bool deviceCachePath(char* path, int len)
+{
+	DWORD n = GetEnvironmentVariable("LOCALAPPDATA", path, len);
+	if(n == 0 || n >= (DWORD)len) return exeDirPath(DEVICE_CACHE_FILE, path, len);
+
+	if(strlen(path) + strlen(DEVICE_CACHE_FILE) + 2 > (size_t)len) return false;
+	strcat(path, "\\");
+	strcat(path, DEVICE_CACHE_FILE);
+
+	return true;
+}
+
+
+// Only written when the probes found are not the ones listed, so searches that keep finding the same probes, such
+// as the polling of hidFindAtPort, leave it alone.  A search that stopped at maxDevs only rewrites it for a probe
+// that is missing from it.
+void saveDeviceCache(hidIdevice** devs, int numDevs, bool complete)
+{
+	char fileName[MAX_PATH];
+	if(!deviceCachePath(fileName, MAX_PATH)) return;
+
+	char ids[MAX_PROBES][MAX_DEVICE_ID_LEN];
+	int numIds(0);
+	for(int i(0); i < numDevs && numIds < MAX_PROBES; i++)
+	{
+		if(hidInstanceId(devs[i]->dpath, ids[numIds], MAX_DEVICE_ID_LEN)) numIds++;
+	}
+
+	int numCached(0), numListed(0);
+	FILE* fp = fopen(fileName, "r");
+	if(fp)
+	{
+		char instanceId[MAX_DEVICE_ID_LEN + 2];
+		while(fgets(instanceId, sizeof(instanceId), fp))
+		{
+			instanceId[strcspn(instanceId, "\r\n")] = 0;
+			numCached++;
+
+			for(int i(0); i < numIds; i++)
+			{
+				if(_stricmp(ids[i], instanceId) == 0)
+				{
+					numListed++;
+					break;
+				}
+			}
+		}
+		fclose(fp);
+	}
+
+	if(numListed == numIds && (!complete || numCached == numIds)) return;
+
+	fp = fopen(fileName, "w");
+	if(!fp) return;
+
+	for(int i(0); i < numIds; i++) fprintf(fp, "%s\n", ids[i]);
+
+	fclose(fp);
+}
+
+
+// Finds up to maxDevs attached i1d3 probes, returns the number found or -1 on error
+int findHIDdevices(hidIdevice** devs, int maxDevs)
+{
+	// Get the GUID for HIDClass devices
+	GUID HidGuid;
+	HidD_GetHidGuid(&HidGuid);
+
+	// One call lists the paths of all present HID interfaces, so each unrelated device only costs a string compare
+	char* list(0);
+	CONFIGRET cr;
+
+	do
+	{
+		ULONG len(0);
+		if(CM_Get_Device_Interface_List_Size(&len, &HidGuid, NULL, CM_GET_DEVICE_INTERFACE_LIST_PRESENT) != CR_SUCCESS) return -1;
+
+		list = new char[len];
+		cr = CM_Get_Device_Interface_List(&HidGuid, NULL, list, len, CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+		if(cr != CR_SUCCESS)
+		{
+			delete[] list;
+			list = 0;
+		}
+	}
+	while(cr == CR_BUFFER_SMALL);	// an interface arrived between the two calls
+
+	if(!list) return -1;
+
+	int numDevs(0);
+
+	for(char* path = list; *path && numDevs < maxDevs; path += strlen(path) + 1)
+	{
+		hidIdevice* hidDev = hidProbeFromPath(path);
+		if(hidDev) devs[numDevs++] = hidDev;
+	}
+
+	delete[] list;
+
+	// the list was cut short if the search stopped at maxDevs
+	if(numDevs > 0) saveDeviceCache(devs, numDevs, numDevs < maxDevs);
+
+    return numDevs;
+}
+
+
+// Tries the probes found last time, which only costs a lookup per probe however many HID devices there are
+hidIdevice* findCachedHIDdevice()
+{
+	GUID HidGuid;
+	HidD_GetHidGuid(&HidGuid);
+
+	char fileName[MAX_PATH];
+	if(!deviceCachePath(fileName, MAX_PATH)) return 0;
+
+	FILE* fp = fopen(fileName, "r");
+	if(!fp) return 0;
+
+	char instanceId[MAX_DEVICE_ID_LEN + 2];
+	hidIdevice* hidDev(0);
+
+	while(!hidDev && fgets(instanceId, sizeof(instanceId), fp))
+	{
+		instanceId[strcspn(instanceId, "\r\n")] = 0;
+
+		// a device that is not present has no interfaces listed
+		char path[512];
+		memset(path, 0x00, sizeof(path));
+		if(CM_Get_Device_Interface_List(&HidGuid, instanceId, path, sizeof(path), CM_GET_DEVICE_INTERFACE_LIST_PRESENT) != CR_SUCCESS) continue;
+
+		if(path[0]) hidDev = hidProbeFromPath(path);
+	}
+
+	fclose(fp);
+
+	return hidDev;
+}
+
+
+hidIdevice* findHIDdevice()
+{
+	hidIdevice* hidDev = findCachedHIDdevice();
+	if(hidDev) return hidDev;
+
+	if(findHIDdevices(&hidDev, 1) <= 0) return 0;
+
+	return hidDev;
+}
+
+
+/* Queued transport */
+// The plain transport issues a read for each reply once the command has been written, so every report
+// waits for a read to be posted and completed through the HID class driver.  The queued transport keeps
+// several reads posted at all times and gives the class driver more buffers, so a reply is taken from
+// a read that has already completed.
+
+bool hidQueueRead(hidIdevice* dev, int i)
+{
+	memset(dev->qbuf[i], 0x00, 65);
+
+	return ReadFile(dev->fh, dev->qbuf[i], 65, NULL, &dev->qols[i]) != 0 || GetLastError() == ERROR_IO_PENDING;
+}
+
+
+bool hidStartQueue(hidIdevice* dev, int depth)
+{
+	if(depth > HID_QUEUE_DEPTH) depth = HID_QUEUE_DEPTH;
+
+	if(HidD_SetNumInputBuffers) HidD_SetNumInputBuffers(dev->fh, HID_NUM_BUFFERS);
+	if(HidD_FlushQueue) HidD_FlushQueue(dev->fh);
+
+	for(int i(0); i < depth; i++)
+	{
+		memset(&dev->qols[i], 0, sizeof(OVERLAPPED));
+		dev->qols[i].hEvent = CreateEvent(NULL, 0, 0, NULL);
+		if(dev->qols[i].hEvent == NULL) return false;
+	}
+
+	dev->queueDepth = depth;
+	dev->qhead = 0;
+
+	for(int i(0); i < depth; i++)
+	{
+		if(!hidQueueRead(dev, i)) return false;
+	}
+
+	return true;
+}
+
+
+// Cancels the queued reads and waits for them to finish, so none can complete into a later command
+void hidDrainQueue(hidIdevice* dev)
+{
+	DWORD num;
+
+	CancelIoEx(dev->fh, NULL);
+	for(int i(0); i < dev->queueDepth; i++)
+	{
+		GetOverlappedResult(dev->fh, &dev->qols[i], &num, TRUE);
+	}
+}
+
+
+// After a timeout a late reply could still land in the queue and be taken as the answer to the next command
+void hidRestartQueue(hidIdevice* dev)
+{
+	hidDrainQueue(dev);
+
+	if(HidD_FlushQueue) HidD_FlushQueue(dev->fh);
+
+	dev->qhead = 0;
+	for(int i(0); i < dev->queueDepth; i++) hidQueueRead(dev, i);
+}
+
+
+// Takes the report from the head read once its event has been signalled, and posts the read again.
+// lBuf gets the report id byte then the report.  Returns the number of bytes or -1.
+int hidQueuePop(hidIdevice* dev, unsigned char* lBuf)
+{
+	DWORD num(0);
+	int i = dev->qhead;
+
+	if(!GetOverlappedResult(dev->fh, &dev->qols[i], &num, FALSE)) num = 0;
+	if(num > 0) memcpy(lBuf, dev->qbuf[i], num);
+
+	hidQueueRead(dev, i);
+	dev->qhead = (i + 1) % dev->queueDepth;
+
+	return (num > 0) ? (int)num : -1;
+}
+
+
+bool openHIDdevice(hidIdevice* dev)
+{
+	// Open the device
+	dev->fh = CreateFile(dev->dpath, GENERIC_READ|GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+
+	if(dev->fh != INVALID_HANDLE_VALUE)
+	{
+		memset(&dev->ols,0,sizeof(OVERLAPPED));
+		dev->ols.hEvent = CreateEvent(NULL, 0, 0, NULL);
+  		if(dev->ols.hEvent == NULL) return false;
+
+		if(hidQueueDepth > 0) return hidStartQueue(dev, hidQueueDepth);
+		
+		return true;
+	}
+
+	return false;
+}
+
+
+void closeHIDdevice(hidIdevice* dev)
+{
+	if(dev != NULL && dev->replay == NULL && dev->emu == NULL)
+	{
+		if(dev->queueDepth)
+		{
+			hidDrainQueue(dev);
+			for(int i(0); i < dev->queueDepth; i++) CloseHandle(dev->qols[i].hEvent);
+			dev->queueDepth = 0;
+		}
+
+		CloseHandle(dev->ols.hEvent);
+		CloseHandle(dev->fh);
+	}
+}
+
+
+// For when one of several probes fails to open, closes the numOpen opened before it and frees them all
+void closeHIDdevices(hidIdevice** devs, int numOpen, int numDevs)
+{
+	for(int i(0); i < numDevs; i++)
+	{
+		if(i < numOpen) closeHIDdevice(devs[i]);
+		delete devs[i];
+	}
+}
+
+
+double timeNow()
+{
+	static double freq(0.0);
+
+	LARGE_INTEGER li;
+	if(freq == 0.0)
+	{
+		QueryPerformanceFrequency(&li);
+		freq = (double)li.QuadPart;
+	}
+
+	QueryPerformanceCounter(&li);
+
+	return (double)li.QuadPart / freq;
+}
+
+
+unsigned char* readWholeFile(const char* fileName, unsigned int* size)
+{
+	HANDLE hd = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if(hd == INVALID_HANDLE_VALUE) return 0;
+
+	DWORD sz = GetFileSize(hd, NULL);
+	if(sz == INVALID_FILE_SIZE)
+	{
+		CloseHandle(hd);
+		return 0;
+	}
+
+	// zero terminated so text files can be parsed in place
+	unsigned char* buf = new unsigned char[sz + 1];
+	memset(buf, 0x00, sz + 1);
+
+	DWORD noRead(0);
+	if(!ReadFile(hd, buf, sz, &noRead, NULL) || noRead != sz)
+	{
+		CloseHandle(hd);
+		delete[] buf;
+		return 0;
+	}
+
+	CloseHandle(hd);
+
+	*size = sz;
+	return buf;
+}
+
+
+/* Re-enumeration */
+// A probe has to re-enumerate after its eeproms are written, and when it comes up as 0x5021.  Rather than ask
+// for it to be unplugged, the hub port it is on is cycled, which needs administrator rights.  Failing that the
+// USB device is restarted.  The probe is found again at the same hub and port, as its product id may change.
+
+// Declarations from usbioctl.h and usbiodef.h
+#define IOCTL_USB_HUB_CYCLE_PORT	0x220444
+
+struct USB_CYCLE_PORT_PARAMS
+{
+	ULONG	ConnectionIndex;
+	ULONG	StatusReturned;
+};
+
+GUID usbHubGuid = { 0xf18a0e88, 0xc30c, 0x11d0, { 0x88, 0x15, 0x00, 0xa0, 0xc9, 0x06, 0xbe, 0xd8 } };
+
+#define REENUM_TIMEOUT		10.0	// seconds to wait for the probe to come back
+#define REENUM_POLL			50		// ms between checks when arrival notifications are not available
+
+
+// The hub and port a probe is plugged into.  The HID node's parent is the USB device, whose parent is the hub.
+bool hidPortOf(DWORD devInst, DEVINST* hub, ULONG* port)
+{
+	DEVINST usbDev;
+	ULONG len = sizeof(ULONG);
+
+	if(CM_Get_Parent(&usbDev, devInst, 0) != CR_SUCCESS) return false;
+	if(CM_Get_Parent(hub, usbDev, 0) != CR_SUCCESS) return false;
+	if(CM_Get_DevNode_Registry_Property(usbDev, CM_DRP_ADDRESS, NULL, port, &len, 0) != CR_SUCCESS) return false;
+
+	return true;
+}
+
+
+bool hidCyclePort(DEVINST hub, ULONG port)
+{
+	char hubId[MAX_DEVICE_ID_LEN];
+	if(CM_Get_Device_ID(hub, hubId, MAX_DEVICE_ID_LEN, 0) != CR_SUCCESS) return false;
+
+	ULONG len(0);
+	if(CM_Get_Device_Interface_List_Size(&len, &usbHubGuid, hubId, CM_GET_DEVICE_INTERFACE_LIST_PRESENT) != CR_SUCCESS || len <= 1) return false;
+
+	char* list = new char[len];
+	if(CM_Get_Device_Interface_List(&usbHubGuid, hubId, list, len, CM_GET_DEVICE_INTERFACE_LIST_PRESENT) != CR_SUCCESS)
+	{
+		delete[] list;
+		return false;
+	}
+
+	HANDLE hd = CreateFile(list, GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	delete[] list;
+	if(hd == INVALID_HANDLE_VALUE) return false;
+
+	USB_CYCLE_PORT_PARAMS cp;
+	cp.ConnectionIndex = port;
+	cp.StatusReturned = 0;
+
+	DWORD num(0);
+	BOOL res = DeviceIoControl(hd, IOCTL_USB_HUB_CYCLE_PORT, &cp, sizeof(cp), &cp, sizeof(cp), &num, NULL);
+
+	CloseHandle(hd);
+
+	return res != 0;
+}
+
+
+// Stops and restarts the USB device node, as a property change in Device Manager does
+bool hidRestartDevice(DWORD devInst)
+{
+	DEVINST usbDev;
+	char usbId[MAX_DEVICE_ID_LEN];
+
+	if(CM_Get_Parent(&usbDev, devInst, 0) != CR_SUCCESS) return false;
+	if(CM_Get_Device_ID(usbDev, usbId, MAX_DEVICE_ID_LEN, 0) != CR_SUCCESS) return false;
+
+	HDEVINFO hdinfo = SetupDiCreateDeviceInfoList(NULL, NULL);
+	if(hdinfo == INVALID_HANDLE_VALUE) return false;
+
+	SP_DEVINFO_DATA dinfoData;
+	dinfoData.cbSize = sizeof(SP_DEVINFO_DATA);
+
+	SP_PROPCHANGE_PARAMS pcp;
+	pcp.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
+	pcp.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
+	pcp.StateChange = DICS_PROPCHANGE;
+	pcp.Scope = DICS_FLAG_GLOBAL;
+	pcp.HwProfile = 0;
+
+	bool res = SetupDiOpenDeviceInfo(hdinfo, usbId, NULL, 0, &dinfoData)
+			&& SetupDiSetClassInstallParams(hdinfo, &dinfoData, &pcp.ClassInstallHeader, sizeof(pcp))
+			&& SetupDiCallClassInstaller(DIF_PROPERTYCHANGE, hdinfo, &dinfoData);
+
+	SetupDiDestroyDeviceInfoList(hdinfo);
+
+	return res;
+}
+
+
+// Finds the probe plugged into a given hub port, or 0
+hidIdevice* hidFindAtPort(DEVINST hub, ULONG port)
+{
+	hidIdevice* devs[MAX_PROBES];
+	hidIdevice* found(0);
+
+	int numDevs = findHIDdevices(devs, MAX_PROBES);
+
+	for(int i(0); i < numDevs; i++)
+	{
+		DEVINST h;
+		ULONG p;
+
+		if(!found && hidPortOf(devs[i]->devInst, &h, &p) && h == hub && p == port) found = devs[i];
+		else delete devs[i];
+	}
+
+	return found;
+}
+
+
+// Right after the reset the old interface can still be listed at the same hub and port, so nothing found there
+// counts until the old one has been seen to go
+struct reenumWait
+{
+	HANDLE			changed;
+	const char*		oldPath;
+	volatile LONG	removed;
+};
+
+
+// Interface paths are ASCII, compare the wide one a notification carries with ours regardless of case
+bool hidSameLink(const WCHAR* link, const char* path)
+{
+	for(; *link && *path; link++, path++)
+	{
+		if(*link > 0x7f || tolower(*link) != tolower((unsigned char)*path)) return false;
+	}
+
+	return *link == 0 && *path == 0;
+}
+
+
+// A zero access open succeeds for as long as the interface exists
+bool hidInterfacePresent(const char* path)
+{
+	HANDLE hd = CreateFile(path, 0, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if(hd == INVALID_HANDLE_VALUE) return false;
+
+	CloseHandle(hd);
+	return true;
+}
+
+
+DWORD CALLBACK hidInterfaceChange(HCMNOTIFICATION notify, PVOID context, CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA data, DWORD size)
+{
+	reenumWait* wait = (reenumWait*)context;
+
+	if(action == CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL && hidSameLink(data->u.DeviceInterface.SymbolicLink, wait->oldPath)) wait->removed = 1;
+
+	if(action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL || action == CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL) SetEvent(wait->changed);
+
+	return ERROR_SUCCESS;
+}
+
+
+// Resets the probe and waits for it to come back, then replaces *dev with it, opened.  Returns false if the probe
+// could not be reset or did not return in time, in which case it has to be unplugged by hand.
+bool i1d3Reenumerate(hidIdevice** dev)
+{
+	hidIdevice* old = *dev;
+
+	if(old->replay || old->emu) return false;
+
+	DEVINST hub;
+	ULONG port;
+	if(!hidPortOf(old->devInst, &hub, &port)) return false;
+
+	// register for HID arrivals and removals before the reset so neither can be missed, without it poll
+	reenumWait wait;
+	wait.changed = CreateEvent(NULL, 0, 0, NULL);
+	wait.oldPath = old->dpath;
+	wait.removed = 0;
+
+	CM_NOTIFY_FILTER filter;
+	memset(&filter, 0x00, sizeof(filter));
+	filter.cbSize = sizeof(filter);
+	filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+	HidD_GetHidGuid(&filter.u.DeviceInterface.ClassGuid);
+
+	// with no event to wake the wait there is no point in notifications, it polls
+	HCMNOTIFICATION notify(0);
+	if(!wait.changed || CM_Register_Notification(&filter, &wait, hidInterfaceChange, &notify) != CR_SUCCESS) notify = 0;
+
+	closeHIDdevice(old);
+
+	hidIdevice* found(0);
+
+	if(hidCyclePort(hub, port) || hidRestartDevice(old->devInst))
+	{
+		double until = timeNow() + REENUM_TIMEOUT;
+
+		while(!found && timeNow() < until)
+		{
+			DWORD ms = notify ? (DWORD)((until - timeNow()) * 1000.0) + 1 : REENUM_POLL;
+			if(wait.changed) WaitForSingleObject(wait.changed, ms);
+			else Sleep(REENUM_POLL);
+
+			// polled as well for when there are no notifications
+			if(!wait.removed && !hidInterfacePresent(old->dpath)) wait.removed = 1;
+
+			if(wait.removed) found = hidFindAtPort(hub, port);
+		}
+	}
+
+	if(notify) CM_Unregister_Notification(notify);
+	if(wait.changed) CloseHandle(wait.changed);
+
+	if(found && !openHIDdevice(found))
+	{
+		delete found;
+		found = 0;
+	}
+
+	if(!found)
+	{
+		// leave the caller with the old device, open again if it is still there
+		openHIDdevice(old);
+		return false;
+	}
+
+	// same probe, same firmware
+	found->caps = old->caps;
+	memcpy(found->darkHz, old->darkHz, sizeof(old->darkHz));
+	found->traceProbe = old->traceProbe;
+
+	delete old;
+	*dev = found;
+
+	return true;
+}
+
+
+// After a write the probe must re-enumerate before the new contents take effect
+void i1d3ResetAfterWrite(hidIdevice** dev)
+{
+	if(i1d3Reenumerate(dev)) cout << "The probe has been reset" << endl;
+	else cout << "Now unplug and plugin the USB connection" << endl;
+}
+
+
+/* Emulated probe */
+// Sleep for whole milliseconds then spin, Sleep alone is far too coarse for a 1ms USB frame
+void spinWait(double secs)
+{
+	double until = timeNow() + secs;
+
+	if(secs > 0.002) Sleep((DWORD)((secs - 0.002) * 1000.0));
+	while(timeNow() < until);
+}
+
+
+/* Recording and replay of HID reports */
+// A trace is a header followed by one record per 64 byte report, or per read that came back without one:
+// u32 microseconds since the trace started, u8 direction, u8 probe, u8 length, then the report data.
+// The probe byte tells apart the probes of a multi-probe session (-a, -h), a replay plays back probe 0.
+// Traces from before it was added (i1d3trc1) have no probe byte and only ever hold one probe.
+struct hidTraceHeader
+{
+	char			magic[8];
+	unsigned int	ProductID;
+};
+
+
+hidTrace* hidRecord(0);
+
+
+bool hidTrace::create(const char* fileName, unsigned int pid)
+{
+	fh = CreateFile(fileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	if(fh == INVALID_HANDLE_VALUE) return false;
+
+	hidTraceHeader hdr;
+	memset(&hdr, 0x00, sizeof(hdr));
+	memcpy(hdr.magic, "i1d3trc2", 8);
+	hdr.ProductID = ProductID = pid;
+
+	DWORD noWritten(0);
+	if(!WriteFile(fh, &hdr, sizeof(hdr), &noWritten, NULL) || noWritten != sizeof(hdr))
+	{
+		close();
+		return false;
+	}
+
+	start = timeNow();
+
+	return true;
+}
+
+
+bool hidTrace::load(const char* fileName, bool recordedTiming)
+{
+	buf = readWholeFile(fileName, &size);
+	if(!buf) return false;
+
+	if(size < sizeof(hidTraceHeader) || (memcmp(buf, "i1d3trc1", 8) != 0 && memcmp(buf, "i1d3trc2", 8) != 0))
+	{
+		close();
+		return false;
+	}
+
+	recHdr = (buf[7] == '1') ? 6 : 7;
+	ProductID = ((hidTraceHeader*)buf)->ProductID;
+	pos = sizeof(hidTraceHeader);
+	realTime = recordedTiming;
+
+	return true;
+}
+
+
+void hidTrace::close()
+{
+	if(fh != INVALID_HANDLE_VALUE) CloseHandle(fh);
+	if(buf) delete[] buf;
+
+	fh = INVALID_HANDLE_VALUE;
+	buf = 0;
+}
+
+
+// The product id is only known once the probe is open, after the trace has been started
+void hidTrace::setProductID(unsigned int pid)
+{
+	ProductID = pid;
+
+	DWORD noWritten(0);
+	SetFilePointer(fh, offsetof(hidTraceHeader, ProductID), NULL, FILE_BEGIN);
+	WriteFile(fh, &ProductID, sizeof(ProductID), &noWritten, NULL);
+	SetFilePointer(fh, 0, NULL, FILE_END);
+}
+
+
+void hidTrace::record(int probe, int dir, unsigned char* data, int len)
+{
+	unsigned char rec[7 + 255];
+
+	unsigned int t = (unsigned int)((timeNow() - start) * 1e6);
+	if(len > 255) len = 255;
+
+	rec[0] = (t >>  0) & 0xff;
+	rec[1] = (t >>  8) & 0xff;
+	rec[2] = (t >> 16) & 0xff;
+	rec[3] = (t >> 24) & 0xff;
+	rec[4] = (unsigned char)dir;
+	rec[5] = (unsigned char)probe;
+	rec[6] = (unsigned char)len;
+	if(len > 0) memcpy(rec + 7, data, len);
+
+	DWORD noWritten(0);
+	WriteFile(fh, rec, 7 + len, &noWritten, NULL);
+}
+
+
+// Finds the next complete record of probe 0 without consuming it, records of other probes are passed over
+bool hidTrace::nextRecord(unsigned char** rec)
+{
+	while(pos + recHdr <= size)
+	{
+		unsigned char* r = buf + pos;
+		unsigned int rlen = r[recHdr - 1];
+		if(pos + recHdr + rlen > size) return false;
+
+		if(recHdr == 6 || r[5] == 0)
+		{
+			*rec = r;
+			return true;
+		}
+
+		pos += recHdr + rlen;
+	}
+
+	return false;
+}
+
+
+int hidTrace::replayWrite(unsigned char* data, int len)
+{
+	if(start == 0.0) start = timeNow();
+
+	// skip to the next report that was sent, any unread replies in between are dropped
+	unsigned char* rec;
+	while(nextRecord(&rec))
+	{
+		int rlen = rec[recHdr - 1];
+		pos += recHdr + rlen;
+
+		if(rec[4] == TRACE_OUT)
+		{
+			if(rlen != len || memcmp(rec + recHdr, data, len) != 0)
+			{
+				if(numMismatch++ == 0) cout << "Warning: replay diverges from the trace at byte " << pos - recHdr - rlen << endl;
+			}
+
+			return len;
+		}
+	}
+
+	return -1;
+}
+
+
+// A read that timed out or failed when the trace was made does so again, after the same wait
+int hidTrace::replayRead(unsigned char* data, int len)
+{
+	if(start == 0.0) start = timeNow();
+
+	unsigned char* rec;
+	if(!nextRecord(&rec) || rec[4] == TRACE_OUT) return -1;
+
+	int rlen = rec[recHdr - 1];
+	pos += recHdr + rlen;
+
+	if(realTime)
+	{
+		double due = start + (rec[0] | (rec[1] << 8) | (rec[2] << 16) | ((unsigned int)rec[3] << 24)) / 1e6;
+		double now = timeNow();
+		if(due > now) Sleep((DWORD)((due - now) * 1000.0));
+	}
+
+	if(rec[4] != TRACE_IN) return -1;
+
+	if(rlen > len) rlen = len;
+	memcpy(data, rec + recHdr, rlen);
+
+	return rlen;
+}
+
+
+void closeTrace()
+{
+	if(hidRecord) delete hidRecord;
+	hidRecord = 0;
+}
+
+
+/* Probe commands */
+int	readHIDdevice(hidIdevice* dev, unsigned char* rbuf,	int numToRead, double timeout)
+{
+	if(dev->replay) return dev->replay->replayRead(rbuf, numToRead);
+	if(dev->emu) return dev->emu->read(rbuf, numToRead);
+
+	if(dev->queueDepth)
+	{
+		unsigned char lBuf[65];
+
+		if(WaitForSingleObject(dev->qols[dev->qhead].hEvent, (int)(timeout * 1000.0 + 0.5)) != WAIT_OBJECT_0)
+		{
+			if(hidRecord) hidRecord->record(dev->traceProbe, TRACE_TIMEOUT, 0, 0);
+			hidRestartQueue(dev);
+			return -1;
+		}
+
+		int numRead = hidQueuePop(dev, lBuf) - 1;
+		if(numRead <= 0)
+		{
+			if(hidRecord) hidRecord->record(dev->traceProbe, TRACE_FAILED, 0, 0);
+			return -1;
+		}
+		if(numRead > numToRead) numRead = numToRead;
+
+		memcpy(rbuf, lBuf + 1, numRead);
+		if(hidRecord) hidRecord->record(dev->traceProbe, TRACE_IN, rbuf, numRead);
+
+		return numRead;
+	}
+
+	int numRead(0);
+	bool timedOut(false);
+
+	unsigned char* lBuf;
+	lBuf = new unsigned char[numToRead + 1];
+	if(!lBuf) return -1;
+	memset(lBuf, 0x00, numToRead + 1);
+
+	if (ReadFile(dev->fh, lBuf, numToRead + 1, (LPDWORD)&numRead, &dev->ols) == 0)
+	{
+		if(GetLastError() != ERROR_IO_PENDING)
+		{
+			numRead = -1; 
+		}
+		else
+		{
+			int res;
+			res = WaitForSingleObject(dev->ols.hEvent, (int)(timeout * 1000.0 + 0.5));
+			if(res == WAIT_FAILED)
+			{
+				numRead = -1;
+			}
+			else if
+			(res == WAIT_TIMEOUT)
+			{
+				CancelIo(dev->fh);
+				numRead = -1;
+				timedOut = true;
+			}
+			else
+			{
+				numRead = dev->ols.InternalHigh;
+			}
+		}
+	}
+
+	if(numRead > 0)
+	{
+		numRead--;
+		memcpy(rbuf, lBuf + 1, numRead);
+
+		if(hidRecord) hidRecord->record(dev->traceProbe, TRACE_IN, rbuf, numRead);
+	}
+	else if(hidRecord) hidRecord->record(dev->traceProbe, timedOut ? TRACE_TIMEOUT : TRACE_FAILED, 0, 0);
+
+	delete[] lBuf;
+
+	return numRead;
+}
+
+
+int writeHIDdevice(hidIdevice* dev,	unsigned char* wbuf, int numToWrite, double timeout)
+{
+	if(dev->replay) return dev->replay->replayWrite(wbuf, numToWrite);
+	if(dev->emu) return dev->emu->write(wbuf, numToWrite);
+
+	if(hidRecord) hidRecord->record(dev->traceProbe, TRACE_OUT, wbuf, numToWrite);
+
+	int numWritten(0);
+
+	unsigned char* lBuf;
+	lBuf = new unsigned char[numToWrite + 1];
+	if(!lBuf) return -1;
+	memset(lBuf, 0x00, numToWrite + 1);
+	memcpy(lBuf + 1, wbuf, numToWrite);
+
+	if(WriteFile(dev->fh, lBuf, numToWrite + 1, (LPDWORD)&numWritten, &dev->ols) == 0)
+	{ 
+		if (GetLastError() != ERROR_IO_PENDING)
+		{
+			numWritten = -1; 
+		}
+		else
+		{
+			int res;
+			res = WaitForSingleObject(dev->ols.hEvent, (int)(timeout * 1000.0 + 0.5));
+			if (res == WAIT_FAILED)
+			{
+				numWritten = -1; 
+			}
+			else if (res == WAIT_TIMEOUT)
+			{
+				CancelIo(dev->fh);
+				numWritten = -1; 
+			}
+			else
+			{
+				numWritten = dev->ols.InternalHigh;
+			}
+		}
+	}
+
+	if(numWritten > 0)
+	{
+		numWritten--;
+	}
+
+	delete[] lBuf;
+
+	return numWritten;
+}
+
+
+int i1d3Command(hidIdevice* dev,unsigned short cmdCode, unsigned char* sBuf, unsigned char* rBuf, double timeout)
+{
+	unsigned char cmd;		/* Major command code */
+	int wbytes;				/* bytes written */
+	int rbytes;				/* bytes read from ep */
+	int num;
+
+	cmd = (cmdCode >> 8) & 0xff;	// Major command == HID report number
+	sBuf[0] = cmd;
+
+	if(cmd == 0x00) sBuf[1] = (cmdCode & 0xff);	// Minor command
+
+	num = writeHIDdevice(dev, sBuf, 64, timeout);
+	if(num == -1)
+	{
+		// flush any crap
+		num = readHIDdevice(dev, rBuf, 64, timeout);
+		return -1;
+	}
+
+	num = readHIDdevice(dev, rBuf, 64, timeout);
+	if(num == -1)
+	{
+		// flush any crap
+		num = readHIDdevice(dev, rBuf, 64, timeout);
+		return -1;
+	}
+
+	/* The first byte returned seems to be a command result error code. */
+	if((rBuf[0] != 0x00) || (rBuf[1] != cmd))
+	{
+		return -1;
+	}
+
+	return 0; 
+}
+
+
+int i1d3GetInfo(hidIdevice* dev, char* rBuf)
+{
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+	unsigned short cmd;
+
+	memset(tBuf, 0, 64);
+	memset(fBuf, 0, 64);
+
+	cmd = 0x0000;
+	int res = i1d3Command(dev, cmd, tBuf, fBuf);
+	
+	strncpy((char *)rBuf, (char *)fBuf + 2, 62);
+
+	return res;
+}
+
+
+// The eeprom access functions transfer len bytes starting at addr, split into packets the firmware will accept.
+// They return 0, or -1 if the probe rejected a command.
+int i1d3ReadExternalEepromRange(hidIdevice* dev, unsigned int addr, unsigned int len, unsigned char* buf)
+{
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+	unsigned short cmd;
+
+	if(addr + len > 8192) return -1;
+
+	memset(tBuf, 0, 64);
+	memset(fBuf, 0, 64);
+
+	cmd = 0x1200;
+
+	unsigned char* bPtr = buf;
+
+	// read up into 59 byte packets, or what the firmware allows
+	for(int inc(0); len > 0; addr += inc, bPtr += inc, len -= inc)
+	{
+		inc = len;
+		if(inc > dev->caps.extRead) inc = dev->caps.extRead;
+
+		tBuf[1]	= (addr >> 8) & 0xff;
+		tBuf[2] = addr & 0xff;
+		tBuf[3] = (unsigned char)inc;
+
+		if(i1d3Command(dev, cmd, tBuf, fBuf) < 0) return -1;
+	
+		memcpy(bPtr, fBuf + 5, inc);
+	}
+
+	return 0;
+}
+
+
+int i1d3WriteExternalEepromRange(hidIdevice* dev, unsigned int addr, unsigned int len, unsigned char* buf)
+{
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+	unsigned short cmd;
+
+	if(addr + len > 8192) return -1;
+
+	memset(tBuf, 0, 64);
+	memset(fBuf, 0, 64);
+
+	cmd = 0x1300;
+
+	unsigned char* bPtr = buf;
+
+	// write up into 32 byte packets that stay within an eeprom page
+	for(int inc(0); len > 0; addr += inc, bPtr += inc, len -= inc)
+	{
+		inc = len;
+		if(inc > dev->caps.extWrite) inc = dev->caps.extWrite;
+		int room = dev->caps.extPage - (int)(addr % dev->caps.extPage);
+		if(inc > room) inc = room;
+
+		tBuf[1]	= (addr >> 8) & 0xff;
+		tBuf[2] = addr & 0xff;
+		tBuf[3] = (unsigned char)inc;
+
+		memcpy(tBuf + 4, bPtr, inc);
+	
+		if(i1d3Command(dev, cmd, tBuf, fBuf) < 0) return -1;
+	}
+
+	return 0;
+}
+
+
+int i1d3ReadInternalEepromRange(hidIdevice* dev, unsigned int addr, unsigned int len, unsigned char* buf)
+{
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+	unsigned short cmd;
+
+	if(addr + len > 256) return -1;
+
+	memset(tBuf, 0, 64);
+	memset(fBuf, 0, 64);
+
+	cmd = 0x0800;
+
+	unsigned char* bPtr = buf;
+
+	// read up into 60 byte packets, or what the firmware allows
+	for(int inc(0); len > 0; addr += inc, bPtr += inc, len -= inc)
+	{
+		inc = len;
+		if(inc > dev->caps.intRead) inc = dev->caps.intRead;
+
+		tBuf[1]	= addr;
+		tBuf[2] = (unsigned char)inc;
+
+		if(i1d3Command(dev, cmd, tBuf, fBuf) < 0) return -1;
+	
+		memcpy(bPtr, fBuf + 4, inc);
+	}
+
+	return 0;
+}
+
+
+int i1d3WriteInternalEepromRange(hidIdevice* dev, unsigned int addr, unsigned int len, unsigned char* buf)
+{
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+	unsigned short cmd;
+
+	if(addr + len > 256) return -1;
+
+	memset(tBuf, 0, 64);
+	memset(fBuf, 0, 64);
+
+	cmd = 0x0700;
+
+	unsigned char* bPtr = buf;
+
+	// write up into 32 byte packets that stay within an eeprom page
+	for(int inc(0); len > 0; addr += inc, bPtr += inc, len -= inc)
+	{
+		inc = len;
+		if(inc > dev->caps.intWrite) inc = dev->caps.intWrite;
+		int room = dev->caps.intPage - (int)(addr % dev->caps.intPage);
+		if(inc > room) inc = room;
+
+		tBuf[1]	= addr;
+		tBuf[2] = (unsigned char)inc;
+	
+		memcpy(tBuf + 3, bPtr, inc);
+
+		if(i1d3Command(dev, cmd, tBuf, fBuf) < 0) return -1;
+	}
+
+	return 0;
+}
+
+
+// The firmware version in the information string as version * 100, e.g. 228 for 2.28, or 0 if there is none
+int i1d3ParseVersion(const char* info)
+{
+	for(const char* cPtr = info; *cPtr; cPtr++)
+	{
+		if(!isdigit((unsigned char)cPtr[0]) || (cPtr > info && isdigit((unsigned char)cPtr[-1]))) continue;
+
+		char* end;
+		int major = (int)strtol(cPtr, &end, 10);
+		if(end[0] != '.' || !isdigit((unsigned char)end[1])) continue;
+
+		int minor = (end[1] - '0') * 10;
+		if(isdigit((unsigned char)end[2])) minor += end[2] - '0';
+
+		return major * 100 + minor;
+	}
+
+	return 0;
+}
+
+
+// Picks the transfer sizes for the probe's firmware.  Unknown firmware gets the safe sizes until i1d3ProbeCaps
+// has tried the full read sizes, which needs the probe unlocked.  Returns the firmware version, caps.maxVersion
+// is 0 if it was not in the table.
+int i1d3DetectCaps(hidIdevice* dev)
+{
+	char info[64];
+	memset(info, 0x00, 64);
+	i1d3GetInfo(dev, info);
+
+	int version = i1d3ParseVersion(info);
+
+	for(unsigned int i(0); i < I1D3_NUM_CAPS; i++)
+	{
+		if(version >= i1d3CapsTable[i].minVersion && version <= i1d3CapsTable[i].maxVersion)
+		{
+			dev->caps = i1d3CapsTable[i];
+			return version;
+		}
+	}
+
+	dev->caps = i1d3CapsSafe;
+
+	return version;
+}
+
+
+// For unknown firmware, tries the full read sizes and keeps them only if they read back the same data as the safe
+// ones.  The eeproms cannot be read until the probe is unlocked, so i1d3UnLock calls this once it succeeds.  Write
+// sizes are never probed, a bad write could damage the eeprom.
+void i1d3ProbeCaps(hidIdevice* dev)
+{
+	if(dev->caps.maxVersion != 0 || dev->caps.extRead != i1d3CapsSafe.extRead || dev->caps.intRead != i1d3CapsSafe.intRead) return;
+
+	unsigned char safeBuf[256];
+	unsigned char fullBuf[256];
+
+	if(i1d3ReadExternalEepromRange(dev, 0, 256, safeBuf) == 0)
+	{
+		dev->caps.extRead = i1d3CapsTable[0].extRead;
+		if(i1d3ReadExternalEepromRange(dev, 0, 256, fullBuf) < 0 || memcmp(safeBuf, fullBuf, 256) != 0) dev->caps.extRead = i1d3CapsSafe.extRead;
+	}
+
+	if(i1d3ReadInternalEepromRange(dev, 0, 256, safeBuf) == 0)
+	{
+		dev->caps.intRead = i1d3CapsTable[0].intRead;
+		if(i1d3ReadInternalEepromRange(dev, 0, 256, fullBuf) < 0 || memcmp(safeBuf, fullBuf, 256) != 0) dev->caps.intRead = i1d3CapsSafe.intRead;
+	}
+}
+
+
+int i1d3ReadExternalEeprom(hidIdevice* dev,	unsigned char* buf)
+{
+	return i1d3ReadExternalEepromRange(dev, 0, 8192, buf);
+}
+
+
+int i1d3WriteExternalEeprom(hidIdevice* dev,	unsigned char* buf)
+{
+	return i1d3WriteExternalEepromRange(dev, 0, 8192, buf);
+}
+
+
+int i1d3ReadInternalEeprom(hidIdevice* dev,	unsigned char* buf)
+{
+	return i1d3ReadInternalEepromRange(dev, 0, 256, buf);
+}
+
+
+int i1d3WriteInternalEeprom(hidIdevice* dev,	unsigned char* buf)
+{
+	return i1d3WriteInternalEepromRange(dev, 0, 256, buf);
+}
+
+void i1d3CreateUnLockResponse(unsigned int k0, unsigned int k1, unsigned char* c, unsigned char* r)
+{
+//static void create_unlock_response(unsigned int *k, unsigned char *c, unsigned char *r) {
+
+	int i;
+	unsigned char sc[8], sr[16];	/* Sub-challeng and response */
+
+	/* Only 8 bytes is used out of challenge buffer starting at */
+	/* offset 35. Bytes are decoded with xor of byte 3 value. */
+	for (i = 0; i < 8; i++)
+		sc[i] = c[3] ^ c[35 + i];
+	
+	/* Combine 8 byte key with 16 byte challenge to create core 16 byte response */
+	{
+		unsigned int ci[2];		/* challenge as 4 ints */
+		unsigned int co[4];		/* product, difference of 4 ints */
+		unsigned int sum;		/* Sum of all input bytes */
+		unsigned char s0, s1;	/* Byte components of sum. */
+
+		/* Shuffle bytes into 32 bit ints to be able to use 32 bit computation. */
+		ci[0] = (sc[3] << 24)
+              + (sc[0] << 16)
+              + (sc[4] << 8)
+              + (sc[6]);
+
+		ci[1] = (sc[1] << 24)
+              + (sc[7] << 16)
+              + (sc[2] << 8)
+              + (sc[5]);
+	
+		/* Computation on the ints */
+		co[0] = -k0 - ci[1];
+		co[1] = -k1 - ci[0];
+		co[2] = ci[1] * -k0;
+		co[3] = ci[0] * -k1;
+	
+		/* Sum of challenge bytes */
+		for (sum = 0, i = 0; i < 8; i++)
+			sum += sc[i];
+
+		/* Minus the two key values as bytes */
+		sum += (0xff & -k0) + (0xff & (-k0 >> 8))
+	        +  (0xff & (-k0 >> 16)) + (0xff & (-k0 >> 24));
+		sum += (0xff & -k1) + (0xff & (-k1 >> 8))
+	        +  (0xff & (-k1 >> 16)) + (0xff & (-k1 >> 24));
+	
+		/* Convert sum to bytes. Only need 2, because sum of 16 bytes can't exceed 16 bits. */
+		s0 =  sum       & 0xff;
+		s1 = (sum >> 8) & 0xff;
+	
+		/* Final computation of 16 bytes from 4 ints + sum bytes */
+		sr[0] =  ((co[0] >> 16) & 0xff) + s0;
+		sr[1] =  ((co[2] >>  8) & 0xff) - s1;
+		sr[2] =  ( co[3]        & 0xff) + s1;
+		sr[3] =  ((co[1] >> 16) & 0xff) + s0;
+		sr[4] =  ((co[2] >> 16) & 0xff) - s1;
+		sr[5] =  ((co[3] >> 16) & 0xff) - s0;
+		sr[6] =  ((co[1] >> 24) & 0xff) - s0;
+		sr[7] =  ( co[0]        & 0xff) - s1;
+		sr[8] =  ((co[3] >>  8) & 0xff) + s0;
+		sr[9] =  ((co[2] >> 24) & 0xff) - s1;
+		sr[10] = ((co[0] >>  8) & 0xff) + s0;
+		sr[11] = ((co[1] >>  8) & 0xff) - s1;
+		sr[12] = ( co[1]        & 0xff) + s1;
+		sr[13] = ((co[3] >> 24) & 0xff) + s1;
+		sr[14] = ( co[2]        & 0xff) + s0;
+		sr[15] = ((co[0] >> 24) & 0xff) - s0;
+	}
+
+	/* The OEM driver sets the resonse to random bytes, */
+	/* but we don't need to do this, since the device doesn't */
+	/* look at them. We could add random bytes if an instrument */
+	/* update were to reject zero bytes. */
+	for (i = 0; i < 64; i++)
+		r[i] = 0;
+
+	/* The actual resonse is 16 bytes at offset 24 in the response buffer. */
+	/* The OEM driver xor's challenge byte 2 with response bytes 4..63, but */
+	/* since the instrument doesn't look at them, we only do this to the actual */
+	/* response. */
+	for (i = 0; i < 16; i++)
+		r[24 + i] = c[2] ^ sr[i];
+}
+
+
+ unsigned int i1d3UnLockKeys[][2] = {
+	{ 0xe9622e9f, 0x8d63e133 },
+	{ 0xe01e6e0a, 0x257462de },
+	{ 0xcaa62b2c, 0x30815b61 }, //oem
+	{ 0xa9119479, 0x5b168761 },
+	{ 0x160eb6ae, 0x14440e70 },
+	{ 0x291e41d7, 0x51937bdd },
+	{ 0x1abfae03, 0xf25ac8e8 },
+	{ 0xc9bfafe0, 0x02871166 }, //c6
+	{ 0x828c43e9, 0xcbb8a8ed }
+};
+
+int i1d3numUnLockKeys(9);
+
+// The flavour of probe each key unlocks
+const char* i1d3KeyNames[9] =
+{
+	"I1D3 Retail",
+	"I1D3 ColorMunkie",
+	"I1D3 OEM",
+	"I1D3 NEC",
+	"I1D3 Quato",
+	"I1D3 HP Dreamcolor",
+	"I1D3 Wacom",
+	"I1D3 SpectraCal C6",
+	"I1D3 Tpa3"
+};
+
+
+int i1d3UnLock(hidIdevice* dev)
+{
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+	unsigned short cmd;
+
+
+	for(int cc(0); cc < i1d3numUnLockKeys; ++cc)
+	{
+		memset(tBuf, 0, 64);
+		memset(fBuf, 0, 64);
+
+		// Send the challenge
+		cmd = 0x9900;
+		i1d3Command(dev, cmd, tBuf, fBuf);
+
+		// Convert challenge to response
+		i1d3CreateUnLockResponse(i1d3UnLockKeys[cc][0], i1d3UnLockKeys[cc][1], fBuf, tBuf);
+
+		// Send the response
+		cmd = 0x9a00;
+		i1d3Command(dev, cmd, tBuf, fBuf);
+
+		if(fBuf[2] == 0x77)
+		{
+			/* Check success */
+			i1d3ProbeCaps(dev);
+			return cc;
+		}
+	}
+
+	return -1;
+}
+
+
+void i1d3ReadSerial(hidIdevice* dev, char* serNum)
+{
+	unsigned char* eBuf = new unsigned char[256];
+	memset(eBuf, 0x00, 256);
+	i1d3ReadInternalEeprom(dev, eBuf);
+
+	memset(serNum, 0x00, 21);
+	memcpy(serNum, &eBuf[16], 20);
+
+	delete[] eBuf;
+}
+
+
+// The 0xab00 packet that enables eeprom writes
+void i1d3MakeEnWrite(unsigned char* tBuf)
+{
+	memset(tBuf, 0, 64);
+
+	tBuf[1]	= 0xa3;
+	tBuf[2]	= 0x80;
+	tBuf[3]	= 0x25;
+	tBuf[4]	= 0x41;
+}
+
+
+int i1d3EnWrite(hidIdevice* dev)
+{
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+	unsigned short cmd;
+
+
+	memset(fBuf, 0, 64);
+
+	// Send the challenge
+	cmd = 0xab00;
+
+	i1d3MakeEnWrite(tBuf);
+
+	i1d3Command(dev, cmd, tBuf, fBuf);
+
+	return -1;
+}
+
+unsigned int calcCsum(unsigned char* buf, bool alt)
+{
+	unsigned int sum(0);
+	unsigned int sz(0x178e);  // rev2
+	if(alt) sz = 0x179a;	  // rev1
+
+	for(int i(4); i < sz; i++)
+	{
+		sum += buf[i];
+	}
+	sum &= 0xffff;
+
+	return sum;
+}
+
+
+hidEmulator::hidEmulator(int key, double rtt, double rttJitter)
+	: haveResp(false), keyIndex(key), latency(rtt), jitter(rttJitter), seed(12345)
+{
+	memset(resp, 0x00, 64);
+	memset(challenge, 0x00, 64);
+
+	// a plausible eeprom image with a valid rev2 checksum
+	for(int i(0); i < 8192; i++) extEE[i] = (unsigned char)(i * 7 + (i >> 8));
+	unsigned int csum = calcCsum(extEE);
+	extEE[2] = (unsigned char)(csum >> 0) & 0xff;
+	extEE[3] = (unsigned char)(csum >> 8) & 0xff;
+
+	memset(intEE, 0xff, 256);
+	memset(intEE + 16, 0x00, 20);
+	strcpy((char*)intEE + 16, "EMU0000001");
+}
+
+
+int hidEmulator::write(unsigned char* data, int len)
+{
+	unsigned char cmd = data[0];
+
+	memset(resp, 0x00, 64);
+	resp[1] = cmd;
+
+	switch(cmd)
+	{
+		case 0x00:		// information
+		{
+			strcpy((char*)resp + 2, "i1Display3 Emulated");
+		}
+		break;
+
+		case 0x01:		// frequency measurement, a steady mid grey
+		{
+			unsigned int intclks = data[1] | (data[2] << 8) | (data[3] << 16) | ((unsigned int)data[4] << 24);
+			double inttime = intclks / I1D3_CLK_FREQ;
+			spinWait(inttime);
+
+			for(int ch(0); ch < 3; ch++)
+			{
+				unsigned int counts = (unsigned int)(inttime * 20000.0 * (ch + 1));
+				resp[2 + ch * 4] = (counts >>  0) & 0xff;
+				resp[3 + ch * 4] = (counts >>  8) & 0xff;
+				resp[4 + ch * 4] = (counts >> 16) & 0xff;
+				resp[5 + ch * 4] = (counts >> 24) & 0xff;
+			}
+		}
+		break;
+
+		case 0x12:		// external eeprom read
+		{
+			int addr = (data[1] << 8) | data[2];
+			int num = data[3];
+			if(num > 59 || addr + num > 8192) resp[0] = 0x01;
+			else memcpy(resp + 5, extEE + addr, num);
+		}
+		break;
+
+		case 0x13:		// external eeprom write
+		{
+			int addr = (data[1] << 8) | data[2];
+			int num = data[3];
+			if(num > 60 || addr + num > 8192) resp[0] = 0x01;
+			else memcpy(extEE + addr, data + 4, num);
+		}
+		break;
+
+		case 0x08:		// internal eeprom read
+		{
+			int addr = data[1];
+			int num = data[2];
+			if(num > 60 || addr + num > 256) resp[0] = 0x01;
+			else memcpy(resp + 4, intEE + addr, num);
+		}
+		break;
+
+		case 0x07:		// internal eeprom write
+		{
+			int addr = data[1];
+			int num = data[2];
+			if(num > 61 || addr + num > 256) resp[0] = 0x01;
+			else memcpy(intEE + addr, data + 3, num);
+		}
+		break;
+
+		case 0x99:		// unlock challenge
+		{
+			for(int i(2); i < 64; i++)
+			{
+				seed = seed * 1103515245 + 12345;
+				resp[i] = (unsigned char)(seed >> 16);
+			}
+			memcpy(challenge, resp, 64);
+		}
+		break;
+
+		case 0x9a:		// unlock response
+		{
+			unsigned char expect[64];
+			i1d3CreateUnLockResponse(i1d3UnLockKeys[keyIndex][0], i1d3UnLockKeys[keyIndex][1], challenge, expect);
+			resp[2] = (memcmp(expect + 24, data + 24, 16) == 0) ? 0x77 : 0x00;
+		}
+		break;
+
+		case 0xab:		// enable write
+		break;
+
+		default:
+		{
+			resp[0] = 0x01;
+		}
+	}
+
+	haveResp = true;
+
+	return len;
+}
+
+
+int hidEmulator::read(unsigned char* data, int len)
+{
+	if(!haveResp) return -1;
+
+	double wait = latency;
+	if(jitter > 0.0)
+	{
+		seed = seed * 1103515245 + 12345;
+		wait += jitter * ((seed >> 16) & 0x7fff) / 32768.0;
+	}
+	spinWait(wait);
+
+	haveResp = false;
+	if(len > 64) len = 64;
+	memcpy(data, resp, len);
+
+	return len;
+}
+
+
+/* Spectral sensitivity */
+const char* cmfNames[CMF_NUM_OBSERVERS] = { "CIE 1931 2 degree", "CIE 1964 10 degree", "CIE 2006 2 degree", "CIE 2006 10 degree" };
+
+// The 1nm tables as the CIE (1931, 1964) and CVRL (2006, CIE 170-2 XYZ) publish them
+const char* cmfFiles[CMF_NUM_OBSERVERS] = { "CIE_xyz_1931_2deg.csv", "CIE_xyz_1964_10deg.csv", "lin2012xyz2e_1_7sf.csv", "lin2012xyz10e_1_7sf.csv" };
+
+float cmfTables[CMF_NUM_OBSERVERS][3][CMF_BANDS];
+int cmfSource[CMF_NUM_OBSERVERS];
+
+
+// Reads a table of wavelength, x, y, z rows, comma or space separated.  Wavelengths outside 380nm to 730nm are
+// skipped.  The 2006 tables start at 390nm, so 380nm to 389nm, where the functions are all but zero, are left at
+// zero, as is a value that is missing or NaN.
+bool readCMFFile(const char* fileName, float cmf[3][CMF_BANDS])
+{
+	FILE* fp = fopen(fileName, "r");
+	if(!fp) return false;
+
+	memset(cmf, 0x00, sizeof(float) * 3 * CMF_BANDS);
+
+	int numBands(0);
+	char line[256];
+
+	while(fgets(line, sizeof(line), fp))
+	{
+		for(char* cPtr = line; *cPtr; cPtr++) if(*cPtr == ',') *cPtr = ' ';
+
+		double nm, v[3] = { 0.0, 0.0, 0.0 };
+		if(sscanf(line, "%lf %lf %lf %lf", &nm, &v[0], &v[1], &v[2]) < 2) continue;	// a header
+
+		int band = (int)floor(nm + 0.5) - CMF_START_NM;
+		if(band < 0 || band >= CMF_BANDS || fabs(nm - CMF_START_NM - band) > 0.01) continue;
+
+		for(int k(0); k < 3; k++) cmf[k][band] = (v[k] == v[k]) ? (float)v[k] : 0.0f;
+		if(band >= CMF_FIRST_BAND) numBands++;
+	}
+
+	fclose(fp);
+
+	return numBands == CMF_BANDS - CMF_FIRST_BAND;
+}
+
+
+// Loads the observer's CIE table into cmfTables from the current directory or the directory of the executable,
+// once.  Without it the 1931 and 1964 observers fall back to the analytic fits in i1d3cmf.h.
+int i1d3LoadCMF(int observer)
+{
+	static bool tried[CMF_NUM_OBSERVERS];
+	if(tried[observer]) return cmfSource[observer];
+	tried[observer] = true;
+
+	char path[MAX_PATH];
+	if(readCMFFile(cmfFiles[observer], cmfTables[observer]) ||
+	   (exeDirPath(cmfFiles[observer], path, MAX_PATH) && readCMFFile(path, cmfTables[observer])))
+	{
+		cmfSource[observer] = CMF_TABLE;
+	}
+	else if(observer == CMF_1931_2DEG || observer == CMF_1964_10DEG)
+	{
+		memcpy(cmfTables[observer], (observer == CMF_1931_2DEG) ? cmf1931_2deg : cmf1964_10deg, sizeof(cmfTables[0]));
+		cmfSource[observer] = CMF_FIT;
+	}
+	else cmfSource[observer] = CMF_MISSING;
+
+	return cmfSource[observer];
+}
+
+
+float spectralDotScalar(const float* a, const float* b, int n)
+{
+	float sum(0.0f);
+
+	for(int i(0); i < n; i++)
+	{
+		sum += a[i] * b[i];
+	}
+
+	return sum;
+}
+
+
+#if defined(SPECTRAL_X86)
+// The build targets plain x86, so the AVX2 kernel is compiled for AVX2 on its own (MSVC allows the intrinsics in
+// any function) and only called once cpuid has said the processor and the OS support it.
+AVX2_TARGET float spectralDotAVX2(const float* a, const float* b, int n)
+{
+	__m256 acc = _mm256_setzero_ps();
+	int i(0);
+
+	for(; i + 8 <= n; i += 8)
+	{
+		acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+	}
+
+	__m128 hsum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+	hsum = _mm_add_ps(hsum, _mm_movehl_ps(hsum, hsum));
+	hsum = _mm_add_ss(hsum, _mm_shuffle_ps(hsum, hsum, 1));
+	float sum = _mm_cvtss_f32(hsum);
+
+	for(; i < n; i++)
+	{
+		sum += a[i] * b[i];
+	}
+
+	return sum;
+}
+
+
+bool cpuHasAVX2()
+{
+	int r[4];
+
+#if defined(_MSC_VER)
+	__cpuid(r, 0);
+	if(r[0] < 7) return false;
+
+	__cpuid(r, 1);
+	if((r[2] & (1 << 27)) == 0 || (r[2] & (1 << 28)) == 0 || (r[2] & (1 << 12)) == 0) return false;	// OSXSAVE, AVX, FMA
+
+	// the OS must save the ymm registers
+	if((_xgetbv(0) & 6) != 6) return false;
+
+	__cpuidex(r, 7, 0);
+#else
+	unsigned int a, b, c, dx;
+	if(__get_cpuid_max(0, 0) < 7) return false;
+
+	__cpuid(1, a, b, c, dx);
+	if((c & (1 << 27)) == 0 || (c & (1 << 28)) == 0 || (c & (1 << 12)) == 0) return false;
+
+	unsigned int lo, hi;
+	__asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	if((lo & 6) != 6) return false;
+
+	__cpuid_count(7, 0, a, b, c, dx);
+	r[1] = (int)b;
+#endif
+
+	return (r[1] & (1 << 5)) != 0;		// AVX2
+}
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+// NEON is always there on arm64
+float spectralDotNEON(const float* a, const float* b, int n)
+{
+	float32x4_t acc = vdupq_n_f32(0.0f);
+	int i(0);
+
+	for(; i + 4 <= n; i += 4)
+	{
+		acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+	}
+
+	float sum = vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1) + vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3);
+
+	for(; i < n; i++)
+	{
+		sum += a[i] * b[i];
+	}
+
+	return sum;
+}
+#endif
+
+
+typedef float (*spectralDotFn)(const float* a, const float* b, int n);
+
+const char* spectralKernel(0);
+
+// Picks the kernel on the first call.  Threads racing here all pick the same one.
+float spectralDotFirst(const float* a, const float* b, int n);
+spectralDotFn spectralDotImpl(spectralDotFirst);
+
+float spectralDotFirst(const float* a, const float* b, int n)
+{
+	spectralDotFn fn(spectralDotScalar);
+	const char* name("scalar");
+
+#if defined(SPECTRAL_X86)
+	if(cpuHasAVX2())
+	{
+		fn = spectralDotAVX2;
+		name = "avx2";
+	}
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+	fn = spectralDotNEON;
+	name = "neon";
+#endif
+
+	spectralKernel = name;
+	spectralDotImpl = fn;
+
+	return fn(a, b, n);
+}
+
+
+float spectralDot(const float* a, const float* b, int n)
+{
+	return spectralDotImpl(a, b, n);
+}
+
+
+void i1d3ReadSensitivities(unsigned char* eBuf, float sens[3][SENS_BANDS])
+{
+	unsigned char* bPtr = eBuf + SENS_OFFSET;
+
+	for(int ch(0); ch < 3; ch++)
+	{
+		for(int i(0); i < SENS_BANDS; i++, bPtr += 4)
+		{
+			unsigned int val = bPtr[0] | (bPtr[1] << 8) | (bPtr[2] << 16) | (bPtr[3] << 24);
+			memcpy(&sens[ch][i], &val, 4);
+		}
+	}
+}
+
+
+// Returns false if there is no table for the observer
+bool i1d3IntegrateCMF(float sens[3][SENS_BANDS], int observer, double mat[3][3])
+{
+	if(i1d3LoadCMF(observer) == CMF_MISSING) return false;
+
+	float (*cmf)[CMF_BANDS] = cmfTables[observer];
+
+	// Row per sensor channel, column per CIE tristimulus curve
+	for(int ch(0); ch < 3; ch++)
+	{
+		for(int xyz(0); xyz < 3; xyz++)
+		{
+			mat[ch][xyz] = spectralDot(sens[ch], cmf[xyz], SENS_BANDS);
+		}
+	}
+
+	return true;
+}
+
+
+/* Measurement */
+// Frequency measurement, returns the raw sensor edge counts for the (clock rounded) integration time
+int i1d3Measure(hidIdevice* dev, double* inttime, double counts[3])
+{
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+	unsigned short cmd;
+
+	memset(tBuf, 0, 64);
+	memset(fBuf, 0, 64);
+
+	cmd = 0x0100;
+
+	unsigned int intclks = (unsigned int)(*inttime * I1D3_CLK_FREQ + 0.5);
+	*inttime = (double)intclks / I1D3_CLK_FREQ;
+
+	tBuf[1] = (intclks >>  0) & 0xff;
+	tBuf[2] = (intclks >>  8) & 0xff;
+	tBuf[3] = (intclks >> 16) & 0xff;
+	tBuf[4] = (intclks >> 24) & 0xff;
+
+	if(i1d3Command(dev, cmd, tBuf, fBuf, *inttime + 1.0) < 0) return -1;
+
+	for(int ch(0); ch < 3; ch++)
+	{
+		unsigned char* bPtr = fBuf + 2 + ch * 4;
+		counts[ch] = (double)(bPtr[0] | (bPtr[1] << 8) | (bPtr[2] << 16) | ((unsigned int)bPtr[3] << 24));
+	}
+
+	return 0;
+}
+
+
+/* Refresh rate detection */
+// Index of the strongest frequency within width Hz of hz, or -1 if that is out of the searched range
+int refreshBandPeak(double* power, int numFreqs, double hz, double width)
+{
+	int lo = (int)ceil((hz - width - REFRESH_MIN_HZ) / REFRESH_STEP_HZ);
+	int hi = (int)floor((hz + width - REFRESH_MIN_HZ) / REFRESH_STEP_HZ);
+
+	if(lo < 0) lo = 0;
+	if(hi > numFreqs - 1) hi = numFreqs - 1;
+
+	int peak(-1);
+	for(int f(lo); f <= hi; f++)
+	{
+		if(peak < 0 || power[f] > power[peak]) peak = f;
+	}
+
+	return peak;
+}
+
+
+// Finds the dominant flicker frequency in n readings taken at the given host times.  slack is the mean
+// time each reading's round trip took beyond its integration, which is how far a timestamp can be from
+// the middle of the integration it stands for.  The values are modified in place.
+//
+// Host timestamps are only good to about a USB frame, and the readings land almost evenly on USB
+// frames, so the periodogram does alias.  A peak is only reported if it stands clear of both the noise
+// floor and its aliases at the mean sample rate, and its confidence is scaled down by the share of the
+// flicker the timestamp jitter smears out at that frequency.
+void refreshFromSamples(double* times, double* vals, int n, double slack, double* refreshRate, double* confidence)
+{
+	double mean(0.0);
+
+	for(int i(0); i < n; i++)
+	{
+		mean += vals[i];
+	}
+
+	mean /= n;
+
+	double var(0.0);
+	for(int i(n - 1); i >= 0; i--)
+	{
+		vals[i] -= mean;
+		var += vals[i] * vals[i];
+		times[i] -= times[0];
+	}
+
+	*refreshRate = 0.0;
+	*confidence = 0.0;
+
+	// a steady light source shows nothing but count quantization
+	if(var / n > 1.0)
+	{
+		const double pi(3.14159265358979);
+		int numFreqs = (int)((REFRESH_MAX_HZ - REFRESH_MIN_HZ) / REFRESH_STEP_HZ + 0.5) + 1;
+		double* power = new double[numFreqs];
+		double sumPow(0.0);
+		int peak(0);
+
+		for(int f(0); f < numFreqs; f++)
+		{
+			double re(0.0), im(0.0);
+			double w = 2.0 * pi * (REFRESH_MIN_HZ + f * REFRESH_STEP_HZ);
+
+			for(int i(0); i < n; i++)
+			{
+				re += vals[i] * cos(w * times[i]);
+				im += vals[i] * sin(w * times[i]);
+			}
+
+			power[f] = re * re + im * im;
+			sumPow += power[f];
+
+			if(power[f] > power[peak]) peak = f;
+		}
+
+		// two frequencies closer than this cannot be told apart over the length of the burst
+		double width = 1.0 / times[n - 1];
+
+		// a display that flashes more than once a frame peaks at a multiple of its refresh rate, so take
+		// the lowest subharmonic that still carries a good share of the peak
+		double peakHz = REFRESH_MIN_HZ + peak * REFRESH_STEP_HZ;
+		for(int k(4); k >= 2; k--)
+		{
+			int sub = refreshBandPeak(power, numFreqs, peakHz / k, width / k);
+
+			if(sub >= 0 && power[sub] >= REFRESH_SUBHARMONIC * power[peak])
+			{
+				peak = sub;
+				break;
+			}
+		}
+
+		double peakPow = power[peak];
+		peakHz = REFRESH_MIN_HZ + peak * REFRESH_STEP_HZ;
+
+		// the strongest alias of the peak at multiples of the mean sample rate
+		double rate = (n - 1) / times[n - 1];
+		double aliasPow(0.0);
+
+		for(int k(1); k * rate <= REFRESH_MAX_HZ + peakHz; k++)
+		{
+			double alias[2] = { fabs(k * rate - peakHz), k * rate + peakHz };
+
+			for(int a(0); a < 2; a++)
+			{
+				if(fabs(alias[a] - peakHz) <= width) continue;
+
+				int f = refreshBandPeak(power, numFreqs, alias[a], width);
+				if(f >= 0 && power[f] > aliasPow) aliasPow = power[f];
+			}
+		}
+
+		double floorPow = sumPow / numFreqs;
+		if(aliasPow > floorPow) floorPow = aliasPow;
+
+		// timestamps spread evenly over the slack keep exp(-(2 pi f sigma)^2) of the flicker power at f
+		double phase = 2.0 * pi * peakHz * slack / sqrt(12.0);
+
+		*confidence = peakPow / floorPow * exp(-phase * phase);
+		if(*confidence >= REFRESH_MIN_CONF) *refreshRate = peakHz;
+
+		delete[] power;
+	}
+}
+
+
+// Captures a burst of 1ms readings and looks for the dominant flicker frequency.  The readings are
+// timestamped on the host, so the spectrum is a periodogram evaluated at the actual sample times rather
+// than an FFT, but the timestamps are no better than the USB round trip.  Returns 0 with refreshRate set
+// to 0 if no refresh rate stood clear of the timing jitter and aliases.
+int i1d3DetectRefresh(hidIdevice* dev, double* refreshRate, double* confidence)
+{
+	double* times = new double[REFRESH_SAMPLES];
+	double* vals = new double[REFRESH_SAMPLES];
+	double slack(0.0);
+
+	for(int i(0); i < REFRESH_SAMPLES; i++)
+	{
+		double inttime(REFRESH_INTTIME);
+		double counts[3];
+
+		double t0 = timeNow();
+		if(i1d3Measure(dev, &inttime, counts) < 0)
+		{
+			delete[] times;
+			delete[] vals;
+			return -1;
+		}
+		double t1 = timeNow();
+
+		times[i] = 0.5 * (t0 + t1);
+		vals[i] = counts[0] + counts[1] + counts[2];
+		slack += t1 - t0 - inttime;
+	}
+
+	refreshFromSamples(times, vals, REFRESH_SAMPLES, slack / REFRESH_SAMPLES, refreshRate, confidence);
+
+	delete[] times;
+	delete[] vals;
+
+	return 0;
+}
+
+
+// Round an integration time to a whole number of refresh periods
+double snapToRefresh(double inttime, double refreshRate)
+{
+	if(refreshRate <= 0.0) return inttime;
+
+	double period = 1.0 / refreshRate;
+	double n = floor(inttime / period + 0.5);
+	if(n < 1.0) n = 1.0;
+
+	return n * period;
+}
+
+
+/* Multiplexed probe operations */
+int seqOp::step(unsigned char* fBuf, bool ok, probeCmd* next)
+{
+	while(cur < numOps)
+	{
+		int res = ops[cur]->step(fBuf, ok, next);
+		if(res == OP_MORE) return OP_MORE;
+
+		ops[cur]->result = res;
+		if(res != OP_DONE) return res;
+
+		// the next operation starts afresh
+		cur++;
+		fBuf = 0;
+	}
+
+	return OP_DONE;
+}
+
+
+// Same as i1d3GetInfo
+int infoOp::step(unsigned char* fBuf, bool ok, probeCmd* next)
+{
+	if(fBuf)
+	{
+		if(!ok) return OP_FAILED;
+
+		strncpy(info, (char*)fBuf + 2, 62);
+		return OP_DONE;
+	}
+
+	memset(next->tBuf, 0, 64);
+	next->cmd = 0x0000;
+
+	return OP_MORE;
+}
+
+
+// Same exchange as i1d3UnLock, a challenge then the response for each key until one is accepted
+int unlockOp::step(unsigned char* fBuf, bool ok, probeCmd* next)
+{
+	if(fBuf && phase == 1)
+	{
+		i1d3CreateUnLockResponse(i1d3UnLockKeys[key][0], i1d3UnLockKeys[key][1], fBuf, next->tBuf);
+		next->cmd = 0x9a00;
+		next->hold = true;		// the response answers the challenge just sent
+		phase = 2;
+		return OP_MORE;
+	}
+
+	if(fBuf && phase == 2 && fBuf[2] == 0x77) return OP_DONE;
+
+	if(++key >= i1d3numUnLockKeys)
+	{
+		key = -1;
+		return OP_FAILED;
+	}
+
+	memset(next->tBuf, 0, 64);
+	next->cmd = 0x9900;
+	phase = 1;
+
+	return OP_MORE;
+}
+
+
+// Same packets as i1d3ReadExternalEepromRange and i1d3ReadInternalEepromRange
+int eepromReadOp::step(unsigned char* fBuf, bool ok, probeCmd* next)
+{
+	if(fBuf)
+	{
+		if(!ok) return OP_FAILED;
+
+		memcpy(buf, fBuf + (ext ? 5 : 4), inc);
+		addr += inc;
+		buf += inc;
+		len -= inc;
+	}
+
+	if(len == 0) return OP_DONE;
+
+	inc = len;
+	if(inc > chunk) inc = chunk;
+
+	memset(next->tBuf, 0, 64);
+
+	if(ext)
+	{
+		next->cmd = 0x1200;
+		next->tBuf[1] = (addr >> 8) & 0xff;
+		next->tBuf[2] = addr & 0xff;
+		next->tBuf[3] = (unsigned char)inc;
+	}
+	else
+	{
+		next->cmd = 0x0800;
+		next->tBuf[1] = (unsigned char)addr;
+		next->tBuf[2] = (unsigned char)inc;
+	}
+
+	return OP_MORE;
+}
+
+
+// Same packets as i1d3WriteExternalEepromRange and i1d3WriteInternalEepromRange
+int eepromWriteOp::step(unsigned char* fBuf, bool ok, probeCmd* next)
+{
+	if(fBuf)
+	{
+		if(!ok) return OP_FAILED;
+
+		addr += inc;
+		buf += inc;
+		len -= inc;
+	}
+
+	if(len == 0) return OP_DONE;
+
+	inc = len;
+	if(inc > chunk) inc = chunk;
+	unsigned int room = page - addr % page;
+	if(inc > room) inc = room;
+
+	memset(next->tBuf, 0, 64);
+
+	if(ext)
+	{
+		next->cmd = 0x1300;
+		next->tBuf[1] = (addr >> 8) & 0xff;
+		next->tBuf[2] = addr & 0xff;
+		next->tBuf[3] = (unsigned char)inc;
+		memcpy(next->tBuf + 4, buf, inc);
+	}
+	else
+	{
+		next->cmd = 0x0700;
+		next->tBuf[1] = (unsigned char)addr;
+		next->tBuf[2] = (unsigned char)inc;
+		memcpy(next->tBuf + 3, buf, inc);
+	}
+
+	return OP_MORE;
+}
+
+
+eepromUpdateOp::eepromUpdateOp(bool external, const unsigned char* cur, const unsigned char* image, unsigned int size, const i1d3Caps& caps)
+	:ext(external), cur(cur), image(image), size(size), addr(0), inc(0),
+	 chunk(external ? caps.extWrite : caps.intWrite), page(external ? caps.extPage : caps.intPage), numPackets(0), sent(0)
+{
+	for(unsigned int at(0); at < size; at += packetLen(at))
+	{
+		if(memcmp(cur + at, image + at, packetLen(at)) != 0) numPackets++;
+	}
+}
+
+
+unsigned int eepromUpdateOp::packetLen(unsigned int at)
+{
+	unsigned int len = size - at;
+	if(len > chunk) len = chunk;
+	if(len > page - at % page) len = page - at % page;
+
+	return len;
+}
+
+
+int eepromUpdateOp::step(unsigned char* fBuf, bool ok, probeCmd* next)
+{
+	if(fBuf)
+	{
+		if(!ok) return OP_FAILED;
+
+		addr += inc;
+		sent++;
+	}
+
+	// on to the next packet that differs
+	for(; addr < size; addr += inc)
+	{
+		inc = packetLen(addr);
+		if(memcmp(cur + addr, image + addr, inc) != 0) break;
+	}
+
+	if(addr >= size) return OP_DONE;
+
+	memset(next->tBuf, 0, 64);
+
+	if(ext)
+	{
+		next->cmd = 0x1300;
+		next->tBuf[1] = (addr >> 8) & 0xff;
+		next->tBuf[2] = addr & 0xff;
+		next->tBuf[3] = (unsigned char)inc;
+		memcpy(next->tBuf + 4, image + addr, inc);
+	}
+	else
+	{
+		next->cmd = 0x0700;
+		next->tBuf[1] = (unsigned char)addr;
+		next->tBuf[2] = (unsigned char)inc;
+		memcpy(next->tBuf + 3, image + addr, inc);
+	}
+
+	return OP_MORE;
+}
+
+
+int commandOp::step(unsigned char* fBuf, bool ok, probeCmd* next)
+{
+	if(fBuf)
+	{
+		memcpy(this->fBuf, fBuf, 64);
+		accepted = ok;
+		return OP_DONE;
+	}
+
+	memcpy(next->tBuf, tBuf, 64);
+	next->cmd = cmd;
+
+	return OP_MORE;
+}
+
+
+int measureBurstOp::step(unsigned char* fBuf, bool ok, probeCmd* next)
+{
+	if(fBuf)
+	{
+		if(!ok) return OP_FAILED;
+
+		double now = timeNow();
+		times[count] = 0.5 * (sent + now);
+		slack += now - sent - (double)intclks / I1D3_CLK_FREQ;
+
+		for(int ch(0); ch < 3; ch++)
+		{
+			unsigned char* bPtr = fBuf + 2 + ch * 4;
+			vals[count * 3 + ch] = (double)(bPtr[0] | (bPtr[1] << 8) | (bPtr[2] << 16) | ((unsigned int)bPtr[3] << 24));
+		}
+
+		count++;
+	}
+
+	if(count == num) return OP_DONE;
+
+	memset(next->tBuf, 0, 64);
+	next->cmd = 0x0100;
+	next->tBuf[1] = (intclks >>  0) & 0xff;
+	next->tBuf[2] = (intclks >>  8) & 0xff;
+	next->tBuf[3] = (intclks >> 16) & 0xff;
+	next->tBuf[4] = (intclks >> 24) & 0xff;
+	next->timeout = (double)intclks / I1D3_CLK_FREQ + 1.0;
+	sent = timeNow();
+
+	return OP_MORE;
+}
+
+
+#define MUX_IDLE		0
+#define MUX_WRITING		1
+#define MUX_READING		2
+#define MUX_HELD		3		// ready to send but held back by the budget
+#define MUX_DRAINING	4		// waiting out the late reply to a command that timed out before resending it
+
+#define MUX_RETRIES		3		// resends of a command that timed out, when a budget is set
+
+#define BUDGET_ALPHA	1.0		// transactions queued in the host controller below which the budget grows
+#define BUDGET_BETA		2.0		// and above which it shrinks
+
+
+void muxBudget::sample(double rtt)
+{
+	if(minRtt == 0.0 || rtt < minRtt) minRtt = rtt;
+	avgRtt = (avgRtt == 0.0) ? rtt : 0.875 * avgRtt + 0.125 * rtt;
+
+	if(++count < limit) return;
+	count = 0;
+
+	double queued = limit * (1.0 - minRtt / avgRtt);
+
+	if(queued < BUDGET_ALPHA && limit < maxLimit) limit++;
+	else if(queued > BUDGET_BETA && limit > 1) limit--;
+}
+
+
+void muxBudget::timeout()
+{
+	timeouts++;
+	count = 0;
+
+	limit /= 2;
+	if(limit < 1) limit = 1;
+}
+
+
+// Adds a probe and its operation, returns the slot number or -1 if the multiplexer is full
+int probeMux::add(hidIdevice* dev, probeOp* op)
+{
+	if(numSlots >= MUX_MAX_PROBES) return -1;
+
+	muxSlot* s = &slots[numSlots];
+	s->dev = dev;
+	s->op = op;
+	s->state = MUX_IDLE;
+	s->flying = false;
+	s->retries = 0;
+
+	op->result = OP_MORE;
+	s->cmd.timeout = 1.0;
+	int res = op->step(0, true, &s->cmd);
+	if(res != OP_MORE) op->result = res;
+	else if(!issue(s)) finish(s, OP_FAILED);
+
+	return numSlots++;
+}
+
+
+void probeMux::finish(muxSlot* s, int result)
+{
+	landed(s);
+
+	s->op->result = result;
+	s->state = MUX_IDLE;
+}
+
+
+// The slot's transaction is over, one way or another
+void probeMux::landed(muxSlot* s)
+{
+	if(!s->flying) return;
+
+	s->flying = false;
+	inFlight--;
+}
+
+
+// Starts held slots while the budget allows
+void probeMux::release()
+{
+	while(numHeld > 0 && (!budget || inFlight < budget->limit))
+	{
+		muxSlot* s = &slots[held[heldHead]];
+		heldHead = (heldHead + 1) % MUX_MAX_PROBES;
+		numHeld--;
+
+		// a cancelled slot is left in the ring, skip it
+		if(s->state != MUX_HELD) continue;
+
+		if(!start(s)) finish(s, OP_FAILED);
+	}
+}
+
+
+// Sends the command in s->cmd, or holds it back behind any already waiting if the budget is used up.  Returns
+// false if it could not be sent.
+bool probeMux::issue(muxSlot* s)
+{
+	if(budget && !s->dev->replay && !s->dev->emu && (inFlight >= budget->limit || numHeld > 0))
+	{
+		s->state = MUX_HELD;
+		held[(heldHead + numHeld) % MUX_MAX_PROBES] = (int)(s - slots);
+		numHeld++;
+		return true;
+	}
+
+	return start(s);
+}
+
+
+bool probeMux::start(muxSlot* s)
+{
+	unsigned char* rep = s->lBuf + 1;
+
+	s->lBuf[0] = 0;
+	memcpy(rep, s->cmd.tBuf, 64);
+	rep[0] = (s->cmd.cmd >> 8) & 0xff;
+	if(rep[0] == 0x00) rep[1] = s->cmd.cmd & 0xff;
+
+	// emulated and replayed probes answer immediately, run them to completion here
+	while(s->dev->replay || s->dev->emu)
+	{
+		unsigned char fBuf[64];
+		memset(fBuf, 0, 64);
+
+		int num = writeHIDdevice(s->dev, rep, 64, s->cmd.timeout);
+		if(num > 0) num = readHIDdevice(s->dev, fBuf, 64, s->cmd.timeout);
+
+		bool ok = (num > 0) && (fBuf[0] == 0x00) && (fBuf[1] == rep[0]);
+		s->cmd.timeout = 1.0;
+		int res = s->op->step(fBuf, ok, &s->cmd);
+		if(res != OP_MORE)
+		{
+			finish(s, res);
+			return true;
+		}
+
+		memcpy(rep, s->cmd.tBuf, 64);
+		rep[0] = (s->cmd.cmd >> 8) & 0xff;
+		if(rep[0] == 0x00) rep[1] = s->cmd.cmd & 0xff;
+	}
+
+	if(hidRecord) hidRecord->record(s->dev->traceProbe, TRACE_OUT, rep, 64);
+
+	s->sent = timeNow();
+	s->deadline = s->sent + s->cmd.timeout;
+	s->state = MUX_WRITING;
+	s->flying = true;
+	inFlight++;
+
+	if(WriteFile(s->dev->fh, s->lBuf, 65, NULL, &s->dev->ols) == 0 && GetLastError() != ERROR_IO_PENDING) return false;
+
+	return true;
+}
+
+
+// Called once the event of a slot has been signalled
+void probeMux::complete(muxSlot* s)
+{
+	DWORD num(0);
+
+	if((s->state == MUX_READING || s->state == MUX_DRAINING) && s->dev->queueDepth)
+	{
+		int n = hidQueuePop(s->dev, s->lBuf);
+		num = (n > 0) ? n : 0;
+	}
+	else if(!GetOverlappedResult(s->dev->fh, &s->dev->ols, &num, FALSE)) num = 0;
+
+	// the late reply, or the read failing, either way the way is clear for the resend
+	if(s->state == MUX_DRAINING)
+	{
+		if(hidRecord) hidRecord->record(s->dev->traceProbe, num > 0 ? TRACE_IN : TRACE_FAILED, s->lBuf + 1, num > 0 ? num - 1 : 0);
+
+		s->state = MUX_IDLE;
+		if(!issue(s)) finish(s, OP_FAILED);
+		return;
+	}
+
+	if(num == 0)
+	{
+		if(s->state == MUX_READING && hidRecord) hidRecord->record(s->dev->traceProbe, TRACE_FAILED, 0, 0);
+		finish(s, OP_FAILED);
+		return;
+	}
+
+	if(s->state == MUX_WRITING)
+	{
+		memset(s->lBuf, 0, 65);
+		s->state = MUX_READING;
+
+		// the queued transport already has a read posted
+		if(s->dev->queueDepth) return;
+
+		if(ReadFile(s->dev->fh, s->lBuf, 65, NULL, &s->dev->ols) == 0 && GetLastError() != ERROR_IO_PENDING) finish(s, OP_FAILED);
+		return;
+	}
+
+	unsigned char* fBuf = s->lBuf + 1;
+	if(hidRecord) hidRecord->record(s->dev->traceProbe, TRACE_IN, fBuf, num - 1);
+
+	landed(s);
+	if(budget) budget->sample(timeNow() - s->sent);
+	s->retries = 0;
+
+	unsigned char major = (s->cmd.cmd >> 8) & 0xff;
+	bool ok = (fBuf[0] == 0x00) && (fBuf[1] == major);
+
+	// step() may build the next command in place, so hand it a copy of the reply
+	unsigned char rBuf[64];
+	memcpy(rBuf, fBuf, 64);
+
+	s->cmd.timeout = 1.0;
+	int res = s->op->step(rBuf, ok, &s->cmd);
+	if(res != OP_MORE) finish(s, res);
+	else if(!issue(s)) finish(s, OP_FAILED);
+}
+
+
+// Abandons the operation on a slot, the probe may be left part way through it
+void probeMux::cancel(int slot)
+{
+	muxSlot* s = &slots[slot];
+
+	stop(s);
+
+	if(s->op->result == OP_MORE) finish(s, OP_CANCELLED);
+}
+
+
+// Cancels the transaction in flight on a slot, if there is one
+void probeMux::stop(muxSlot* s)
+{
+	if((s->state == MUX_READING || s->state == MUX_DRAINING) && s->dev->queueDepth)
+	{
+		hidRestartQueue(s->dev);
+	}
+	else if(s->state == MUX_WRITING || s->state == MUX_READING || s->state == MUX_DRAINING)
+	{
+		DWORD num;
+		CancelIo(s->dev->fh);
+		GetOverlappedResult(s->dev->fh, &s->dev->ols, &num, TRUE);	// the event is auto reset, so this also clears it
+	}
+
+	landed(s);
+	s->state = MUX_IDLE;
+}
+
+
+// Clears out a slot whose command timed out before it is sent again.  What has arrived is flushed, and a read is
+// left posted for the command's timeout to catch a reply still on its way, see complete().
+void probeMux::drain(muxSlot* s)
+{
+	stop(s);
+
+	if(HidD_FlushQueue) HidD_FlushQueue(s->dev->fh);
+
+	s->deadline = timeNow() + s->cmd.timeout;
+	s->state = MUX_DRAINING;
+
+	// the queued transport has its reads posted again by stop()
+	if(s->dev->queueDepth) return;
+
+	memset(s->lBuf, 0, 65);
+	if(ReadFile(s->dev->fh, s->lBuf, 65, NULL, &s->dev->ols) == 0 && GetLastError() != ERROR_IO_PENDING)
+	{
+		s->state = MUX_IDLE;
+		if(!issue(s)) finish(s, OP_FAILED);
+	}
+}
+
+
+// Runs until every operation has finished, or for at most maxTime seconds if that is given.
+// Returns the number still running.  Commands that time out fail their operation.
+int probeMux::run(double maxTime)
+{
+	double until = (maxTime > 0.0) ? timeNow() + maxTime : 0.0;
+
+	for(;;)
+	{
+		HANDLE events[MUX_MAX_PROBES];
+		int which[MUX_MAX_PROBES];
+		int numWait(0);
+		double now = timeNow();
+		double wake = until;
+
+		for(int i(0); i < numSlots; i++)
+		{
+			muxSlot* s = &slots[i];
+			if(s->state == MUX_IDLE || s->state == MUX_HELD) continue;
+
+			if(now > s->deadline)
+			{
+				if(s->state != MUX_WRITING && hidRecord) hidRecord->record(s->dev->traceProbe, TRACE_TIMEOUT, 0, 0);
+
+				// nothing came back in time, the way is clear for the resend
+				if(s->state == MUX_DRAINING)
+				{
+					stop(s);
+					if(!issue(s)) finish(s, OP_FAILED);
+				}
+				else
+				{
+					// with a budget a timeout is taken as the bus being overloaded, back off and try again
+					if(budget) budget->timeout();
+
+					if(budget && s->retries++ < MUX_RETRIES) drain(s);
+					else
+					{
+						stop(s);
+						finish(s, OP_FAILED);
+					}
+				}
+
+				// a slot that carries on is waited on with its new deadline
+				if(s->state == MUX_IDLE || s->state == MUX_HELD) continue;
+			}
+
+			if(wake == 0.0 || s->deadline < wake) wake = s->deadline;
+
+			if((s->state == MUX_READING || s->state == MUX_DRAINING) && s->dev->queueDepth) events[numWait] = s->dev->qols[s->dev->qhead].hEvent;
+			else events[numWait] = s->dev->ols.hEvent;
+			which[numWait++] = i;
+		}
+
+		if(numWait == 0)
+		{
+			if(numHeld == 0) return 0;
+
+			release();
+			continue;
+		}
+
+		if(until > 0.0 && now >= until) return numWait;
+
+		DWORD ms = (DWORD)((wake - now) * 1000.0) + 1;
+		DWORD res = WaitForMultipleObjects(numWait, events, FALSE, ms);
+		if(res == WAIT_TIMEOUT) continue;
+		if(res == WAIT_FAILED) return numWait;
+
+		complete(&slots[which[res - WAIT_OBJECT_0]]);
+
+		// WaitForMultipleObjects only reports the lowest signalled handle, so give the others their turn now
+		for(int w(0); w < numWait; w++)
+		{
+			if((int)(res - WAIT_OBJECT_0) == w) continue;
+
+			if(WaitForSingleObject(events[w], 0) == WAIT_OBJECT_0) complete(&slots[which[w]]);
+		}
+
+		release();
+	}
+}
+
+
+/* Per-device scheduling */
+probeScheduler::probeScheduler(hidIdevice* dev):dev(dev), quit(false), last(SCHED_LEVELS - 1)
+{
+	for(int p(0); p < SCHED_LEVELS; p++) head[p] = tail[p] = 0;
+
+	InitializeCriticalSection(&lock);
+	wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	thread = wake ? CreateThread(NULL, 0, worker, this, 0, NULL) : 0;
+}
+
+
+// Finishes whatever is queued, then stops the worker
+probeScheduler::~probeScheduler()
+{
+	EnterCriticalSection(&lock);
+	quit = true;
+	LeaveCriticalSection(&lock);
+	if(thread)
+	{
+		SetEvent(wake);
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+	if(wake) CloseHandle(wake);
+	DeleteCriticalSection(&lock);
+}
+
+
+// Runs op on the probe and waits for it, returns its result.  Safe to call from any number of threads.  Returns
+// OP_FAILED without queuing op if the worker thread or the event to wait on could not be created.
+int probeScheduler::run(probeOp* op, int priority)
+{
+	if(!valid()) return op->result = OP_FAILED;
+
+	schedTask t;
+
+	t.op = op;
+	t.priority = (priority < 0) ? 0 : (priority >= SCHED_LEVELS) ? SCHED_LEVELS - 1 : priority;
+	t.cmd.timeout = 1.0;
+	t.cmd.hold = false;
+
+	op->result = OP_MORE;
+	int res = op->step(0, true, &t.cmd);
+	if(res != OP_MORE) return op->result = res;
+
+	// t lives on this stack, so it is only queued if there is an event to wait for it on
+	t.done = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if(!t.done) return op->result = OP_FAILED;
+
+	EnterCriticalSection(&lock);
+	push(&t);
+	LeaveCriticalSection(&lock);
+	SetEvent(wake);
+
+	WaitForSingleObject(t.done, INFINITE);
+	CloseHandle(t.done);
+
+	return op->result;
+}
+
+
+// Both called with the lock held
+void probeScheduler::push(schedTask* t)
+{
+	t->next = 0;
+
+	if(tail[t->priority]) tail[t->priority]->next = t;
+	else head[t->priority] = t;
+	tail[t->priority] = t;
+}
+
+
+probeScheduler::schedTask* probeScheduler::pop()
+{
+	for(int n(-1); n < SCHED_LEVELS; n++)
+	{
+		// the level below the last command first, then from the top
+		int p = (n < 0) ? last + 1 : n;
+		if(p >= SCHED_LEVELS) continue;
+
+		schedTask* t = head[p];
+		if(!t) continue;
+
+		head[p] = t->next;
+		if(!head[p]) tail[p] = 0;
+
+		last = p;
+		return t;
+	}
+
+	return 0;
+}
+
+
+DWORD WINAPI probeScheduler::worker(LPVOID param)
+{
+	((probeScheduler*)param)->serve();
+
+	return 0;
+}
+
+
+void probeScheduler::serve()
+{
+	schedTask* t(0);
+
+	for(;;)
+	{
+		if(!t)
+		{
+			EnterCriticalSection(&lock);
+			t = pop();
+			bool stop = quit;
+			LeaveCriticalSection(&lock);
+
+			if(!t)
+			{
+				if(stop) return;
+
+				WaitForSingleObject(wake, INFINITE);
+				continue;
+			}
+		}
+
+		unsigned char fBuf[64];
+		memset(fBuf, 0, 64);
+
+		bool ok = (i1d3Command(dev, t->cmd.cmd, t->cmd.tBuf, fBuf, t->cmd.timeout) == 0);
+
+		t->cmd.timeout = 1.0;
+		t->cmd.hold = false;
+		int res = t->op->step(fBuf, ok, &t->cmd);
+
+		if(res != OP_MORE)
+		{
+			t->op->result = res;
+			SetEvent(t->done);
+			t = 0;
+			continue;
+		}
+
+		// a command that must follow on keeps the probe, anything else goes back in line behind its equals
+		if(t->cmd.hold) continue;
+
+		EnterCriticalSection(&lock);
+		push(t);
+		LeaveCriticalSection(&lock);
+		t = 0;
+	}
+}
@@ -0,0 +1,539 @@
+/*
+ * i1d3proto.h
+ *
+ * i1d3 probe protocol, shared by i1d3util, i1d3lib and i1d3bench
+ *
+ * This material is licenced under the GNU GENERAL PUBLIC LICENSE Version 2 or later :-
+ * see the License.txt file for licencing details.
+ *
+ *
+ */
+
+
+// Notes:
+//
+// Everything that talks to a probe lives in i1d3proto.cpp, from the HID transport and the i1d3 commands up to eeprom
+// access and unlocking.  i1d3util.exe, i1d3lib.dll and i1d3bench.exe each link it, so they always share the same
+// protocol code.
+
+
+#ifndef I1D3PROTO_H
+#define I1D3PROTO_H
+
+#include <windows.h>
+#include <string.h>
+
+#include "i1d3cmf.h"
+
+
+#define HID_QUEUE_DEPTH		4		// input reports kept queued by the queued transport
+#define HID_NUM_BUFFERS		64		// input report buffers of the HID class driver for the queued transport
+
+
+// Largest payload a firmware revision takes per packet, and the page size a write must not cross.  Reads are
+// limited by the 64 byte report, 59 bytes after the external read header and 60 after the internal one.
+struct i1d3Caps
+{
+	int				minVersion;		// firmware version * 100
+	int				maxVersion;
+	int				extRead;
+	int				extWrite;
+	int				extPage;
+	int				intRead;
+	int				intWrite;
+	int				intPage;
+};
+
+
+extern const i1d3Caps i1d3CapsTable[];
+
+class hidTrace;
+class hidEmulator;
+
+
+class hidIdevice
+{
+	public:
+					hidIdevice():dpath(0), fh(0), devInst(0), replay(0), emu(0), traceProbe(0), queueDepth(0), qhead(0), caps(i1d3CapsTable[0])
+						{ darkHz[0] = darkHz[1] = darkHz[2] = 0.0; };
+				   ~hidIdevice(){ if(dpath) delete[] dpath;};
+
+	char*			dpath;
+	HANDLE			fh;
+	OVERLAPPED		ols;
+	unsigned int	ProductID;
+	DWORD			devInst;	// device node of the HID interface
+	hidTrace*		replay;		// set when the device is a recorded trace rather than a probe
+	hidEmulator*	emu;		// set when the device is emulated
+	int				traceProbe;	// tells this probe's reports apart in a trace of several, see -y
+
+	int				queueDepth;	// reads kept outstanding by the queued transport, 0 for the plain one
+	int				qhead;		// the queued read the next report arrives in
+	OVERLAPPED		qols[HID_QUEUE_DEPTH];
+	unsigned char	qbuf[HID_QUEUE_DEPTH][65];
+
+	i1d3Caps		caps;		// transfer sizes for the firmware, see i1d3DetectCaps
+	double			darkHz[3];	// subtracted from every auto-ranged reading, see i1d3LoadDark
+};
+
+
+/* Declartions to enable HID access without using the DDK */
+extern int hidQueueDepth;		// transport for devices opened from now on, see -b
+
+HINSTANCE		loadDLLfuncs();
+
+#define MAX_PROBES			32
+#define DEVICE_CACHE_FILE	"i1d3util.devices"	// instance ids of the probes found last time
+
+int				findHIDdevices(hidIdevice** devs, int maxDevs);
+hidIdevice*		findHIDdevice();
+bool			openHIDdevice(hidIdevice* dev);
+void			closeHIDdevice(hidIdevice* dev);
+void			closeHIDdevices(hidIdevice** devs, int numOpen, int numDevs);
+double			timeNow();
+unsigned char*	readWholeFile(const char* fileName, unsigned int* size);
+
+
+/* Re-enumeration */
+bool			i1d3Reenumerate(hidIdevice** dev);
+void			i1d3ResetAfterWrite(hidIdevice** dev);
+
+
+/* Emulated probe */
+#define I1D3_CLK_FREQ		12e6	// integration time is given to the probe in master clock ticks
+
+
+// Answers the same commands as an unlocked-on-demand i1d3 from in-memory eeproms, adding a simulated
+// USB round trip to every transaction.  Used for benchmarks and soak testing without hardware.
+class hidEmulator
+{
+	public:
+					hidEmulator(int key = 2, double rtt = 0.0, double rttJitter = 0.0);
+
+	int				write(unsigned char* data, int len);
+	int				read(unsigned char* data, int len);
+
+	unsigned char	extEE[8192];
+	unsigned char	intEE[256];
+	unsigned char	resp[64];
+	unsigned char	challenge[64];
+	bool			haveResp;
+	int				keyIndex;	// position in i1d3UnLockKeys the emulated probe is locked to
+	double			latency;	// seconds per command round trip
+	double			jitter;
+	unsigned int	seed;
+};
+
+
+/* Recording and replay of HID reports */
+#define TRACE_OUT		0
+#define TRACE_IN		1
+#define TRACE_TIMEOUT	2		// a read that timed out, no data
+#define TRACE_FAILED	3		// a read that failed, no data
+
+
+class hidTrace
+{
+	public:
+					hidTrace():fh(INVALID_HANDLE_VALUE), buf(0), size(0), pos(0), recHdr(7), realTime(false), start(0.0), numMismatch(0) {};
+				   ~hidTrace(){ close(); };
+
+	bool			create(const char* fileName, unsigned int ProductID);
+	bool			load(const char* fileName, bool recordedTiming);
+	void			close();
+	void			setProductID(unsigned int pid);
+
+	void			record(int probe, int dir, unsigned char* data, int len);
+	int				replayWrite(unsigned char* data, int len);
+	int				replayRead(unsigned char* data, int len);
+
+	HANDLE			fh;
+	unsigned char*	buf;
+	unsigned int	size;
+	unsigned int	pos;
+	unsigned int	recHdr;			// bytes before the data of each record, 6 in an i1d3trc1 trace
+	bool			realTime;
+	double			start;
+	unsigned int	ProductID;
+	int				numMismatch;	// reports sent that differ from the ones recorded
+
+	private:
+	bool			nextRecord(unsigned char** rec);
+};
+
+
+extern hidTrace* hidRecord;		// set when -y asks for the HID traffic to be recorded
+
+void			closeTrace();
+
+
+/* Probe commands */
+int				readHIDdevice(hidIdevice* dev, unsigned char* rbuf, int numToRead, double timeout);
+int				writeHIDdevice(hidIdevice* dev, unsigned char* wbuf, int numToWrite, double timeout = 1.0);
+int				i1d3Command(hidIdevice* dev, unsigned short cmdCode, unsigned char* sBuf, unsigned char* rBuf, double timeout = 1.0);
+int				i1d3GetInfo(hidIdevice* dev, char* rBuf);
+int				i1d3DetectCaps(hidIdevice* dev);
+void			i1d3ProbeCaps(hidIdevice* dev);
+int				i1d3ReadExternalEeprom(hidIdevice* dev, unsigned char* buf);
+int				i1d3WriteExternalEeprom(hidIdevice* dev, unsigned char* buf);
+int				i1d3ReadInternalEeprom(hidIdevice* dev, unsigned char* buf);
+int				i1d3WriteInternalEeprom(hidIdevice* dev, unsigned char* buf);
+void			i1d3CreateUnLockResponse(unsigned int k0, unsigned int k1, unsigned char* c, unsigned char* r);
+
+extern unsigned int i1d3UnLockKeys[][2];
+extern int i1d3numUnLockKeys;
+extern const char* i1d3KeyNames[9];
+
+int				i1d3UnLock(hidIdevice* dev);
+void			i1d3ReadSerial(hidIdevice* dev, char* serNum);
+void			i1d3MakeEnWrite(unsigned char* tBuf);
+int				i1d3EnWrite(hidIdevice* dev);
+unsigned int	calcCsum(unsigned char* buf, bool alt = false);
+
+
+/* Spectral sensitivity */
+// The spectral sensitivity of the three sensor channels is held in the external eeprom
+// as 3 x 351 little endian IEEE floats covering 380nm to 730nm in 1nm steps
+#define SENS_OFFSET		0x010e
+#define SENS_BANDS		CMF_BANDS
+
+
+enum
+{
+	CMF_1931_2DEG,
+	CMF_1964_10DEG,
+	CMF_2006_2DEG,
+	CMF_2006_10DEG,
+	CMF_NUM_OBSERVERS
+};
+
+#define CMF_MISSING		0		// where an observer's table came from, see i1d3LoadCMF
+#define CMF_FIT			1
+#define CMF_TABLE		2
+
+#define CMF_FIRST_BAND	10		// 390nm, where the 2006 tables start
+
+
+extern const char* cmfNames[CMF_NUM_OBSERVERS];
+extern const char* cmfFiles[CMF_NUM_OBSERVERS];
+extern float cmfTables[CMF_NUM_OBSERVERS][3][CMF_BANDS];
+
+int				i1d3LoadCMF(int observer);
+
+float			spectralDotScalar(const float* a, const float* b, int n);
+
+extern const char* spectralKernel;		// name of the kernel spectralDot runs, set on first use
+
+float			spectralDot(const float* a, const float* b, int n);
+void			i1d3ReadSensitivities(unsigned char* eBuf, float sens[3][SENS_BANDS]);
+bool			i1d3IntegrateCMF(float sens[3][SENS_BANDS], int observer, double mat[3][3]);
+
+
+/* Measurement */
+int				i1d3Measure(hidIdevice* dev, double* inttime, double counts[3]);
+
+
+/* Refresh rate detection */
+#define REFRESH_SAMPLES		200
+#define REFRESH_INTTIME		0.001
+#define REFRESH_MIN_HZ		20.0
+#define REFRESH_MAX_HZ		250.0
+#define REFRESH_STEP_HZ		0.05
+#define REFRESH_MIN_CONF	6.0		// peak to floor power ratio below which there is no usable refresh
+#define REFRESH_SUBHARMONIC	0.3		// share of the peak power at which a subharmonic is taken as the refresh
+
+void			refreshFromSamples(double* times, double* vals, int n, double slack, double* refreshRate, double* confidence);
+int				i1d3DetectRefresh(hidIdevice* dev, double* refreshRate, double* confidence);
+double			snapToRefresh(double inttime, double refreshRate);
+
+
+/* Multiplexed probe operations */
+#define OP_MORE			1
+#define OP_DONE			0
+#define OP_FAILED		-1
+#define OP_CANCELLED	-2
+
+#define MUX_MAX_PROBES	MAXIMUM_WAIT_OBJECTS
+
+
+struct probeCmd
+{
+	unsigned short	cmd;
+	unsigned char	tBuf[64];
+	double			timeout;
+	bool			hold;		// must follow the previous command with nothing in between, see probeScheduler
+};
+
+
+// An operation is a series of commands to one probe written as a state machine, so that one thread can keep
+// many probes busy at full USB rate instead of blocking on each in turn.  step() is called with no reply to get
+// the first command, then with each reply in turn.  It fills in the next command and returns OP_MORE, or
+// returns OP_DONE or OP_FAILED.  ok is false if the probe rejected the command.
+class probeOp
+{
+	public:
+					probeOp():result(OP_MORE) {};
+	virtual		   ~probeOp() {};
+
+	virtual int		step(unsigned char* fBuf, bool ok, probeCmd* next) = 0;
+
+	int				result;		// OP_MORE while running
+};
+
+
+// Runs operations one after the other on the same probe, stopping at the first that fails
+class seqOp : public probeOp
+{
+	public:
+					seqOp():numOps(0), cur(0) {};
+				   ~seqOp() { for(int i(0); i < numOps; i++) delete ops[i]; };
+
+	void			add(probeOp* op) { if(numOps < 8) ops[numOps++] = op; };
+	int				step(unsigned char* fBuf, bool ok, probeCmd* next);
+
+	probeOp*		ops[8];
+	int				numOps;
+	int				cur;
+};
+
+
+class infoOp : public probeOp
+{
+	public:
+					infoOp() { memset(info, 0x00, 64); };
+
+	int				step(unsigned char* fBuf, bool ok, probeCmd* next);
+
+	char			info[64];
+};
+
+
+class unlockOp : public probeOp
+{
+	public:
+					unlockOp():key(-1), phase(0) {};
+
+	int				step(unsigned char* fBuf, bool ok, probeCmd* next);
+
+	int				key;		// index in i1d3UnLockKeys once unlocked
+	int				phase;
+};
+
+
+class eepromReadOp : public probeOp
+{
+	public:
+					eepromReadOp(bool external, unsigned int addr, unsigned int len, unsigned char* buf, const i1d3Caps& caps)
+						:ext(external), addr(addr), len(len), buf(buf), inc(0), chunk(external ? caps.extRead : caps.intRead) {};
+
+	int				step(unsigned char* fBuf, bool ok, probeCmd* next);
+
+	bool			ext;
+	unsigned int	addr;
+	unsigned int	len;
+	unsigned char*	buf;
+	unsigned int	inc;
+	unsigned int	chunk;		// the firmware's read size
+};
+
+
+class eepromWriteOp : public probeOp
+{
+	public:
+					eepromWriteOp(bool external, unsigned int addr, unsigned int len, const unsigned char* buf, const i1d3Caps& caps)
+						:ext(external), addr(addr), len(len), buf(buf), inc(0),
+						 chunk(external ? caps.extWrite : caps.intWrite), page(external ? caps.extPage : caps.intPage) {};
+
+	int				step(unsigned char* fBuf, bool ok, probeCmd* next);
+
+	bool			ext;
+	unsigned int	addr;
+	unsigned int	len;
+	const unsigned char* buf;
+	unsigned int	inc;
+	unsigned int	chunk;		// the firmware's write size
+	unsigned int	page;
+};
+
+
+// Brings an eeprom holding cur up to image, sending only the write packets whose bytes differ.  Packets are
+// split exactly as eepromWriteOp splits them.
+class eepromUpdateOp : public probeOp
+{
+	public:
+					eepromUpdateOp(bool external, const unsigned char* cur, const unsigned char* image, unsigned int size, const i1d3Caps& caps);
+
+	int				step(unsigned char* fBuf, bool ok, probeCmd* next);
+	unsigned int	packetLen(unsigned int at);
+
+	bool			ext;
+	const unsigned char* cur;
+	const unsigned char* image;
+	unsigned int	size;
+	unsigned int	addr;
+	unsigned int	inc;
+	unsigned int	chunk;
+	unsigned int	page;
+	int				numPackets;	// that differ, for progress
+	int				sent;
+};
+
+
+// A single command, for the one packet exchanges such as enabling writes.  Like i1d3EnWrite it carries on
+// whatever the reply, accepted says whether the probe took it.
+class commandOp : public probeOp
+{
+	public:
+					commandOp(unsigned short cmd, const unsigned char* tBuf):cmd(cmd), accepted(false) { memcpy(this->tBuf, tBuf, 64); memset(fBuf, 0x00, 64); };
+
+	int				step(unsigned char* fBuf, bool ok, probeCmd* next);
+
+	unsigned short	cmd;
+	unsigned char	tBuf[64];
+	unsigned char	fBuf[64];	// the reply
+	bool			accepted;
+};
+
+
+// A burst of back to back frequency measurements, each timestamped on the host like i1d3DetectRefresh
+class measureBurstOp : public probeOp
+{
+	public:
+					measureBurstOp(int n, double inttime):num(n), count(0), sent(0.0), slack(0.0)
+						{ times = new double[n]; vals = new double[n * 3]; intclks = (unsigned int)(inttime * I1D3_CLK_FREQ + 0.5); };
+				   ~measureBurstOp() { delete[] times; delete[] vals; };
+
+	int				step(unsigned char* fBuf, bool ok, probeCmd* next);
+
+	int				num;
+	int				count;
+	unsigned int	intclks;
+	double			sent;
+	double			slack;		// summed round trip time beyond the integration
+	double*			times;
+	double*			vals;		// three counts per reading
+};
+
+
+// A global allowance of transactions in flight across all the probes of a multiplexer, sized from their round
+// trip times in the manner of TCP Vegas.  The fastest round trip seen is taken as the uncontended time, and
+// limit * (1 - minRtt / avgRtt) estimates how many of the transactions in flight are only queued behind the
+// others.  Once per round of transactions the limit grows by one while that is below BUDGET_ALPHA and shrinks by
+// one while it is above BUDGET_BETA, and a timeout halves it.
+class muxBudget
+{
+	public:
+					muxBudget(int maxLimit):limit(1), maxLimit(maxLimit), minRtt(0.0), avgRtt(0.0), count(0), timeouts(0) {};
+
+	void			sample(double rtt);
+	void			timeout();
+
+	int				limit;
+	int				maxLimit;
+	double			minRtt;
+	double			avgRtt;		// smoothed like TCP's srtt
+	int				count;
+	int				timeouts;
+};
+
+
+// Drives one operation on each of a number of probes from a single thread.  Each probe has one report in
+// flight at a time, the overlapped write then read of i1d3Command, and the thread sleeps in
+// WaitForMultipleObjects until any of them completes.  Emulated and replayed probes complete at once.
+//
+// With a budget the number of transactions in flight across all probes is held to budget->limit.  Probes with a
+// command ready beyond that wait their turn in order of arrival, so when the budget shrinks every probe slows
+// down alike rather than some stalling, and a command that times out is sent again up to MUX_RETRIES times.
+// Before it is, the probe's input is flushed and its late reply waited out for one more timeout, as i1d3Command
+// does, or the resend would take that reply as its own and every later reply on the probe would be one behind.
+class probeMux
+{
+	public:
+					probeMux():numSlots(0), budget(0), inFlight(0), heldHead(0), numHeld(0) {};
+
+	int				add(hidIdevice* dev, probeOp* op);
+	int				run(double maxTime = 0.0);
+	void			cancel(int slot);
+	void			setBudget(muxBudget* b) { budget = b; };
+
+	private:
+	struct muxSlot
+	{
+		hidIdevice*		dev;
+		probeOp*		op;
+		probeCmd		cmd;
+		unsigned char	lBuf[65];	// report id byte then the report
+		int				state;
+		double			deadline;
+		double			sent;
+		bool			flying;		// counted in inFlight
+		int				retries;
+	};
+
+	bool			issue(muxSlot* s);
+	bool			start(muxSlot* s);
+	void			complete(muxSlot* s);
+	void			finish(muxSlot* s, int result);
+	void			stop(muxSlot* s);
+	void			drain(muxSlot* s);
+	void			landed(muxSlot* s);
+	void			release();
+
+	muxSlot			slots[MUX_MAX_PROBES];
+	int				numSlots;
+
+	muxBudget*		budget;
+	int				inFlight;
+	int				held[MUX_MAX_PROBES];	// ring of held slots, oldest first
+	int				heldHead;
+	int				numHeld;
+};
+
+
+/* Per-device scheduling */
+#define SCHED_MEASURE	0		// priorities, the lowest number runs first
+#define SCHED_BULK		1
+#define SCHED_LEVELS	2
+
+
+// Shares one probe between threads.  Callers hand in operations with a priority and a single worker thread runs
+// them one command at a time, choosing the highest priority operation afresh before every command.  An eeprom
+// job is already a series of packet sized commands, so a measurement that arrives part way through an 8 KB dump
+// waits for at most the one packet in flight, while a job with nothing competing runs its packets back to back.
+// Operations of equal priority take turns, command by command, and after each command of one priority a waiting
+// operation of the next priority down gets one, so a steady stream of measurements slows a dump but cannot stall it.
+class probeScheduler
+{
+	public:
+					probeScheduler(hidIdevice* dev);
+				   ~probeScheduler();
+
+	int				run(probeOp* op, int priority);
+	bool			valid() { return wake && thread; };	// false if the worker could not be started
+
+	private:
+	struct schedTask
+	{
+		probeOp*		op;
+		int				priority;
+		probeCmd		cmd;
+		HANDLE			done;
+		schedTask*		next;
+	};
+
+	static DWORD WINAPI	worker(LPVOID param);
+	void			serve();
+	void			push(schedTask* t);
+	schedTask*		pop();
+
+	hidIdevice*		dev;
+	CRITICAL_SECTION lock;
+	HANDLE			wake;		// set when a task is queued and on shutdown
+	HANDLE			thread;
+	bool			quit;
+	int				last;		// priority of the last command
+	schedTask*		head[SCHED_LEVELS];
+	schedTask*		tail[SCHED_LEVELS];
+};
+
+#endif
@@ -1,4 +1,3 @@
-
 /* 
  * i1D3util.cpp
  *
@@ -65,6 +64,7 @@
 // The i1d3util will try and detect this and correct the problem.
 //
 // Between each WRITE to the i1d3, it is important that you unplug and plug back in the probe to reset the Windows device driver.
+// Run as administrator and i1d3util does this itself by cycling the USB port, otherwise it asks you to.
 //
 // Once a write operation has been performed, the i1d3 sometimes starts flashing its white LEDS.  This is normal, and is part of it visual feedback system.  
 // Most application will either turn this off or allow you to turn it off/on
@@ -76,12 +76,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include <setupapi.h>
-
 #include <math.h>
+#include <ctype.h>
 #include <iostream>
 #include <fstream>
 
+#include "i1d3proto.h"
+
 
 using namespace std;
 
@@ -142,629 +143,3690 @@ int getopt(int nargc, char * const nargv[], const char *ostr)
 	return optopt;
 }
 
-/* Declartions to enable HID access without using the DDK */
-#define DIDD_BUFSIZE sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA) + (sizeof(TCHAR)*MAX_PATH)
 
-class hidIdevice
+bool invert3x3(double in[3][3], double out[3][3])
+{
+	double det = in[0][0] * (in[1][1] * in[2][2] - in[1][2] * in[2][1])
+			   - in[0][1] * (in[1][0] * in[2][2] - in[1][2] * in[2][0])
+			   + in[0][2] * (in[1][0] * in[2][1] - in[1][1] * in[2][0]);
+
+	if(fabs(det) < 1e-12) return false;
+
+	out[0][0] =  (in[1][1] * in[2][2] - in[1][2] * in[2][1]) / det;
+	out[0][1] = -(in[0][1] * in[2][2] - in[0][2] * in[2][1]) / det;
+	out[0][2] =  (in[0][1] * in[1][2] - in[0][2] * in[1][1]) / det;
+	out[1][0] = -(in[1][0] * in[2][2] - in[1][2] * in[2][0]) / det;
+	out[1][1] =  (in[0][0] * in[2][2] - in[0][2] * in[2][0]) / det;
+	out[1][2] = -(in[0][0] * in[1][2] - in[0][2] * in[1][0]) / det;
+	out[2][0] =  (in[1][0] * in[2][1] - in[1][1] * in[2][0]) / det;
+	out[2][1] = -(in[0][0] * in[2][1] - in[0][1] * in[2][0]) / det;
+	out[2][2] =  (in[0][0] * in[1][1] - in[0][1] * in[1][0]) / det;
+
+	return true;
+}
+
+
+// FNV-1a, used to key cached corrections on the content of the correction file.  Pass the hash of one buffer to
+// carry it on over another.
+unsigned int hashBuffer(unsigned char* buf, unsigned int size, unsigned int hash = 0x811c9dc5)
+{
+
+	for(unsigned int i(0); i < size; i++)
+	{
+		hash ^= buf[i];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+
+/* Minimal CGATS reader, enough for the Argyll CCSS and CCMX files */
+#define CGATS_MAX_FIELDS	512
+
+class cgatsData
 {
 	public:
-					hidIdevice():dpath(0), fh(0) {};
-				   ~hidIdevice(){ if(dpath) delete[] dpath;};
+					cgatsData():numFields(0), numSets(0), fields(0), data(0) { memset(type, 0, 16); };
+				   ~cgatsData(){ if(fields) delete[] fields; if(data) delete[] data; };
 
-	char*			dpath;
-	HANDLE			fh;
-	OVERLAPPED		ols;
-	unsigned int	ProductID;
+	int				findField(const char* name);
+
+	char			type[16];
+	int				numFields;
+	int				numSets;
+	char**			fields;
+	double*			data;		// numSets x numFields
 };
 
 
-typedef struct _HIDD_ATTRIBUTES
+int cgatsData::findField(const char* name)
+{
+	for(int i(0); i < numFields; i++)
+	{
+		if(strcmp(fields[i], name) == 0) return i;
+	}
+
+	return -1;
+}
+
+
+char* cgatsToken(char** pos)
 {
-	ULONG	Size;
-	USHORT	VendorID;
-	USHORT	ProductID;
-	USHORT	VersionNumber;
-} HIDD_ATTRIBUTES, *PHIDD_ATTRIBUTES;
+	char* cPtr = *pos;
+
+	while(*cPtr && (*cPtr == ' ' || *cPtr == '\t' || *cPtr == '\r' || *cPtr == '\n')) cPtr++;
+	if(!*cPtr) return 0;
+
+	char* tok = cPtr;
+	if(*cPtr == '"')
+	{
+		tok = ++cPtr;
+		while(*cPtr && *cPtr != '"') cPtr++;
+	}
+	else
+	{
+		while(*cPtr && *cPtr != ' ' && *cPtr != '\t' && *cPtr != '\r' && *cPtr != '\n') cPtr++;
+	}
+
+	if(*cPtr) *cPtr++ = 0;
+	*pos = cPtr;
+
+	return tok;
+}
 
-typedef void (__stdcall *FP_HidD_GetHidGuid)   (LPGUID HidGuid);
-typedef BOOL (__stdcall *FP_HidD_GetAttributes)(HANDLE , PHIDD_ATTRIBUTES Attributes);
-FP_HidD_GetHidGuid    HidD_GetHidGuid;
-FP_HidD_GetAttributes HidD_GetAttributes;
 
-HINSTANCE loadDLLfuncs()
+// Parses the file in place, the field names point into text
+bool parseCGATS(char* text, cgatsData* cd)
 {
-	static HINSTANCE lib(0);
+	char* pos = text;
+	char* tok = cgatsToken(&pos);
+	if(!tok) return false;
 
-	if(!lib)
+	strncpy(cd->type, tok, 15);
+
+	cd->fields = new char*[CGATS_MAX_FIELDS];
+
+	while((tok = cgatsToken(&pos)) != 0)
 	{
-		lib = LoadLibrary("HID");
-		if(lib)
+		if(strcmp(tok, "BEGIN_DATA_FORMAT") == 0)
+		{
+			while((tok = cgatsToken(&pos)) != 0 && strcmp(tok, "END_DATA_FORMAT") != 0)
+			{
+				if(cd->numFields >= CGATS_MAX_FIELDS) return false;
+				cd->fields[cd->numFields++] = tok;
+			}
+		}
+		else if(strcmp(tok, "NUMBER_OF_SETS") == 0)
 		{
-			HidD_GetHidGuid    = (FP_HidD_GetHidGuid)    GetProcAddress(lib, "HidD_GetHidGuid");
-			HidD_GetAttributes = (FP_HidD_GetAttributes) GetProcAddress(lib, "HidD_GetAttributes");
+			if((tok = cgatsToken(&pos)) == 0) return false;
+			cd->numSets = atoi(tok);
 		}
+		else if(strcmp(tok, "BEGIN_DATA") == 0)
+		{
+			if(cd->numFields == 0 || cd->numSets <= 0) return false;
+
+			cd->data = new double[cd->numSets * cd->numFields];
 
-		if((HidD_GetHidGuid == 0) || (HidD_GetAttributes == 0)) lib = 0;
+			for(int i(0); i < cd->numSets * cd->numFields; i++)
+			{
+				if((tok = cgatsToken(&pos)) == 0 || strcmp(tok, "END_DATA") == 0) return false;
+				cd->data[i] = atof(tok);
+			}
+
+			return true;
+		}
 	}
 
-	return lib;
+	return false;
 }
 
 
-hidIdevice* findHIDdevice()
+/* Display type corrections */
+#define CORR_CCMX			1
+#define CORR_CCSS			2
+#define CORR_FIT			3		// fitted against a reference instrument with -g
+
+#define CORR_FIT_HASH		0		// cache key of a fitted matrix, which has no file to hash
+
+#define CORR_CACHE_FILE		"i1d3util.cache"
+#define CORR_CACHE_ENTRIES	256
+
+struct corrCacheHeader
 {
-	// Get the GUID for HIDClass devices
-	GUID HidGuid;
-	HidD_GetHidGuid(&HidGuid);
+	char			magic[8];
+	unsigned int	numEntries;
+	unsigned int	next;		// round robin replacement once the table is full
+};
 
-	// Get the device information for all devices of the HID class
-	HDEVINFO hdinfo;
-	hdinfo = SetupDiGetClassDevs(&HidGuid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE); 
-	if(hdinfo == INVALID_HANDLE_VALUE) return 0;
+struct corrCacheEntry
+{
+	char			serNum[20];
+	unsigned int	hash;
+	unsigned int	type;
+	double			mat[3][3];
+};
 
-	/* Get each devices interface data in turn */
-	SP_DEVICE_INTERFACE_DATA diData;
-	diData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
 
-	PSP_DEVICE_INTERFACE_DETAIL_DATA pdiDataDetail;
-	char* diddBuf[DIDD_BUFSIZE];
-	pdiDataDetail = (PSP_DEVICE_INTERFACE_DETAIL_DATA)diddBuf;  
-	pdiDataDetail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+// The cache is a fixed size table in a memory mapped file, so a lookup costs no parsing
+class corrCache
+{
+	public:
+					corrCache():fh(INVALID_HANDLE_VALUE), mh(0), hdr(0), entries(0) {};
+				   ~corrCache(){ close(); };
 
-	SP_DEVINFO_DATA dinfoData;
-	dinfoData.cbSize = sizeof(SP_DEVINFO_DATA);
+	bool			open(const char* fileName);
+	void			close();
+	corrCacheEntry*	find(const char* serNum, unsigned int hash);
+	corrCacheEntry*	add(const char* serNum, unsigned int hash);
 
-	hidIdevice* hidDev(0);
+	HANDLE			fh;
+	HANDLE			mh;
+	corrCacheHeader* hdr;
+	corrCacheEntry*	entries;
+};
 
-	for(unsigned int c(0); ; ++c)
-	{
-		if(SetupDiEnumDeviceInterfaces(hdinfo, NULL, &HidGuid, c, &diData) == 0)
-		{
-			if (GetLastError() == ERROR_NO_MORE_ITEMS) break;
 
-			return 0;
-		}
+bool corrCache::open(const char* fileName)
+{
+	DWORD sz = sizeof(corrCacheHeader) + CORR_CACHE_ENTRIES * sizeof(corrCacheEntry);
 
-		if(SetupDiGetDeviceInterfaceDetail(hdinfo, &diData, pdiDataDetail, DIDD_BUFSIZE, NULL, &dinfoData) == 0)
-		{
-			return 0;
-		}
+	fh = CreateFile(fileName, GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, 0, NULL);
+	if(fh == INVALID_HANDLE_VALUE) return false;
 
-		// Extract the vid and pid from the device path
-		unsigned int VendorID(0);
-		unsigned int ProductID(0);
-	
-		char *cPtr;
-		char cBuf[20];
-
-		if((cPtr = strchr(pdiDataDetail->DevicePath, 'v')) == NULL) continue;
-		if(strlen(cPtr) < 8) continue;
-		if(cPtr[1] != 'i' || cPtr[2] != 'd' || cPtr[3] != '_') continue;
-		memcpy(cBuf, cPtr + 4, 4);
-		cBuf[4] = 0;
-		if(sscanf(cBuf, "%x", &VendorID) != 1) continue;
-
-		if((cPtr = strchr(pdiDataDetail->DevicePath, 'p')) == NULL) continue;
-		if(strlen(cPtr) < 8) break;
-		if(cPtr[1] != 'i' || cPtr[2] != 'd' || cPtr[3] != '_') continue;
-		memcpy(cBuf, cPtr + 4, 4);
-		cBuf[4] = 0;
-		if(sscanf(cBuf, "%x", &ProductID) != 1) break;
-
-		//Is it an X-Rite i1DisplayPro, ColorMunki Display (HID)
-		if((VendorID == 0x0765) && ((ProductID == 0x5020) || (ProductID == 0x5021)))
-		{
-			hidDev = new hidIdevice;
-			if(!hidDev) return 0;
-			hidDev->dpath = new char[strlen(pdiDataDetail->DevicePath) + 2];
-			if(!hidDev->dpath) return 0;
-			memset(hidDev->dpath, 0x00, strlen(pdiDataDetail->DevicePath) + 2);
-
-			/* Windows 10 seems to return paths without the leading '\\' */
-			if(pdiDataDetail->DevicePath[0] == '\\' &&	pdiDataDetail->DevicePath[1] != '\\') strcpy(hidDev->dpath, "\\");
-			strcpy(hidDev->dpath, pdiDataDetail->DevicePath);
-
-			hidDev->ProductID = ProductID;
+	bool created = (GetLastError() != ERROR_ALREADY_EXISTS);
 
-			break;
-		}
+	mh = CreateFileMapping(fh, NULL, PAGE_READWRITE, 0, sz, NULL);
+	if(mh == NULL)
+	{
+		close();
+		return false;
+	}
+
+	hdr = (corrCacheHeader*)MapViewOfFile(mh, FILE_MAP_WRITE, 0, 0, sz);
+	if(hdr == NULL)
+	{
+		close();
+		return false;
 	}
 
-	//cleanup hdifo
-	if(SetupDiDestroyDeviceInfoList(hdinfo) == 0) return 0;
+	entries = (corrCacheEntry*)(hdr + 1);
+
+	// A new or foreign file is reset to an empty table.  The magic changes whenever the stored matrices would mean
+	// something different, ccc2 is the CCSS fit scaled to cd/m^2.
+	if(created || memcmp(hdr->magic, "i1d3ccc2", 8) != 0 || hdr->numEntries != CORR_CACHE_ENTRIES)
+	{
+		memset(hdr, 0x00, sz);
+		memcpy(hdr->magic, "i1d3ccc2", 8);
+		hdr->numEntries = CORR_CACHE_ENTRIES;
+	}
 
-    return hidDev;
+	return true;
 }
 
 
-bool openHIDdevice(hidIdevice* dev)
+void corrCache::close()
 {
-	// Open the device
-	dev->fh = CreateFile(dev->dpath, GENERIC_READ|GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+	if(hdr) UnmapViewOfFile(hdr);
+	if(mh) CloseHandle(mh);
+	if(fh != INVALID_HANDLE_VALUE) CloseHandle(fh);
+
+	hdr = 0;
+	entries = 0;
+	mh = 0;
+	fh = INVALID_HANDLE_VALUE;
+}
+
 
-	if(dev != INVALID_HANDLE_VALUE)
+corrCacheEntry* corrCache::find(const char* serNum, unsigned int hash)
+{
+	for(int i(0); i < CORR_CACHE_ENTRIES; i++)
 	{
-		memset(&dev->ols,0,sizeof(OVERLAPPED));
-		dev->ols.hEvent = CreateEvent(NULL, 0, 0, NULL);
-  		if(dev->ols.hEvent == NULL) return false;
-		
-		return true;
+		if(entries[i].type != 0 && entries[i].hash == hash && memcmp(entries[i].serNum, serNum, 20) == 0)
+		{
+			return &entries[i];
+		}
 	}
 
-	return false;
+	return 0;
 }
 
 
-void closeHIDdevice(hidIdevice* dev)
+corrCacheEntry* corrCache::add(const char* serNum, unsigned int hash)
 {
-	if(dev != NULL)
+	corrCacheEntry* entry(0);
+
+	for(int i(0); i < CORR_CACHE_ENTRIES && !entry; i++)
+	{
+		if(entries[i].type == 0) entry = &entries[i];
+	}
+
+	if(!entry)
 	{
-		CloseHandle(dev->ols.hEvent);
-		CloseHandle(dev->fh);
+		entry = &entries[hdr->next];
+		hdr->next = (hdr->next + 1) % CORR_CACHE_ENTRIES;
 	}
+
+	memset(entry, 0x00, sizeof(corrCacheEntry));
+	memcpy(entry->serNum, serNum, 20);
+	entry->hash = hash;
+
+	return entry;
 }
 
 
-int	readHIDdevice(hidIdevice* dev, unsigned char* rbuf,	int numToRead, double timeout)
+// Resample a CCSS spectrum onto the 1nm grid of the sensor data
+void ccssResample(cgatsData* cd, int set, int* specField, double* specNm, int numSpec, float* out)
 {
-	int numRead(0);
-
-	unsigned char* lBuf;
-	lBuf = new unsigned char[numToRead + 1];
-	if(!lBuf) return -1;
-	memset(lBuf, 0x00, numToRead + 1);
+	double* row = cd->data + set * cd->numFields;
 
-	if (ReadFile(dev->fh, lBuf, numToRead + 1, (LPDWORD)&numRead, &dev->ols) == 0)
+	for(int i(0); i < SENS_BANDS; i++)
 	{
-		if(GetLastError() != ERROR_IO_PENDING)
-		{
-			numRead = -1; 
-		}
-		else
+		double nm = CMF_START_NM + i;
+		out[i] = 0.0f;
+
+		for(int j(0); j + 1 < numSpec; j++)
 		{
-			int res;
-			res = WaitForSingleObject(dev->ols.hEvent, (int)(timeout * 1000.0 + 0.5));
-			if(res == WAIT_FAILED)
+			if(nm >= specNm[j] && nm <= specNm[j + 1])
 			{
-				numRead = -1;
-			}
-			else if
-			(res == WAIT_TIMEOUT)
-			{
-				CancelIo(dev->fh);
-				numRead = -1;
-			}
-			else
-			{
-				numRead = dev->ols.InternalHigh;
+				double t = (nm - specNm[j]) / (specNm[j + 1] - specNm[j]);
+				out[i] = (float)((1.0 - t) * row[specField[j]] + t * row[specField[j + 1]]);
+				break;
 			}
 		}
 	}
+}
+
+
+// Fit the sensor RGB to XYZ matrix for this probe from the CCSS display samples
+bool ccssFitMatrix(cgatsData* cd, float sens[3][SENS_BANDS], double mat[3][3])
+{
+	i1d3LoadCMF(CMF_1931_2DEG);
 
-	if(numRead > 0)
+	int* specField = new int[cd->numFields];
+	double* specNm = new double[cd->numFields];
+	int numSpec(0);
+
+	for(int i(0); i < cd->numFields; i++)
 	{
-		numRead--;
-		memcpy(rbuf, lBuf + 1, numRead);
+		if(strncmp(cd->fields[i], "SPEC_", 5) == 0)
+		{
+			specField[numSpec] = i;
+			specNm[numSpec++] = atof(cd->fields[i] + 5);
+		}
 	}
 
-	delete[] lBuf;
-
-	return numRead;
-}
+	if(numSpec < 2)
+	{
+		delete[] specField;
+		delete[] specNm;
+		return false;
+	}
 
+	// Accumulate the normal equations for XYZ = M * RGB
+	double rr[3][3], xr[3][3];
+	memset(rr, 0, sizeof(rr));
+	memset(xr, 0, sizeof(xr));
 
-int writeHIDdevice(hidIdevice* dev,	unsigned char* wbuf, int numToWrite, double timeout = 1.0)
-{
-	int numWritten(0);
+	float spec[SENS_BANDS];
 
-	unsigned char* lBuf;
-	lBuf = new unsigned char[numToWrite + 1];
-	if(!lBuf) return -1;
-	memset(lBuf, 0x00, numToWrite + 1);
-	memcpy(lBuf + 1, wbuf, numToWrite);
+	for(int set(0); set < cd->numSets; set++)
+	{
+		ccssResample(cd, set, specField, specNm, numSpec, spec);
 
-	if(WriteFile(dev->fh, lBuf, numToWrite + 1, (LPDWORD)&numWritten, &dev->ols) == 0)
-	{ 
-		if (GetLastError() != ERROR_IO_PENDING)
+		double rgb[3], xyz[3];
+		for(int k(0); k < 3; k++)
 		{
-			numWritten = -1; 
+			rgb[k] = spectralDot(sens[k], spec, SENS_BANDS);
+			xyz[k] = 683.0 * spectralDot(cmfTables[CMF_1931_2DEG][k], spec, SENS_BANDS);	// so Y is in cd/m^2
 		}
-		else
+
+		for(int r(0); r < 3; r++)
 		{
-			int res;
-			res = WaitForSingleObject(dev->ols.hEvent, (int)(timeout * 1000.0 + 0.5));
-			if (res == WAIT_FAILED)
-			{
-				numWritten = -1; 
-			}
-			else if (res == WAIT_TIMEOUT)
-			{
-				CancelIo(dev->fh);
-				numWritten = -1; 
-			}
-			else
+			for(int c(0); c < 3; c++)
 			{
-				numWritten = dev->ols.InternalHigh;
+				rr[r][c] += rgb[r] * rgb[c];
+				xr[r][c] += xyz[r] * rgb[c];
 			}
 		}
 	}
 
-	if(numWritten > 0)
+	delete[] specField;
+	delete[] specNm;
+
+	double rri[3][3];
+	if(!invert3x3(rr, rri)) return false;
+
+	for(int r(0); r < 3; r++)
 	{
-		numWritten--;
+		for(int c(0); c < 3; c++)
+		{
+			mat[r][c] = xr[r][0] * rri[0][c] + xr[r][1] * rri[1][c] + xr[r][2] * rri[2][c];
+		}
 	}
 
-	delete[] lBuf;
+	return true;
+}
+
 
-	return numWritten;
+void applyMatrix(double mat[3][3], double in[3], double out[3])
+{
+	for(int r(0); r < 3; r++)
+	{
+		out[r] = mat[r][0] * in[0] + mat[r][1] * in[1] + mat[r][2] * in[2];
+	}
 }
 
 
-int i1d3Command(hidIdevice* dev,unsigned short cmdCode, unsigned char* sBuf, unsigned char* rBuf, double timeout = 1.0)
+// Load a CCMX or CCSS file for the probe with the given serial number, returns the correction type or -1
+int i1d3LoadCorrection(hidIdevice* dev, const char* serNum, const char* corrFile, double mat[3][3], bool* cached)
 {
-	unsigned char cmd;		/* Major command code */
-	int wbytes;				/* bytes written */
-	int rbytes;				/* bytes read from ep */
-	int num;
+	unsigned int size(0);
+	unsigned char* buf = readWholeFile(corrFile, &size);
+	if(!buf) return -1;
 
-	cmd = (cmdCode >> 8) & 0xff;	// Major command == HID report number
-	sBuf[0] = cmd;
+	// a CCSS matrix also depends on which 1931 table it was integrated against
+	unsigned int hash = hashBuffer(buf, size);
+	if(i1d3LoadCMF(CMF_1931_2DEG) == CMF_TABLE) hash = hashBuffer((unsigned char*)cmfTables[CMF_1931_2DEG], sizeof(cmfTables[0]), hash);
 
-	if(cmd == 0x00) sBuf[1] = (cmdCode & 0xff);	// Minor command
+	corrCache cache;
+	bool haveCache = cache.open(CORR_CACHE_FILE);
 
-	num = writeHIDdevice(dev, sBuf, 64, timeout);
-	if(num == -1)
+	corrCacheEntry* entry(0);
+	if(haveCache && (entry = cache.find(serNum, hash)) != 0)
 	{
-		// flush any crap
-		num = readHIDdevice(dev, rBuf, 64, timeout);
-		return -1;
+		delete[] buf;
+
+		memcpy(mat, entry->mat, sizeof(entry->mat));
+		*cached = true;
+
+		return entry->type;
 	}
 
-	num = readHIDdevice(dev, rBuf, 64, timeout);
-	if(num == -1)
+	*cached = false;
+
+	cgatsData cd;
+	int type(-1);
+
+	if(parseCGATS((char*)buf, &cd))
 	{
-		// flush any crap
-		num = readHIDdevice(dev, rBuf, 64, timeout);
-		return -1;
+		if(strcmp(cd.type, "CCMX") == 0)
+		{
+			int fx = cd.findField("XYZ_X");
+			int fy = cd.findField("XYZ_Y");
+			int fz = cd.findField("XYZ_Z");
+
+			if(fx >= 0 && fy >= 0 && fz >= 0 && cd.numSets == 3)
+			{
+				for(int r(0); r < 3; r++)
+				{
+					mat[r][0] = cd.data[r * cd.numFields + fx];
+					mat[r][1] = cd.data[r * cd.numFields + fy];
+					mat[r][2] = cd.data[r * cd.numFields + fz];
+				}
+
+				type = CORR_CCMX;
+			}
+		}
+		else if(strcmp(cd.type, "CCSS") == 0)
+		{
+			unsigned char* eBuf = new unsigned char[8192];
+			memset(eBuf, 0x00, 8192);
+			i1d3ReadExternalEeprom(dev, eBuf);
+
+			unsigned int fsum = eBuf[2] | (eBuf[3] << 8);
+
+			if(calcCsum(eBuf) == fsum || calcCsum(eBuf, true) == fsum)
+			{
+				float sens[3][SENS_BANDS];
+				i1d3ReadSensitivities(eBuf, sens);
+
+				if(ccssFitMatrix(&cd, sens, mat)) type = CORR_CCSS;
+			}
+
+			delete[] eBuf;
+		}
 	}
 
-	/* The first byte returned seems to be a command result error code. */
-	if((rBuf[0] != 0x00) || (rBuf[1] != cmd))
+	delete[] buf;
+
+	if(type > 0 && haveCache)
 	{
-		return -1;
+		entry = cache.add(serNum, hash);
+		entry->type = type;
+		memcpy(entry->mat, mat, sizeof(entry->mat));
 	}
 
-	return 0; 
+	return type;
 }
 
 
-void i1d3GetInfo(hidIdevice* dev, char* rBuf)
+// A matrix fitted with -g takes the probe's frequencies straight to XYZ.  It lives in the correction cache, so
+// loading it before a run costs one table lookup and applying it is the same matrix multiply as a CCSS correction.
+bool i1d3LoadFit(const char* serNum, double mat[3][3])
 {
-	unsigned char tBuf[64];
-	unsigned char fBuf[64];
-	unsigned short cmd;
+	corrCache cache;
+	if(!cache.open(CORR_CACHE_FILE)) return false;
 
-	memset(tBuf, 0, 64);
-	memset(fBuf, 0, 64);
+	corrCacheEntry* entry = cache.find(serNum, CORR_FIT_HASH);
+	if(!entry || entry->type != CORR_FIT) return false;
 
-	cmd = 0x0000;
-	i1d3Command(dev, cmd, tBuf, fBuf);
-	
-	strncpy((char *)rBuf, (char *)fBuf + 2, 62);
+	memcpy(mat, entry->mat, sizeof(entry->mat));
+
+	return true;
 }
 
 
-int i1d3ReadExternalEeprom(hidIdevice* dev,	unsigned char* buf)
+bool i1d3StoreFit(const char* serNum, double mat[3][3])
 {
-	unsigned char tBuf[64];
-	unsigned char fBuf[64];
-	unsigned short cmd;
+	corrCache cache;
+	if(!cache.open(CORR_CACHE_FILE)) return false;
+
+	corrCacheEntry* entry = cache.find(serNum, CORR_FIT_HASH);
+	if(!entry) entry = cache.add(serNum, CORR_FIT_HASH);
 
-	memset(tBuf, 0, 64);
-	memset(fBuf, 0, 64);
+	entry->type = CORR_FIT;
+	memcpy(entry->mat, mat, sizeof(entry->mat));
 
-	cmd = 0x1200;
+	return true;
+}
 
-	unsigned char* bPtr = buf;
 
-	// read up into 59 byte packets
-	unsigned short addr(0);
-	for(int len(8192), inc(0); len > 0; addr += inc, bPtr += inc, len -= inc)
-	{
-		inc = len;
-		if(inc > 59) inc = 59;
+// A CCMX corrects one instrument's XYZ to another's, so it needs the probe's own XYZ first.  That is the -g fit,
+// mat becomes the CCMX times the fit.  Returns false and leaves mat alone if the probe has no fit.
+bool i1d3ApplyCCMX(const char* serNum, double mat[3][3])
+{
+	double base[3][3];
+	if(!i1d3LoadFit(serNum, base)) return false;
 
-		tBuf[1]	= (addr >> 8) & 0xff;
-		tBuf[2] = addr & 0xff;
-		tBuf[3] = (unsigned char)inc;
+	double ccmx[3][3];
+	memcpy(ccmx, mat, sizeof(ccmx));
 
-		i1d3Command(dev, cmd, tBuf, fBuf);
-	
-		memcpy(bPtr, fBuf + 5, inc);
+	for(int r(0); r < 3; r++)
+	{
+		for(int c(0); c < 3; c++)
+		{
+			mat[r][c] = ccmx[r][0] * base[0][c] + ccmx[r][1] * base[1][c] + ccmx[r][2] * base[2][c];
+		}
 	}
 
-	return 0;
+	return true;
 }
 
 
-int i1d3WriteExternalEeprom(hidIdevice* dev,	unsigned char* buf)
+/* Measurement */
+#define MEAS_PROBE_TIME		0.02	// first short reading used to estimate the light level
+#define MEAS_MAX_CHUNK		1.0
+#define MEAS_MAX_TIME		6.0		// give up refining after this much integration
+#define MEAS_PRECISION		0.001	// target relative precision of the dimmest channel
+
+#define STATS_MIN_SAMPLES	3		// readings needed before the variance means anything
+#define STATS_MAX_SAMPLES	50
+#define STATS_CLIP_SIGMA	3.0
+#define STATS_CLIP_MIN		8		// readings needed before sigma clipping starts
+
+
+// Running mean and variance of one channel in constant memory (Welford)
+class runStats
 {
-	unsigned char tBuf[64];
-	unsigned char fBuf[64];
-	unsigned short cmd;
+	public:
+					runStats():n(0), mean(0.0), m2(0.0) {};
 
-	memset(tBuf, 0, 64);
-	memset(fBuf, 0, 64);
+	void			add(double x);
+	double			variance() { return (n > 1) ? m2 / (n - 1) : 0.0; };
+	double			stdErr() { return (n > 1) ? sqrt(variance() / n) : 0.0; };
+	bool			outlier(double x, double slack);
 
-	cmd = 0x1300;
+	int				n;
+	double			mean;
+	double			m2;
+};
 
-	unsigned char* bPtr = buf;
 
-	// write up into 59 byte packets
-	unsigned short addr(0);
-	for(int len(8192), inc(0); len > 0; addr += inc, bPtr += inc, len -= inc)
-	{
-		inc = len;
-		if(inc > 32) inc = 32;
+void runStats::add(double x)
+{
+	n++;
+
+	double delta = x - mean;
+	mean += delta / n;
+	m2 += delta * (x - mean);
+}
 
-		tBuf[1]	= (addr >> 8) & 0xff;
-		tBuf[2] = addr & 0xff;
-		tBuf[3] = (unsigned char)inc;
 
-		memcpy(tBuf + 4, bPtr, inc);
-	
-		i1d3Command(dev, cmd, tBuf, fBuf);
-	}
+// Sigma clipping against the readings accepted so far.  slack covers the +/-1 count quantization,
+// which would otherwise make a run of identical readings reject anything that differs by one count.
+bool runStats::outlier(double x, double slack)
+{
+	if(n < STATS_CLIP_MIN) return false;
 
-	return 0;
+	return fabs(x - mean) > STATS_CLIP_SIGMA * sqrt(variance()) + slack;
 }
 
 
-int i1d3ReadInternalEeprom(hidIdevice* dev,	unsigned char* buf)
+class measStats
 {
-	unsigned char tBuf[64];
-	unsigned char fBuf[64];
-	unsigned short cmd;
+	public:
+	double			stdErr[3];	// standard error of each channel in Hz
+	int				numUsed;
+	int				numRejected;
+	double			inttime;	// integration time of each reading
+};
+
+
+// Auto-ranging measurement.  A short probe reading estimates the count rate, and from it the integration
+// time needed for the target count precision is predicted and split over STATS_MIN_SAMPLES readings.
+// Readings then feed a running mean and variance per channel, outliers are sigma clipped, and the
+// measurement stops as soon as the standard error is within the target, so a patch only takes as many
+// readings as its noise level needs.  Returns the sensor frequencies in Hz.
+// With a known refresh rate every reading covers a whole number of refresh periods.
+int i1d3MeasureAuto(hidIdevice* dev, double rgb[3], double* totalTime, double refreshRate = 0.0,
+					double precision = MEAS_PRECISION, double maxTime = MEAS_MAX_TIME, measStats* ms = 0)
+{
+	double counts[3];
+	double elapsed(0.0);
+
+	double probeTime = snapToRefresh(MEAS_PROBE_TIME, refreshRate);
+	double inttime(probeTime);
+
+	if(i1d3Measure(dev, &inttime, counts) < 0) return -1;
+	elapsed += inttime;
+
+	double minCount = counts[0];
+	if(counts[1] < minCount) minCount = counts[1];
+	if(counts[2] < minCount) minCount = counts[2];
+
+	// time for the dimmest channel to reach the count target, with a little margin
+	double needed = maxTime;
+	if(minCount > 0.0) needed = 1.1 * inttime / (precision * minCount);
 
-	memset(tBuf, 0, 64);
-	memset(fBuf, 0, 64);
+	double readTime = needed / STATS_MIN_SAMPLES;
+	if(readTime > MEAS_MAX_CHUNK) readTime = MEAS_MAX_CHUNK;
+	if(readTime > (maxTime - elapsed) / STATS_MIN_SAMPLES) readTime = (maxTime - elapsed) / STATS_MIN_SAMPLES;
+	if(readTime < probeTime) readTime = probeTime;
+	readTime = snapToRefresh(readTime, refreshRate);
 
-	cmd = 0x0800;
+	runStats stats[3];
+	int numRejected(0);
 
-	unsigned char* bPtr = buf;
+	// a bright patch keeps the probe reading as its first sample
+	bool haveReading = (readTime <= probeTime);
 
-	// read up into 60 byte packets
-	unsigned short addr(0);
-	for(int len(256), inc(0); len > 0; addr += inc, bPtr += inc, len -= inc)
+	while(true)
 	{
-		inc = len;
-		if(inc > 60) inc = 60;
+		if(!haveReading)
+		{
+			inttime = readTime;
+			if(i1d3Measure(dev, &inttime, counts) < 0) return -1;
+			elapsed += inttime;
+		}
 
-		tBuf[1]	= addr;
-		tBuf[2] = (unsigned char)inc;
+		haveReading = false;
 
-		i1d3Command(dev, cmd, tBuf, fBuf);
-	
-		memcpy(bPtr, fBuf + 4, inc);
-	}
+		double rate[3];
+		bool reject(false);
 
-	return 0;
-}
+		for(int ch(0); ch < 3; ch++)
+		{
+			rate[ch] = counts[ch] / inttime;
+			if(stats[ch].outlier(rate[ch], 1.0 / inttime)) reject = true;
+		}
 
+		if(reject)
+		{
+			numRejected++;
+		}
+		else
+		{
+			for(int ch(0); ch < 3; ch++) stats[ch].add(rate[ch]);
+		}
 
-int i1d3WriteInternalEeprom(hidIdevice* dev,	unsigned char* buf)
-{
-	unsigned char tBuf[64];
-	unsigned char fBuf[64];
-	unsigned short cmd;
+		int numUsed = stats[0].n;
 
-	memset(tBuf, 0, 64);
-	memset(fBuf, 0, 64);
+		if(numUsed >= STATS_MIN_SAMPLES)
+		{
+			// the standard error target has a floor of one count over all the accepted readings
+			bool done(true);
+			for(int ch(0); ch < 3; ch++)
+			{
+				if(stats[ch].stdErr() > precision * stats[ch].mean + 1.0 / (numUsed * inttime)) done = false;
+			}
+
+			if(done) break;
+		}
 
-	cmd = 0x0700;
+		if(numUsed + numRejected >= STATS_MAX_SAMPLES || elapsed + readTime > maxTime) break;
+	}
 
-	unsigned char* bPtr = buf;
+	if(stats[0].n == 0) return -1;
 
-	// write up into 32 byte packets
-	unsigned short addr(0);
-	for(int len(256), inc(0); len > 0; addr += inc, bPtr += inc, len -= inc)
+	for(int ch(0); ch < 3; ch++)
 	{
-		inc = len;
-		if(inc > 32) inc = 32;
+		rgb[ch] = stats[ch].mean - dev->darkHz[ch];
+	}
 
-		tBuf[1]	= addr;
-		tBuf[2] = (unsigned char)inc;
-	
-		memcpy(tBuf + 3, bPtr, inc);
+	*totalTime = elapsed;
 
-		i1d3Command(dev, cmd, tBuf, fBuf);
+	if(ms)
+	{
+		for(int ch(0); ch < 3; ch++) ms->stdErr[ch] = stats[ch].stdErr();
+		ms->numUsed = stats[0].n;
+		ms->numRejected = numRejected;
+		ms->inttime = inttime;
 	}
 
 	return 0;
 }
 
-void i1d3CreateUnLockResponse(unsigned int k0, unsigned int k1, unsigned char* c, unsigned char* r)
-{
-//static void create_unlock_response(unsigned int *k, unsigned char *c, unsigned char *r) {
 
-	int i;
-	unsigned char sc[8], sr[16];	/* Sub-challeng and response */
+/* Columnar measurement log */
+#define LOG_CHUNK_ROWS		4096
+#define LOG_TIME_MAX		0x7fffffffffffffffLL
 
-	/* Only 8 bytes is used out of challenge buffer starting at */
-	/* offset 35. Bytes are decoded with xor of byte 3 value. */
-	for (i = 0; i < 8; i++)
-		sc[i] = c[3] ^ c[35 + i];
-	
-	/* Combine 8 byte key with 16 byte challenge to create core 16 byte response */
-	{
-		unsigned int ci[2];		/* challenge as 4 ints */
-		unsigned int co[4];		/* product, difference of 4 ints */
-		unsigned int sum;		/* Sum of all input bytes */
-		unsigned char s0, s1;	/* Byte components of sum. */
-
-		/* Shuffle bytes into 32 bit ints to be able to use 32 bit computation. */
-		ci[0] = (sc[3] << 24)
-              + (sc[0] << 16)
-              + (sc[4] << 8)
-              + (sc[6]);
-
-		ci[1] = (sc[1] << 24)
-              + (sc[7] << 16)
-              + (sc[2] << 8)
-              + (sc[5]);
-	
-		/* Computation on the ints */
-		co[0] = -k0 - ci[1];
-		co[1] = -k1 - ci[0];
-		co[2] = ci[1] * -k0;
-		co[3] = ci[0] * -k1;
-	
-		/* Sum of challenge bytes */
-		for (sum = 0, i = 0; i < 8; i++)
-			sum += sc[i];
-
-		/* Minus the two key values as bytes */
-		sum += (0xff & -k0) + (0xff & (-k0 >> 8))
-	        +  (0xff & (-k0 >> 16)) + (0xff & (-k0 >> 24));
-		sum += (0xff & -k1) + (0xff & (-k1 >> 8))
-	        +  (0xff & (-k1 >> 16)) + (0xff & (-k1 >> 24));
-	
-		/* Convert sum to bytes. Only need 2, because sum of 16 bytes can't exceed 16 bits. */
-		s0 =  sum       & 0xff;
-		s1 = (sum >> 8) & 0xff;
-	
-		/* Final computation of 16 bytes from 4 ints + sum bytes */
-		sr[0] =  ((co[0] >> 16) & 0xff) + s0;
-		sr[1] =  ((co[2] >>  8) & 0xff) - s1;
-		sr[2] =  ( co[3]        & 0xff) + s1;
-		sr[3] =  ((co[1] >> 16) & 0xff) + s0;
-		sr[4] =  ((co[2] >> 16) & 0xff) - s1;
-		sr[5] =  ((co[3] >> 16) & 0xff) - s0;
-		sr[6] =  ((co[1] >> 24) & 0xff) - s0;
-		sr[7] =  ( co[0]        & 0xff) - s1;
-		sr[8] =  ((co[3] >>  8) & 0xff) + s0;
-		sr[9] =  ((co[2] >> 24) & 0xff) - s1;
-		sr[10] = ((co[0] >>  8) & 0xff) + s0;
-		sr[11] = ((co[1] >>  8) & 0xff) - s1;
-		sr[12] = ( co[1]        & 0xff) + s1;
-		sr[13] = ((co[3] >> 24) & 0xff) + s1;
-		sr[14] = ( co[2]        & 0xff) + s0;
-		sr[15] = ((co[0] >> 24) & 0xff) - s0;
-	}
-
-	/* The OEM driver sets the resonse to random bytes, */
-	/* but we don't need to do this, since the device doesn't */
-	/* look at them. We could add random bytes if an instrument */
-	/* update were to reject zero bytes. */
-	for (i = 0; i < 64; i++)
-		r[i] = 0;
-
-	/* The actual resonse is 16 bytes at offset 24 in the response buffer. */
-	/* The OEM driver xor's challenge byte 2 with response bytes 4..63, but */
-	/* since the instrument doesn't look at them, we only do this to the actual */
-	/* response. */
-	for (i = 0; i < 16; i++)
-		r[24 + i] = c[2] ^ sr[i];
-}
-
-
- unsigned int i1d3UnLockKeys[][2] = {
-	{ 0xe9622e9f, 0x8d63e133 },
-	{ 0xe01e6e0a, 0x257462de },
-	{ 0xcaa62b2c, 0x30815b61 }, //oem
-	{ 0xa9119479, 0x5b168761 },
-	{ 0x160eb6ae, 0x14440e70 },
-	{ 0x291e41d7, 0x51937bdd },
-	{ 0x1abfae03, 0xf25ac8e8 },
-	{ 0xc9bfafe0, 0x02871166 }, //c6
-	{ 0x828c43e9, 0xcbb8a8ed }
+// The log is a file header followed by self contained chunks, each appended in one write when it
+// fills up (or the log is closed), so a crash can only lose the chunk being filled.  In each chunk the
+// columns are stored one after another: the time and patch columns delta encoded as zigzag varints,
+// then the fixed width serial, sensor Hz and XYZ columns.  The chunk header carries min/max of time
+// and patch, and the serial if every row has the same one, so a reader can skip whole chunks.
+struct logFileHeader
+{
+	char			magic[8];
+	unsigned int	version;
+	unsigned int	chunkRows;
 };
 
-int i1d3numUnLockKeys(9);
+struct logChunkHeader
+{
+	long long		minTime;	// wall clock, microseconds since 1970
+	long long		maxTime;
+	int				minPatch;
+	int				maxPatch;
+	unsigned int	numRows;
+	unsigned int	size;		// bytes of column data following the header
+	unsigned int	timeBytes;
+	unsigned int	patchBytes;
+	char			serNum[20];	// shared by every row, or empty if they differ
+	char			magic[4];
+};
 
 
-int i1d3UnLock(hidIdevice* dev)
+long long wallTimeUs()
 {
-	unsigned char tBuf[64];
-	unsigned char fBuf[64];
-	unsigned short cmd;
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
 
+	unsigned long long t = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
 
-	for(int cc(0); cc < i1d3numUnLockKeys; ++cc)
-	{
-		memset(tBuf, 0, 64);
-		memset(fBuf, 0, 64);
-
-		// Send the challenge
-		cmd = 0x9900;
-		i1d3Command(dev, cmd, tBuf, fBuf);
+	// 100ns ticks since 1601 to microseconds since 1970
+	return (long long)((t - 116444736000000000ULL) / 10);
+}
 
-		// Convert challenge to response
-		i1d3CreateUnLockResponse(i1d3UnLockKeys[cc][0], i1d3UnLockKeys[cc][1], fBuf, tBuf);
 
-		// Send the response
-		cmd = 0x9a00;
-		i1d3Command(dev, cmd, tBuf, fBuf);
+int putVarint(unsigned char* buf, long long val)
+{
+	unsigned long long zz = ((unsigned long long)val << 1) ^ (unsigned long long)(val >> 63);
+	int len(0);
 
-		if(fBuf[2] == 0x77)
-		{
-			/* Check success */
-			return cc;
-		}
+	while(zz >= 0x80)
+	{
+		buf[len++] = (unsigned char)(zz | 0x80);
+		zz >>= 7;
 	}
+	buf[len++] = (unsigned char)zz;
 
-	return -1;
+	return len;
 }
 
 
-int i1d3EnWrite(hidIdevice* dev)
+// Returns false if the varint would run past end or is longer than 64 bits
+bool getVarint(const unsigned char** pos, const unsigned char* end, long long* val)
 {
-	unsigned char tBuf[64];
-	unsigned char fBuf[64];
-	unsigned short cmd;
+	unsigned long long zz(0);
+	int shift(0);
 
+	while(true)
+	{
+		if(*pos >= end || shift > 63) return false;
 
-	memset(tBuf, 0, 64);
-	memset(fBuf, 0, 64);
-
-	// Send the challenge
-	cmd = 0xab00;
-
-	tBuf[1]	= 0xa3;
-	tBuf[2]	= 0x80;
-	tBuf[3]	= 0x25;
-	tBuf[4]	= 0x41;
+		unsigned char b = *(*pos)++;
+		zz |= (unsigned long long)(b & 0x7f) << shift;
+		if(!(b & 0x80)) break;
+		shift += 7;
+	}
 
-	i1d3Command(dev, cmd, tBuf, fBuf);
+	*val = (long long)(zz >> 1) ^ -(long long)(zz & 1);
 
-	return -1;
+	return true;
 }
 
-unsigned int calcCsum(unsigned char* buf, bool alt = false)
+
+// Reads the header of the chunk at pos and checks that its columns add up and fit in the file
+bool readChunkHeader(HANDLE fh, long long pos, long long fileSize, logChunkHeader* ch)
 {
-	unsigned int sum(0);
-	unsigned int sz(0x178e);  // rev2
-	if(alt) sz = 0x179a;	  // rev1
+	if(pos + (long long)sizeof(logChunkHeader) > fileSize) return false;
 
-	for(int i(4); i < sz; i++)
-	{
-		sum += buf[i];
-	}
-	sum &= 0xffff;
+	LARGE_INTEGER li;
+	li.QuadPart = pos;
+	DWORD num(0);
 
-	return sum;
-}
+	if(!SetFilePointerEx(fh, li, NULL, FILE_BEGIN) || !ReadFile(fh, ch, sizeof(logChunkHeader), &num, NULL) || num != sizeof(logChunkHeader)) return false;
 
+	if(memcmp(ch->magic, "CHNK", 4) != 0 || ch->numRows > LOG_CHUNK_ROWS) return false;
+	if(pos + (long long)sizeof(logChunkHeader) + ch->size > fileSize) return false;
 
-//extern char *optarg;
-//extern int optind, opterr, optopt;
+	return (long long)ch->timeBytes + ch->patchBytes + ch->numRows * (20 + 6 * sizeof(double)) == ch->size;
+}
 
-int main(int argc, char **argv)
+
+// Offset just past the last complete chunk.  Chunks are only ever appended, so the first bad one is the
+// partial chunk of a writer that crashed and nothing after it is valid.
+long long logValidEnd(HANDLE fh, long long fileSize)
 {
-	cout << "i1d3util ver 1.0" << endl;
+	long long pos = sizeof(logFileHeader);
+	logChunkHeader ch;
 
+	while(readChunkHeader(fh, pos, fileSize, &ch)) pos += sizeof(logChunkHeader) + ch.size;
 
-    char* fileName(0);
+	return pos;
+}
+
+
+class logWriter
+{
+	public:
+					logWriter():fh(INVALID_HANDLE_VALUE), numRows(0), times(0), patches(0), serNums(0), rgbs(0), xyzs(0) {};
+				   ~logWriter(){ close(); };
+
+	bool			open(const char* fileName);
+	void			close();
+	void			append(const char* serNum, int patch, double rgb[3], double xyz[3]);
+	bool			flush();
+
+	HANDLE			fh;
+	CRITICAL_SECTION lock;		// the multi-probe threads log concurrently
+	unsigned int	numRows;
+	long long*		times;
+	int*			patches;
+	char*			serNums;
+	double*			rgbs;
+	double*			xyzs;
+};
+
+
+logWriter* logOut(0);	// set when -o asks for readings to be logged
+
+
+// exit() is used on every error path, so the last partial chunk is written from an atexit handler
+void closeLog()
+{
+	if(logOut) delete logOut;
+	logOut = 0;
+}
+
+
+bool logWriter::open(const char* fileName)
+{
+	fh = CreateFile(fileName, GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, 0, NULL);
+	if(fh == INVALID_HANDLE_VALUE) return false;
+
+	logFileHeader hdr;
+	DWORD num(0);
+
+	if(GetFileSize(fh, NULL) == 0)
+	{
+		memset(&hdr, 0x00, sizeof(hdr));
+		memcpy(hdr.magic, "i1d3log1", 8);
+		hdr.version = 1;
+		hdr.chunkRows = LOG_CHUNK_ROWS;
+
+		if(!WriteFile(fh, &hdr, sizeof(hdr), &num, NULL) || num != sizeof(hdr))
+		{
+			CloseHandle(fh);
+			fh = INVALID_HANDLE_VALUE;
+			return false;
+		}
+	}
+	else if(!ReadFile(fh, &hdr, sizeof(hdr), &num, NULL) || num != sizeof(hdr) || memcmp(hdr.magic, "i1d3log1", 8) != 0)
+	{
+		CloseHandle(fh);
+		fh = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	// cut off a chunk left incomplete by a crash, or everything appended after it would be unreadable
+	LARGE_INTEGER size, end;
+	GetFileSizeEx(fh, &size);
+	end.QuadPart = logValidEnd(fh, size.QuadPart);
+
+	if(end.QuadPart < size.QuadPart)
+	{
+		cout << "Warning: dropping " << size.QuadPart - end.QuadPart << " bytes of an incomplete chunk at the end of " << fileName << endl;
+	}
+
+	if(!SetFilePointerEx(fh, end, NULL, FILE_BEGIN) || !SetEndOfFile(fh))
+	{
+		CloseHandle(fh);
+		fh = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	times = new long long[LOG_CHUNK_ROWS];
+	patches = new int[LOG_CHUNK_ROWS];
+	serNums = new char[LOG_CHUNK_ROWS * 20];
+	rgbs = new double[LOG_CHUNK_ROWS * 3];
+	xyzs = new double[LOG_CHUNK_ROWS * 3];
+
+	InitializeCriticalSection(&lock);
+
+	return true;
+}
+
+
+void logWriter::close()
+{
+	if(fh == INVALID_HANDLE_VALUE) return;
+
+	flush();
+	CloseHandle(fh);
+	fh = INVALID_HANDLE_VALUE;
+
+	DeleteCriticalSection(&lock);
+
+	delete[] times;
+	delete[] patches;
+	delete[] serNums;
+	delete[] rgbs;
+	delete[] xyzs;
+}
+
+
+void logWriter::append(const char* serNum, int patch, double rgb[3], double xyz[3])
+{
+	EnterCriticalSection(&lock);
+
+	times[numRows] = wallTimeUs();
+	patches[numRows] = patch;
+	memset(serNums + numRows * 20, 0x00, 20);
+	strncpy(serNums + numRows * 20, serNum, 20);
+	memcpy(rgbs + numRows * 3, rgb, 3 * sizeof(double));
+	memcpy(xyzs + numRows * 3, xyz, 3 * sizeof(double));
+
+	if(++numRows == LOG_CHUNK_ROWS) flush();
+
+	LeaveCriticalSection(&lock);
+}
+
+
+bool logWriter::flush()
+{
+	if(numRows == 0) return true;
+
+	// worst case 10 bytes per varint
+	unsigned int maxSize = numRows * (10 + 10 + 20 + 6 * sizeof(double));
+	unsigned char* buf = new unsigned char[sizeof(logChunkHeader) + maxSize];
+
+	logChunkHeader* ch = (logChunkHeader*)buf;
+	memset(ch, 0x00, sizeof(logChunkHeader));
+	memcpy(ch->magic, "CHNK", 4);
+	memcpy(ch->serNum, serNums, 20);
+
+	ch->numRows = numRows;
+	ch->minTime = ch->maxTime = times[0];
+	ch->minPatch = ch->maxPatch = patches[0];
+
+	unsigned char* bPtr = buf + sizeof(logChunkHeader);
+	long long prevTime(0);
+	int prevPatch(0);
+
+	for(unsigned int i(0); i < numRows; i++)
+	{
+		if(times[i] < ch->minTime) ch->minTime = times[i];
+		if(times[i] > ch->maxTime) ch->maxTime = times[i];
+		if(memcmp(ch->serNum, serNums + i * 20, 20) != 0) memset(ch->serNum, 0x00, 20);
+
+		bPtr += putVarint(bPtr, times[i] - prevTime);
+		prevTime = times[i];
+	}
+	ch->timeBytes = (unsigned int)(bPtr - buf - sizeof(logChunkHeader));
+
+	for(unsigned int i(0); i < numRows; i++)
+	{
+		if(patches[i] < ch->minPatch) ch->minPatch = patches[i];
+		if(patches[i] > ch->maxPatch) ch->maxPatch = patches[i];
+
+		bPtr += putVarint(bPtr, patches[i] - prevPatch);
+		prevPatch = patches[i];
+	}
+	ch->patchBytes = (unsigned int)(bPtr - buf - sizeof(logChunkHeader)) - ch->timeBytes;
+
+	memcpy(bPtr, serNums, numRows * 20);
+	bPtr += numRows * 20;
+	memcpy(bPtr, rgbs, numRows * 3 * sizeof(double));
+	bPtr += numRows * 3 * sizeof(double);
+	memcpy(bPtr, xyzs, numRows * 3 * sizeof(double));
+	bPtr += numRows * 3 * sizeof(double);
+
+	ch->size = (unsigned int)(bPtr - buf - sizeof(logChunkHeader));
+
+	DWORD len = (DWORD)(bPtr - buf);
+	DWORD noWritten(0);
+	bool ok = WriteFile(fh, buf, len, &noWritten, NULL) && noWritten == len;
+
+	delete[] buf;
+	numRows = 0;
+
+	return ok;
+}
+
+
+// Decodes the time and patch columns of a chunk, returns false if they do not decode to exactly their sizes
+bool decodeChunk(const logChunkHeader* ch, const unsigned char* data, long long* times, int* patches)
+{
+	const unsigned char* bPtr = data;
+	const unsigned char* end = data + ch->timeBytes;
+	long long prevTime(0), prevPatch(0), delta;
+
+	for(unsigned int i(0); i < ch->numRows; i++)
+	{
+		if(!getVarint(&bPtr, end, &delta)) return false;
+		times[i] = prevTime += delta;
+	}
+	if(bPtr != end) return false;
+
+	end += ch->patchBytes;
+
+	for(unsigned int i(0); i < ch->numRows; i++)
+	{
+		if(!getVarint(&bPtr, end, &delta)) return false;
+		patches[i] = (int)(prevPatch += delta);
+	}
+
+	return bPtr == end;
+}
+
+
+// Scan a log, printing the rows for one probe serial (or all of them) between fromTime and toTime (wall clock
+// microseconds).  Chunks are found from their headers alone, and only those whose serial and time range can
+// match are mapped, one at a time, so a log of any size is read without mapping the whole file.
+int scanLog(const char* logFile, const char* serFilter, long long fromTime, long long toTime)
+{
+	HANDLE fh = CreateFile(logFile, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if(fh == INVALID_HANDLE_VALUE)
+	{
+		cout << "Error: Failed to open file " << logFile << " for reading" << endl;
+		return 1;
+	}
+
+	// the size is taken once, so chunks appended by a writer while the scan runs are left for the next one
+	LARGE_INTEGER li;
+	logFileHeader hdr;
+	DWORD num(0);
+
+	if(!GetFileSizeEx(fh, &li) || !ReadFile(fh, &hdr, sizeof(hdr), &num, NULL) || num != sizeof(hdr) || memcmp(hdr.magic, "i1d3log1", 8) != 0)
+	{
+		CloseHandle(fh);
+		cout << "Error: " << logFile << " is not an i1d3util log" << endl;
+		return 1;
+	}
+
+	long long size = li.QuadPart;
+	HANDLE mh = CreateFileMapping(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(mh == NULL)
+	{
+		CloseHandle(fh);
+		cout << "Error: Failed to map " << logFile << endl;
+		return 1;
+	}
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	long long gran = si.dwAllocationGranularity;
+
+	char filter[20];
+	memset(filter, 0x00, 20);
+	if(serFilter) strncpy(filter, serFilter, 20);
+
+	double t0 = timeNow();
+	unsigned int numChunks(0), numSkipped(0), numMatched(0);
+	double sum[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+	long long* times = new long long[LOG_CHUNK_ROWS];
+	int* patches = new int[LOG_CHUNK_ROWS];
+
+	long long pos = sizeof(logFileHeader);
+	logChunkHeader ch;
+
+	while(readChunkHeader(fh, pos, size, &ch))
+	{
+		long long data = pos + sizeof(logChunkHeader);
+		pos = data + ch.size;
+		numChunks++;
+
+		if((serFilter && ch.serNum[0] && memcmp(ch.serNum, filter, 20) != 0) || ch.maxTime < fromTime || ch.minTime > toTime)
+		{
+			numSkipped++;
+			continue;
+		}
+
+		// views start on the allocation granularity
+		long long viewPos = data - data % gran;
+		SIZE_T viewLen = (SIZE_T)(pos - viewPos);
+		const unsigned char* view = (const unsigned char*)MapViewOfFile(mh, FILE_MAP_READ, (DWORD)(viewPos >> 32), (DWORD)(viewPos & 0xffffffff), viewLen);
+		if(!view)
+		{
+			cout << "Error: Failed to map the chunk at " << data - sizeof(logChunkHeader) << endl;
+			break;
+		}
+
+		const unsigned char* bPtr = view + (data - viewPos);
+
+		if(!decodeChunk(&ch, bPtr, times, patches))
+		{
+			UnmapViewOfFile(view);
+			cout << "Error: the chunk at " << data - sizeof(logChunkHeader) << " is corrupt" << endl;
+			break;
+		}
+
+		bPtr += ch.timeBytes + ch.patchBytes;
+
+		const char* serNums = (const char*)bPtr;
+		const unsigned char* rgbs = bPtr + ch.numRows * 20;
+		const unsigned char* xyzs = rgbs + ch.numRows * 3 * sizeof(double);
+
+		for(unsigned int i(0); i < ch.numRows; i++)
+		{
+			if(serFilter && memcmp(serNums + i * 20, filter, 20) != 0) continue;
+			if(times[i] < fromTime || times[i] > toTime) continue;
+
+			double vals[6];
+			memcpy(vals, rgbs + i * 3 * sizeof(double), 3 * sizeof(double));
+			memcpy(vals + 3, xyzs + i * 3 * sizeof(double), 3 * sizeof(double));
+
+			char serNum[21];
+			memcpy(serNum, serNums + i * 20, 20);
+			serNum[20] = 0;
+
+			char line[256];
+			sprintf(line, "%.6f %s %d %f %f %f %f %f %f", times[i] / 1e6, serNum, patches[i], vals[0], vals[1], vals[2], vals[3], vals[4], vals[5]);
+			cout << line << endl;
+
+			for(int k(0); k < 6; k++) sum[k] += vals[k];
+			numMatched++;
+		}
+
+		UnmapViewOfFile(view);
+	}
+
+	delete[] times;
+	delete[] patches;
+
+	CloseHandle(mh);
+	CloseHandle(fh);
+
+	cout << numMatched << " readings from " << numChunks << " chunks (" << numSkipped << " skipped) in " << timeNow() - t0 << " s" << endl;
+	if(numMatched)
+	{
+		cout << "mean RGB Hz " << sum[0] / numMatched << "  " << sum[1] / numMatched << "  " << sum[2] / numMatched
+			 << "  XYZ " << sum[3] / numMatched << "  " << sum[4] / numMatched << "  " << sum[5] / numMatched << endl;
+	}
+
+	return 0;
+}
+
+
+/* Live readings published in shared memory */
+#define LIVE_MAP_NAME		"Local\\i1d3util.live"
+#define LIVE_SLOTS			256
+
+// One reading.  seq is odd while the writer is filling the slot, readers retry until they see the
+// same even value before and after copying it out (a seqlock), so writers never wait for readers.
+// Every lap of the ring adds 2, so once sample n is in its slot seq is 2 * (n / LIVE_SLOTS + 1).
+struct liveSample
+{
+	volatile LONG	seq;
+	int				patch;		// patch index, -1 for a single measurement
+	double			time;		// monotonic, seconds
+	char			serNum[24];
+	double			rgb[3];		// sensor Hz
+	double			xyz[3];		// zero without a CCSS correction
+};
+
+struct liveRing
+{
+	char			magic[8];
+	volatile LONG	head;		// total number of samples ever claimed, the next slot is head % LIVE_SLOTS
+	volatile LONG	statusSeq;
+	char			status[64];
+	liveSample		slots[LIVE_SLOTS];
+};
+
+
+class livePublisher
+{
+	public:
+					livePublisher():mh(0), ring(0) {};
+				   ~livePublisher(){ close(); };
+
+	bool			open();
+	void			close();
+	void			publish(const char* serNum, int patch, double rgb[3], double xyz[3]);
+	void			setStatus(const char* status);
+
+	HANDLE			mh;
+	liveRing*		ring;
+};
+
+
+livePublisher* livePub(0);	// set when -l asks for readings to be published
+
+
+bool livePublisher::open()
+{
+	mh = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(liveRing), LIVE_MAP_NAME);
+	if(mh == NULL) return false;
+
+	if(GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		// someone else is already publishing
+		close();
+		return false;
+	}
+
+	ring = (liveRing*)MapViewOfFile(mh, FILE_MAP_WRITE, 0, 0, sizeof(liveRing));
+	if(ring == NULL)
+	{
+		close();
+		return false;
+	}
+
+	memset(ring, 0x00, sizeof(liveRing));
+	memcpy(ring->magic, "i1d3liv1", 8);
+
+	return true;
+}
+
+
+void livePublisher::close()
+{
+	if(ring) UnmapViewOfFile(ring);
+	if(mh) CloseHandle(mh);
+
+	ring = 0;
+	mh = 0;
+}
+
+
+// Safe to call from several measurement threads, each claims its own slot
+void livePublisher::publish(const char* serNum, int patch, double rgb[3], double xyz[3])
+{
+	LONG idx = InterlockedIncrement(&ring->head) - 1;
+	liveSample* slot = &ring->slots[idx % LIVE_SLOTS];
+
+	InterlockedIncrement(&slot->seq);
+
+	slot->patch = patch;
+	slot->time = timeNow();
+	memset(slot->serNum, 0x00, sizeof(slot->serNum));
+	strncpy(slot->serNum, serNum, sizeof(slot->serNum) - 1);
+	memcpy(slot->rgb, rgb, sizeof(slot->rgb));
+	memcpy(slot->xyz, xyz, sizeof(slot->xyz));
+
+	InterlockedIncrement(&slot->seq);
+}
+
+
+void livePublisher::setStatus(const char* status)
+{
+	InterlockedIncrement(&ring->statusSeq);
+
+	memset(ring->status, 0x00, sizeof(ring->status));
+	strncpy(ring->status, status, sizeof(ring->status) - 1);
+
+	InterlockedIncrement(&ring->statusSeq);
+}
+
+
+// Every finished reading goes through here to the live ring and the log, when they are enabled
+void recordReading(const char* serNum, int patch, double rgb[3], double xyz[3])
+{
+	if(livePub) livePub->publish(serNum, patch, rgb, xyz);
+	if(logOut) logOut->append(serNum, patch, rgb, xyz);
+}
+
+
+void publishStatus(const char* status)
+{
+	if(livePub) livePub->setStatus(status);
+}
+
+
+// Reader side, prints every reading as it is published.  Needs no device, so it can run alongside
+// the process that owns the probe.
+int tailLiveReadings()
+{
+	HANDLE mh = OpenFileMapping(FILE_MAP_READ, FALSE, LIVE_MAP_NAME);
+	if(mh == NULL)
+	{
+		cout << "Error: no i1d3util is publishing live readings" << endl;
+		return 1;
+	}
+
+	liveRing* ring = (liveRing*)MapViewOfFile(mh, FILE_MAP_READ, 0, 0, sizeof(liveRing));
+	if(ring == NULL || memcmp(ring->magic, "i1d3liv1", 8) != 0)
+	{
+		CloseHandle(mh);
+		cout << "Error: failed to map the live readings" << endl;
+		return 1;
+	}
+
+	LONG next = ring->head;
+	LONG lastStatus(-1);
+
+	while(true)
+	{
+		LONG sseq = ring->statusSeq;
+		if(sseq != lastStatus && !(sseq & 1))
+		{
+			char status[64];
+			memcpy(status, ring->status, 64);
+			MemoryBarrier();
+
+			if(ring->statusSeq == sseq)
+			{
+				status[63] = 0;
+				cout << "status: " << status << endl;
+				lastStatus = sseq;
+			}
+		}
+
+		LONG head = ring->head;
+
+		if(head - next > LIVE_SLOTS)
+		{
+			cout << "Warning: " << head - next - LIVE_SLOTS << " readings lost" << endl;
+			next = head - LIVE_SLOTS;
+		}
+
+		while(next < head)
+		{
+			liveSample* slot = &ring->slots[next % LIVE_SLOTS];
+			liveSample copy;
+
+			// head is claimed before the slot is marked, so the slot may still hold the previous lap
+			LONG want = 2 * (next / LIVE_SLOTS + 1);
+			LONG seq = slot->seq;
+			if(seq < want) break;		// not written yet or still being written, pick it up next time round
+
+			if(seq > want)
+			{
+				cout << "Warning: 1 reading lost" << endl;
+				next++;
+				continue;
+			}
+
+			memcpy(&copy, slot, sizeof(liveSample));
+			MemoryBarrier();
+
+			if(slot->seq != seq) continue;
+
+			copy.serNum[23] = 0;
+			cout << copy.time << "  " << copy.serNum << "  " << copy.patch
+				 << "  RGB Hz " << copy.rgb[0] << "  " << copy.rgb[1] << "  " << copy.rgb[2]
+				 << "  XYZ " << copy.xyz[0] << "  " << copy.xyz[1] << "  " << copy.xyz[2] << endl;
+
+			next++;
+		}
+
+		Sleep(10);
+	}
+
+	return 0;
+}
+
+
+/* Dark offset */
+#define DARK_CACHE_FILE		"i1d3util.dark"
+#define DARK_TMP_FILE		DARK_CACHE_FILE ".tmp"	// must be next to it for MoveFileEx to replace it
+#define DARK_MAX			1024
+#define DARK_VALID_TIME		(8 * 3600)	// seconds a calibration is trusted without a check passing
+#define DARK_CAL_INTTIME	2.0			// full calibration, DARK_CAL_READINGS readings of this long
+#define DARK_CAL_READINGS	5
+#define DARK_CHECK_TIME		1.0			// quick check against the cached offset
+#define DARK_CHECK_SIGMA	4.0
+#define DARK_MAX_HZ			50.0		// more than this and the probe is not capped
+
+
+// One line per probe, tab separated
+struct darkRecord
+{
+	char			serNum[21];
+	long long		when;		// seconds since 1970 of the calibration or the last check it passed
+	double			hz[3];
+	double			inttime;	// total integration the offset was averaged over
+};
+
+
+int loadDarkCache(darkRecord* recs)
+{
+	FILE* fp = fopen(DARK_CACHE_FILE, "r");
+	if(!fp) return 0;
+
+	char line[256];
+	int numRecs(0);
+
+	while(numRecs < DARK_MAX && fgets(line, sizeof(line), fp))
+	{
+		if(line[0] == '#') continue;
+
+		darkRecord* rec = &recs[numRecs];
+		memset(rec, 0x00, sizeof(darkRecord));
+
+		if(sscanf(line, "%20[^\t]\t%lld\t%lf\t%lf\t%lf\t%lf", rec->serNum, &rec->when, &rec->hz[0], &rec->hz[1], &rec->hz[2], &rec->inttime) == 6) numRecs++;
+	}
+
+	fclose(fp);
+
+	return numRecs;
+}
+
+
+bool saveDarkCache(darkRecord* recs, int numRecs)
+{
+	FILE* fp = fopen(DARK_TMP_FILE, "w");
+	if(!fp) return false;
+
+	fprintf(fp, "# serial\twhen\tdark Hz R\tG\tB\tintegration s\n");
+
+	for(int i(0); i < numRecs; i++)
+	{
+		darkRecord* rec = &recs[i];
+		fprintf(fp, "%s\t%lld\t%.6f\t%.6f\t%.6f\t%.1f\n", rec->serNum, rec->when, rec->hz[0], rec->hz[1], rec->hz[2], rec->inttime);
+	}
+
+	fclose(fp);
+
+	return MoveFileEx(DARK_TMP_FILE, DARK_CACHE_FILE, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+
+darkRecord* findDark(darkRecord* recs, int numRecs, const char* serNum)
+{
+	for(int i(0); i < numRecs; i++)
+	{
+		if(strcmp(recs[i].serNum, serNum) == 0) return &recs[i];
+	}
+
+	return 0;
+}
+
+
+// Sets the device's dark offset from the cache, so a measurement session pays nothing for it.  An expired offset
+// is still applied, as dropping it would change the probe's readings and no longer match a matrix fitted with it
+// (-g), and the caller warns instead.  Returns 1 if an offset was loaded, 0 if there is none, -1 if it has expired.
+int i1d3LoadDark(hidIdevice* dev, const char* serNum)
+{
+	darkRecord* recs = new darkRecord[DARK_MAX];
+	int numRecs = loadDarkCache(recs);
+
+	darkRecord* rec = findDark(recs, numRecs, serNum);
+	int res(0);
+
+	if(rec)
+	{
+		memcpy(dev->darkHz, rec->hz, sizeof(rec->hz));
+		res = (wallTimeUs() / 1000000 - rec->when > DARK_VALID_TIME) ? -1 : 1;
+	}
+
+	delete[] recs;
+
+	return res;
+}
+
+
+// Counts from one dark reading are Poisson, so the check allows DARK_CHECK_SIGMA standard deviations of the count
+// the cached offset predicts, plus one count of quantization
+bool darkConsistent(double cachedHz[3], double counts[3], double inttime)
+{
+	for(int ch(0); ch < 3; ch++)
+	{
+		double expect = cachedHz[ch] * inttime;
+		if(fabs(counts[ch] - expect) > DARK_CHECK_SIGMA * sqrt(expect + 1.0) + 1.0) return false;
+	}
+
+	return true;
+}
+
+
+// Session start for a capped probe.  A cached offset that is inside its validity window and agrees with one
+// short reading is kept, and its window restarted.  Otherwise, or when the check finds the dark level has moved,
+// as it does with the sensor's temperature, the full calibration of several long readings is run and cached.
+// The i1d3 has no temperature sensor of its own, so the dark level itself is what is watched.
+int darkCalibrate(hidIdevice* dev, bool force)
+{
+	if(i1d3UnLock(dev) < 0)
+	{
+		cout << "Error: Failed to unlock the i1d3" << endl;
+		return 1;
+	}
+
+	char serNum[21];
+	i1d3ReadSerial(dev, serNum);
+
+	darkRecord* recs = new darkRecord[DARK_MAX];
+	int numRecs = loadDarkCache(recs);
+	darkRecord* rec = findDark(recs, numRecs, serNum);
+
+	long long now = wallTimeUs() / 1000000;
+	bool full(true);
+
+	if(rec && !force && now - rec->when <= DARK_VALID_TIME)
+	{
+		double inttime(DARK_CHECK_TIME);
+		double counts[3];
+
+		if(i1d3Measure(dev, &inttime, counts) < 0)
+		{
+			cout << "Error: Measurement failed" << endl;
+			delete[] recs;
+			return 1;
+		}
+
+		if(counts[0] > DARK_MAX_HZ * inttime || counts[1] > DARK_MAX_HZ * inttime || counts[2] > DARK_MAX_HZ * inttime)
+		{
+			cout << "Error: the probe is not dark, cap it and try again" << endl;
+			delete[] recs;
+			return 1;
+		}
+
+		if(darkConsistent(rec->hz, counts, inttime))
+		{
+			full = false;
+			cout << "Dark offset for " << serNum << " still valid, " << rec->hz[0] << "  " << rec->hz[1] << "  " << rec->hz[2] << " Hz" << endl;
+		}
+		else cout << "Dark level of " << serNum << " has moved, recalibrating" << endl;
+	}
+	else if(rec && !force) cout << "Dark offset for " << serNum << " has expired, recalibrating" << endl;
+
+	if(full)
+	{
+		double sum[3] = { 0.0, 0.0, 0.0 };
+		double total(0.0);
+
+		for(int i(0); i < DARK_CAL_READINGS; i++)
+		{
+			double inttime(DARK_CAL_INTTIME);
+			double counts[3];
+
+			if(i1d3Measure(dev, &inttime, counts) < 0)
+			{
+				cout << "Error: Measurement failed" << endl;
+				delete[] recs;
+				return 1;
+			}
+
+			for(int ch(0); ch < 3; ch++) sum[ch] += counts[ch];
+			total += inttime;
+		}
+
+		if(sum[0] > DARK_MAX_HZ * total || sum[1] > DARK_MAX_HZ * total || sum[2] > DARK_MAX_HZ * total)
+		{
+			cout << "Error: the probe is not dark, cap it and try again" << endl;
+			delete[] recs;
+			return 1;
+		}
+
+		if(!rec)
+		{
+			if(numRecs == DARK_MAX)
+			{
+				cout << "Error: the dark offset cache is full" << endl;
+				delete[] recs;
+				return 1;
+			}
+
+			rec = &recs[numRecs++];
+			memset(rec, 0x00, sizeof(darkRecord));
+			strcpy(rec->serNum, serNum);
+		}
+
+		for(int ch(0); ch < 3; ch++) rec->hz[ch] = sum[ch] / total;
+		rec->inttime = total;
+
+		cout << "Dark offset for " << serNum << " " << rec->hz[0] << "  " << rec->hz[1] << "  " << rec->hz[2] << " Hz" << endl;
+	}
+
+	rec->when = now;
+
+	int res(0);
+	if(!saveDarkCache(recs, numRecs))
+	{
+		cout << "Error: Failed to write " << DARK_CACHE_FILE << endl;
+		res = 1;
+	}
+
+	delete[] recs;
+
+	return res;
+}
+
+
+/* Synchronised multi-probe measurement */
+class probeJob
+{
+	public:
+					probeJob():dev(0), ready(0), go(0), corrFile(0), corrLock(0), unlocked(false), refreshRate(0.0),
+							   corrType(-1), haveXYZ(false), dark(0), start(0.0), end(0.0), inttime(0.0), result(-1) { memset(serNum, 0, 21); };
+
+	hidIdevice*		dev;
+	HANDLE			ready;		// set by the worker once it is unlocked and set up
+	HANDLE			go;			// manual reset event shared by all workers, the barrier start
+	const char*		corrFile;
+	CRITICAL_SECTION* corrLock;	// the correction cache is one file shared by all probes
+	bool			unlocked;
+
+	char			serNum[21];
+	double			refreshRate;
+	int				corrType;	// i1d3LoadCorrection's result
+	bool			haveXYZ;
+	double			mat[3][3];
+	int				dark;		// i1d3LoadDark's result
+
+	double			start;		// monotonic timestamps of the measurement
+	double			end;
+	double			rgb[3];
+	double			inttime;
+	int				result;
+};
+
+
+DWORD WINAPI probeJobThread(LPVOID param)
+{
+	probeJob* job = (probeJob*)param;
+
+	if(!job->unlocked)
+	{
+		SetEvent(job->ready);
+		return 0;
+	}
+
+	if(job->corrFile)
+	{
+		bool cached(false);
+
+		EnterCriticalSection(job->corrLock);
+		job->corrType = i1d3LoadCorrection(job->dev, job->serNum, job->corrFile, job->mat, &cached);
+		job->haveXYZ = (job->corrType == CORR_CCSS || (job->corrType == CORR_CCMX && i1d3ApplyCCMX(job->serNum, job->mat)));
+		LeaveCriticalSection(job->corrLock);
+	}
+	else
+	{
+		EnterCriticalSection(job->corrLock);
+		job->haveXYZ = i1d3LoadFit(job->serNum, job->mat);
+		LeaveCriticalSection(job->corrLock);
+	}
+
+	job->dark = i1d3LoadDark(job->dev, job->serNum);
+
+	SetEvent(job->ready);
+	WaitForSingleObject(job->go, INFINITE);
+
+	job->start = timeNow();
+	job->result = i1d3MeasureAuto(job->dev, job->rgb, &job->inttime, job->refreshRate);
+	job->end = timeNow();
+
+	if(job->result == 0)
+	{
+		double xyz[3] = { 0.0, 0.0, 0.0 };
+		if(job->haveXYZ) applyMatrix(job->mat, job->rgb, xyz);
+
+		recordReading(job->serNum, -1, job->rgb, xyz);
+	}
+
+	return 0;
+}
+
+
+// Measure on every attached probe at once.  The setup that is the same for every probe runs multiplexed
+// on this thread, then each probe gets an I/O thread for its corrections and measurement.
+int measureAllProbes(const char* corrFile, bool refresh)
+{
+	hidIdevice* devs[MAX_PROBES];
+
+	int numDevs = findHIDdevices(devs, MAX_PROBES);
+	if(numDevs <= 0)
+	{
+		cout << "Error: failed to find USB HID device" << endl;
+		return 1;
+	}
+
+	for(int i(0); i < numDevs; i++)
+	{
+		devs[i]->traceProbe = i;
+
+		if(!openHIDdevice(devs[i]))
+		{
+			cout << "Error: failed to open USB HID device " << devs[i]->dpath << endl;
+			closeHIDdevices(devs, i, numDevs);
+			return 1;
+		}
+	}
+
+	CRITICAL_SECTION corrLock;
+	InitializeCriticalSection(&corrLock);
+
+	HANDLE go = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	probeJob* jobs = new probeJob[numDevs];
+	HANDLE readies[MAX_PROBES];
+	HANDLE threads[MAX_PROBES];
+
+	// Unlock, read the serial number and capture the refresh detection burst of every probe together
+	probeMux mux;
+	seqOp* setups[MAX_PROBES];
+	unlockOp* unlocks[MAX_PROBES];
+	measureBurstOp* bursts[MAX_PROBES];
+
+	for(int i(0); i < numDevs; i++)
+	{
+		setups[i] = new seqOp;
+		setups[i]->add(unlocks[i] = new unlockOp);
+		setups[i]->add(new eepromReadOp(false, 16, 20, (unsigned char*)jobs[i].serNum, devs[i]->caps));
+		bursts[i] = 0;
+		if(refresh) setups[i]->add(bursts[i] = new measureBurstOp(REFRESH_SAMPLES, REFRESH_INTTIME));
+
+		mux.add(devs[i], setups[i]);
+	}
+
+	mux.run();
+
+	for(int i(0); i < numDevs; i++)
+	{
+		jobs[i].unlocked = (unlocks[i]->result == OP_DONE);
+
+		if(bursts[i] && bursts[i]->result == OP_DONE)
+		{
+			double confidence(0.0);
+			double* vals = new double[REFRESH_SAMPLES];
+			for(int n(0); n < REFRESH_SAMPLES; n++) vals[n] = bursts[i]->vals[n * 3] + bursts[i]->vals[n * 3 + 1] + bursts[i]->vals[n * 3 + 2];
+
+			refreshFromSamples(bursts[i]->times, vals, REFRESH_SAMPLES, bursts[i]->slack / REFRESH_SAMPLES, &jobs[i].refreshRate, &confidence);
+			delete[] vals;
+		}
+
+		delete setups[i];
+	}
+
+	for(int i(0); i < numDevs; i++)
+	{
+		jobs[i].dev = devs[i];
+		jobs[i].ready = readies[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+		jobs[i].go = go;
+		jobs[i].corrFile = corrFile;
+		jobs[i].corrLock = &corrLock;
+
+		threads[i] = CreateThread(NULL, 0, probeJobThread, &jobs[i], 0, NULL);
+	}
+
+	// Corrections are loaded up front so the measurements themselves start together
+	WaitForMultipleObjects(numDevs, readies, TRUE, INFINITE);
+
+	publishStatus("measuring");
+
+	double t0 = timeNow();
+	SetEvent(go);
+
+	WaitForMultipleObjects(numDevs, threads, TRUE, INFINITE);
+
+	double t1 = timeNow();
+
+	publishStatus("idle");
+
+	int res(0);
+
+	for(int i(0); i < numDevs; i++)
+	{
+		probeJob* job = &jobs[i];
+
+		if(job->result < 0)
+		{
+			cout << i << "  " << (job->serNum[0] ? job->serNum : devs[i]->dpath) << "  Error: Measurement failed" << endl;
+			res = 1;
+		}
+		else
+		{
+			cout << i << "  " << job->serNum << "  t=" << (job->start - t0) * 1000.0 << "ms" 
+				 << "  RGB Hz " << job->rgb[0] << "  " << job->rgb[1] << "  " << job->rgb[2] << "  (" << job->inttime << " s)";
+
+			if(job->haveXYZ)
+			{
+				double xyz[3];
+				applyMatrix(job->mat, job->rgb, xyz);
+				cout << "  XYZ " << xyz[0] << "  " << xyz[1] << "  " << xyz[2];
+			}
+
+			if(job->corrFile && job->corrType < 0) cout << "  (display correction not loaded)";
+			else if(job->corrType == CORR_CCMX && !job->haveXYZ) cout << "  (CCMX needs a -g fit)";
+			if(job->dark < 0) cout << "  (dark offset expired, run -K)";
+
+			cout << endl;
+		}
+
+		CloseHandle(threads[i]);
+		CloseHandle(readies[i]);
+		closeHIDdevice(devs[i]);
+		delete devs[i];
+	}
+
+	cout << numDevs << " probes measured in " << t1 - t0 << " s" << endl;
+
+	delete[] jobs;
+	CloseHandle(go);
+	DeleteCriticalSection(&corrLock);
+
+	return res;
+}
+
+
+/* Probe inventory */
+#define REGISTRY_MAX		1024
+
+// One line per probe ever seen, tab separated, with the firmware string last as it may contain spaces
+struct probeRecord
+{
+	char			serNum[21];
+	int				key;		// index of the key that unlocks it, see i1d3KeyNames
+	int				revision;	// layout the eeprom checksum matches, 2 or 1, 0 if neither
+	unsigned int	storedCsum;	// bytes 2 and 3 of the external eeprom
+	long long		lastSeen;	// seconds since 1970
+	char			firmware[64];
+};
+
+
+int loadRegistry(const char* regFile, probeRecord* recs)
+{
+	FILE* fp = fopen(regFile, "r");
+	if(!fp) return 0;
+
+	char line[256];
+	int numRecs(0);
+
+	while(numRecs < REGISTRY_MAX && fgets(line, sizeof(line), fp))
+	{
+		if(line[0] == '#') continue;
+
+		probeRecord* rec = &recs[numRecs];
+		memset(rec, 0x00, sizeof(probeRecord));
+
+		if(sscanf(line, "%20[^\t]\t%d\t%d\t%x\t%lld\t%63[^\r\n]", rec->serNum, &rec->key, &rec->revision, &rec->storedCsum, &rec->lastSeen, rec->firmware) >= 5) numRecs++;
+	}
+
+	fclose(fp);
+
+	return numRecs;
+}
+
+
+bool saveRegistry(const char* regFile, probeRecord* recs, int numRecs)
+{
+	// next to the registry, MoveFileEx cannot replace a file on another volume
+	char* tmpFile = new char[strlen(regFile) + 5];
+	strcpy(tmpFile, regFile);
+	strcat(tmpFile, ".tmp");
+
+	FILE* fp = fopen(tmpFile, "w");
+	if(!fp)
+	{
+		delete[] tmpFile;
+		return false;
+	}
+
+	fprintf(fp, "# serial\tkey\trevision\tchecksum\tlast seen\tfirmware\n");
+
+	for(int i(0); i < numRecs; i++)
+	{
+		probeRecord* rec = &recs[i];
+		fprintf(fp, "%s\t%d\t%d\t%04x\t%lld\t%s\n", rec->serNum, rec->key, rec->revision, rec->storedCsum, rec->lastSeen, rec->firmware);
+	}
+
+	fclose(fp);
+
+	// the old registry stays intact until the new one is complete
+	bool res = MoveFileEx(tmpFile, regFile, MOVEFILE_REPLACE_EXISTING) != 0;
+
+	delete[] tmpFile;
+
+	return res;
+}
+
+
+// Inventories every attached probe into the registry, all probes at once on one thread.  A probe whose serial,
+// firmware and stored checksum match its record keeps its recorded checksum status, otherwise the whole external
+// eeprom is read to check it.
+int inventoryProbes(const char* regFile)
+{
+	probeRecord* recs = new probeRecord[REGISTRY_MAX];
+	int numRecs = loadRegistry(regFile, recs);
+
+	hidIdevice* devs[MAX_PROBES];
+	int numDevs = findHIDdevices(devs, MAX_PROBES);
+	if(numDevs <= 0)
+	{
+		cout << "Error: failed to find USB HID device" << endl;
+		delete[] recs;
+		return 1;
+	}
+
+	for(int i(0); i < numDevs; i++)
+	{
+		devs[i]->traceProbe = i;
+
+		if(!openHIDdevice(devs[i]))
+		{
+			cout << "Error: failed to open USB HID device " << devs[i]->dpath << endl;
+			closeHIDdevices(devs, i, numDevs);
+			delete[] recs;
+			return 1;
+		}
+	}
+
+	double t0 = timeNow();
+
+	// the cheap part for every probe: firmware, unlock, serial number and the stored checksum
+	probeMux mux;
+	seqOp* setups[MAX_PROBES];
+	infoOp* infos[MAX_PROBES];
+	unlockOp* unlocks[MAX_PROBES];
+	char serNums[MAX_PROBES][21];
+	unsigned char heads[MAX_PROBES][4];
+
+	for(int i(0); i < numDevs; i++)
+	{
+		memset(serNums[i], 0x00, 21);
+
+		setups[i] = new seqOp;
+		setups[i]->add(infos[i] = new infoOp);
+		setups[i]->add(unlocks[i] = new unlockOp);
+		setups[i]->add(new eepromReadOp(false, 16, 20, (unsigned char*)serNums[i], devs[i]->caps));
+		setups[i]->add(new eepromReadOp(true, 0, 4, heads[i], devs[i]->caps));
+
+		mux.add(devs[i], setups[i]);
+	}
+
+	mux.run();
+
+	// then the whole eeprom of the probes that are new or have changed
+	probeMux fullMux;
+	eepromReadOp* fulls[MAX_PROBES];
+	unsigned char* eBufs[MAX_PROBES];
+	probeRecord* found[MAX_PROBES];
+
+	for(int i(0); i < numDevs; i++)
+	{
+		fulls[i] = 0;
+		eBufs[i] = 0;
+		found[i] = 0;
+
+		if(setups[i]->result != OP_DONE) continue;
+
+		unsigned int storedCsum = heads[i][2] | (heads[i][3] << 8);
+
+		for(int r(0); r < numRecs; r++)
+		{
+			if(strcmp(recs[r].serNum, serNums[i]) == 0) found[i] = &recs[r];
+		}
+
+		if(found[i] && found[i]->storedCsum == storedCsum && strcmp(found[i]->firmware, infos[i]->info) == 0) continue;
+
+		eBufs[i] = new unsigned char[8192];
+		fulls[i] = new eepromReadOp(true, 0, 8192, eBufs[i], devs[i]->caps);
+		fullMux.add(devs[i], fulls[i]);
+	}
+
+	fullMux.run();
+
+	long long now = wallTimeUs() / 1000000;
+	int res(0);
+
+	for(int i(0); i < numDevs; i++)
+	{
+		if(setups[i]->result != OP_DONE || (fulls[i] && fulls[i]->result != OP_DONE))
+		{
+			cout << i << "  " << (serNums[i][0] ? serNums[i] : devs[i]->dpath) << "  Error: Failed to read the probe" << endl;
+			res = 1;
+		}
+		else
+		{
+			probeRecord* rec = found[i];
+			if(!rec && numRecs < REGISTRY_MAX)
+			{
+				rec = &recs[numRecs++];
+				memset(rec, 0x00, sizeof(probeRecord));
+				strcpy(rec->serNum, serNums[i]);
+			}
+
+			if(rec)
+			{
+				rec->key = unlocks[i]->key;
+				rec->lastSeen = now;
+				strcpy(rec->firmware, infos[i]->info);
+
+				if(eBufs[i])
+				{
+					rec->storedCsum = heads[i][2] | (heads[i][3] << 8);
+					if(calcCsum(eBufs[i]) == rec->storedCsum) rec->revision = 2;
+					else if(calcCsum(eBufs[i], true) == rec->storedCsum) rec->revision = 1;
+					else rec->revision = 0;
+				}
+
+				cout << i << "  " << rec->serNum << "  " << i1d3KeyNames[rec->key] << "  " << rec->firmware
+					 << "  checksum " << (rec->revision ? "ok" : "BAD") << (rec->revision ? (rec->revision == 2 ? " (rev2)" : " (rev1)") : "")
+					 << (eBufs[i] ? "" : "  unchanged") << endl;
+
+				if(rec->revision == 0) res = 1;
+			}
+		}
+
+		if(fulls[i]) delete fulls[i];
+		if(eBufs[i]) delete[] eBufs[i];
+		delete setups[i];
+		closeHIDdevice(devs[i]);
+		delete devs[i];
+	}
+
+	cout << numDevs << " probes inventoried in " << timeNow() - t0 << " s" << endl;
+
+	if(!saveRegistry(regFile, recs, numRecs))
+	{
+		cout << "Error: Failed to write registry " << regFile << endl;
+		res = 1;
+	}
+
+	delete[] recs;
+
+	return res;
+}
+
+
+/* Batch flashing */
+#define FLASH_EXTERNAL		1		// -E
+#define FLASH_INTERNAL		2		// -I
+#define FLASH_SIGNATURE		3		// -S
+
+#define FLASH_REPORT_TIME	2.0		// seconds between progress lines
+
+class flashJob
+{
+	public:
+					flashJob():cur(0), image(0), check(0), setup(0), unlock(0), write(0), update(0), failed(false) { memset(serNum, 0x00, 21); };
+				   ~flashJob() { if(cur) delete[] cur; if(image) delete[] image; if(check) delete[] check; if(setup) delete setup; if(write) delete write; };
+
+	char			serNum[21];
+	unsigned char*	cur;		// the eeprom as it was
+	unsigned char*	image;		// as it should be
+	unsigned char*	check;		// read back after writing
+	seqOp*			setup;
+	unlockOp*		unlock;
+	seqOp*			write;
+	eepromUpdateOp*	update;
+	bool			failed;
+};
+
+
+// Builds the image for one probe from its current eeprom, returns false with the reason printed if it can't
+bool flashPrepare(int mode, const char* fileName, unsigned char* sig, flashJob* job, int index)
+{
+	unsigned int size = (mode == FLASH_INTERNAL) ? 256 : 8192;
+
+	if(mode == FLASH_SIGNATURE)
+	{
+		memcpy(job->image, job->cur, size);
+
+		unsigned int fsum = job->image[2] | (job->image[3] << 8);
+		if(calcCsum(job->image) != fsum)
+		{
+			cout << index << "  " << job->serNum << "  Error: Checksum of the external eeprom failed.  This may mean it is not Rev2 hardware" << endl;
+			return false;
+		}
+
+		memcpy(&job->image[0x1638], sig, 0x48);
+
+		unsigned int csum = calcCsum(job->image);
+		job->image[2] = (unsigned char)(csum >> 0) & 0xff;
+		job->image[3] = (unsigned char)(csum >> 8) & 0xff;
+
+		return true;
+	}
+
+	// each probe has its own calibration, so its image comes from its own file, the %s replaced by its serial
+	const char* mark = strstr(fileName, "%s");
+	char* path = new char[strlen(fileName) + 21];
+	memcpy(path, fileName, mark - fileName);
+	strcpy(path + (mark - fileName), job->serNum);
+	strcat(path, mark + 2);
+
+	unsigned int fsize(0);
+	unsigned char* buf = readWholeFile(path, &fsize);
+	if(!buf || fsize != size)
+	{
+		cout << index << "  " << job->serNum << "  Error: Failed to read " << size << " bytes from " << path << endl;
+		if(buf) delete[] buf;
+		delete[] path;
+		return false;
+	}
+
+	memcpy(job->image, buf, size);
+	delete[] buf;
+	delete[] path;
+
+	return true;
+}
+
+
+// Writes -E, -I or -S to every attached probe at once from one thread.  Every probe is read first, and only the
+// write packets that differ from what is already there are sent, which for a signature is a handful of packets
+// rather than the whole eeprom.  The writes share a muxBudget, so as many transactions are in flight as the host
+// controller carries without queueing, and timeouts back off all probes alike.  Each probe is read back to
+// verify it and reset afterwards.  For -E and -I fileName must contain %s, which is replaced by each probe's serial.
+int flashAllProbes(int mode, const char* fileName, bool enableWrite)
+{
+	bool ext = (mode != FLASH_INTERNAL);
+	unsigned int size = ext ? 8192 : 256;
+	unsigned char sig[0x48];
+
+	if(mode == FLASH_SIGNATURE)
+	{
+		unsigned int fsize(0);
+		unsigned char* buf = readWholeFile(fileName, &fsize);
+		if(!buf || fsize != 0x48)
+		{
+			cout << "Error: Failed to read file " << fileName << endl;
+			if(buf) delete[] buf;
+			return 1;
+		}
+
+		memcpy(sig, buf, 0x48);
+		delete[] buf;
+	}
+	else if(!strstr(fileName, "%s"))
+	{
+		cout << "Error: with -a the file name needs a %s for each probe's serial number, e.g. eeprom_%s.bin" << endl;
+		return 1;
+	}
+
+	hidIdevice* devs[MAX_PROBES];
+	int numDevs = findHIDdevices(devs, MAX_PROBES);
+	if(numDevs <= 0)
+	{
+		cout << "Error: failed to find USB HID device" << endl;
+		return 1;
+	}
+
+	for(int i(0); i < numDevs; i++)
+	{
+		devs[i]->traceProbe = i;
+
+		if(!openHIDdevice(devs[i]))
+		{
+			cout << "Error: failed to open USB HID device " << devs[i]->dpath << endl;
+			closeHIDdevices(devs, i, numDevs);
+			return 1;
+		}
+	}
+
+	double t0 = timeNow();
+	flashJob* jobs = new flashJob[numDevs];
+	muxBudget budget(numDevs);
+
+	// unlock, enable writes and read what is there now
+	probeMux readMux;
+	readMux.setBudget(&budget);
+
+	unsigned char enw[64];
+	i1d3MakeEnWrite(enw);
+
+	for(int i(0); i < numDevs; i++)
+	{
+		flashJob* job = &jobs[i];
+		job->cur = new unsigned char[size];
+		job->image = new unsigned char[size];
+		job->check = new unsigned char[size];
+
+		job->setup = new seqOp;
+		job->setup->add(job->unlock = new unlockOp);
+		job->setup->add(new commandOp(0xab00, enw));
+		job->setup->add(new eepromReadOp(false, 16, 20, (unsigned char*)job->serNum, devs[i]->caps));
+		job->setup->add(new eepromReadOp(ext, 0, size, job->cur, devs[i]->caps));
+
+		readMux.add(devs[i], job->setup);
+	}
+
+	readMux.run();
+
+	probeMux writeMux;
+	writeMux.setBudget(&budget);
+
+	int numWrites(0);
+	int numPackets(0);
+
+	for(int i(0); i < numDevs; i++)
+	{
+		flashJob* job = &jobs[i];
+
+		if(job->setup->result != OP_DONE)
+		{
+			cout << i << "  " << (job->serNum[0] ? job->serNum : devs[i]->dpath)
+				 << (job->unlock->result == OP_DONE ? "  Error: Failed to read the probe" : "  Error: Failed to unlock the i1d3") << endl;
+			job->failed = true;
+			continue;
+		}
+
+		if(!flashPrepare(mode, fileName, sig, job, i))
+		{
+			job->failed = true;
+			continue;
+		}
+
+		job->update = new eepromUpdateOp(ext, job->cur, job->image, size, devs[i]->caps);
+		if(job->update->numPackets == 0)
+		{
+			cout << i << "  " << job->serNum << "  already up to date" << endl;
+			delete job->update;
+			job->update = 0;
+			continue;
+		}
+
+		cout << i << "  " << job->serNum << "  " << job->update->numPackets << " packets to write" << endl;
+		numPackets += job->update->numPackets;
+
+		if(!enableWrite)
+		{
+			delete job->update;
+			job->update = 0;
+			continue;
+		}
+
+		job->write = new seqOp;
+		job->write->add(job->update);
+		job->write->add(new eepromReadOp(ext, 0, size, job->check, devs[i]->caps));
+
+		writeMux.add(devs[i], job->write);
+		numWrites++;
+	}
+
+	if(!enableWrite && numPackets > 0) cout << "EEPROM write not enabled, use -w" << endl;
+
+	// the writes, with a progress line for every probe
+	if(numWrites > 0)
+	{
+		cout << "Writing " << numPackets << " packets to " << numWrites << " probes" << endl;
+
+		while(writeMux.run(FLASH_REPORT_TIME) > 0)
+		{
+			cout << "  " << (int)(timeNow() - t0) << " s  " << budget.limit << " in flight  rtt " << budget.avgRtt * 1000.0 << " ms ";
+
+			for(int i(0); i < numDevs; i++)
+			{
+				flashJob* job = &jobs[i];
+				if(!job->write) continue;
+
+				cout << "  " << job->serNum << " ";
+				if(job->write->result != OP_MORE) cout << (job->write->result == OP_DONE ? "done" : "failed");
+				else if(job->write->cur > 0) cout << "verify";
+				else cout << 100 * job->update->sent / job->update->numPackets << "%";
+			}
+
+			cout << endl;
+		}
+	}
+
+	int res(0);
+	int numDone(0);
+
+	for(int i(0); i < numDevs; i++)
+	{
+		flashJob* job = &jobs[i];
+		if(job->failed) res = 1;
+		if(!job->write) continue;
+
+		if(job->write->result != OP_DONE)
+		{
+			cout << i << "  " << job->serNum << "  Error: the write failed after " << job->update->sent << " of " << job->update->numPackets << " packets" << endl;
+			res = 1;
+		}
+		else if(memcmp(job->check, job->image, size) != 0)
+		{
+			cout << i << "  " << job->serNum << "  Error: the eeprom does not read back as written" << endl;
+			res = 1;
+		}
+		else
+		{
+			numDone++;
+
+			// the probe only takes up the new eeprom once it restarts
+			if(i1d3Reenumerate(&devs[i])) cout << i << "  " << job->serNum << "  written and reset" << endl;
+			else cout << i << "  " << job->serNum << "  written, now unplug and plugin the USB connection" << endl;
+		}
+	}
+
+	if(numWrites > 0)
+	{
+		cout << numDone << " of " << numWrites << " probes written in " << timeNow() - t0 << " s, "
+			 << budget.timeouts << " timeouts" << endl;
+	}
+
+	for(int i(0); i < numDevs; i++)
+	{
+		closeHIDdevice(devs[i]);
+		delete devs[i];
+	}
+
+	delete[] jobs;
+
+	return res;
+}
+
+
+/* Patch sequencing */
+#define SETTLE_INTTIME		0.02
+#define SETTLE_TOL			0.01	// relative change between successive readings that counts as settled
+#define SETTLE_MAX_TIME		3.0
+
+#define PATCH_FILE			"i1d3patch.txt"
+#define PATCH_TMP_FILE		"i1d3patch.tmp"
+
+
+// Interface to whatever is displaying the patches.  prepare() gets the next patch ready without showing
+// it and may run on a worker thread while the current patch is measured, show() puts it on screen.
+class patchSource
+{
+	public:
+	virtual		   ~patchSource() {};
+
+	virtual int		numPatches() = 0;
+	virtual bool	prepare(int index, double rgb[3]) = 0;
+	virtual bool	show() = 0;
+};
+
+
+// Stand-in patch source that reads a list of "R G B" values (0.0 - 1.0) and hands each patch to a display
+// program through PATCH_FILE.  The patch is written to a temporary file in prepare() and renamed over
+// PATCH_FILE in show(), so the display side never sees a partly written patch.
+class filePatchSource : public patchSource
+{
+	public:
+					filePatchSource():patches(0), numPatch(0) {};
+				   ~filePatchSource(){ if(patches) delete[] patches; };
+
+	bool			load(const char* fileName);
+
+	int				numPatches() { return numPatch; };
+	bool			prepare(int index, double rgb[3]);
+	bool			show();
+
+	double*			patches;
+	int				numPatch;
+};
+
+
+bool filePatchSource::load(const char* fileName)
+{
+	unsigned int size(0);
+	unsigned char* buf = readWholeFile(fileName, &size);
+	if(!buf) return false;
+
+	// every patch is three numbers, so there can't be more than size / 6 of them
+	patches = new double[size / 2 + 3];
+
+	char* cPtr = (char*)buf;
+	char* ePtr;
+	int numVals(0);
+
+	while(true)
+	{
+		double val = strtod(cPtr, &ePtr);
+		if(ePtr == cPtr) break;
+
+		patches[numVals++] = val;
+		cPtr = ePtr;
+	}
+
+	delete[] buf;
+
+	numPatch = numVals / 3;
+
+	return numPatch > 0;
+}
+
+
+bool filePatchSource::prepare(int index, double rgb[3])
+{
+	memcpy(rgb, patches + index * 3, 3 * sizeof(double));
+
+	char line[128];
+	int len = sprintf(line, "%d %f %f %f\r\n", index, rgb[0], rgb[1], rgb[2]);
+
+	HANDLE hd = CreateFile(PATCH_TMP_FILE, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	if(hd == INVALID_HANDLE_VALUE) return false;
+
+	DWORD noWritten(0);
+	bool ok = WriteFile(hd, line, len, &noWritten, NULL) && (noWritten == (DWORD)len);
+
+	CloseHandle(hd);
+
+	return ok;
+}
+
+
+bool filePatchSource::show()
+{
+	return MoveFileEx(PATCH_TMP_FILE, PATCH_FILE, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+
+// Wait for the display to settle on a new patch by watching short readings until two in a row agree,
+// instead of sleeping for a fixed worst case settle time
+bool waitSettled(hidIdevice* dev, double refreshRate)
+{
+	double prev(-1.0);
+	double elapsed(0.0);
+
+	while(elapsed < SETTLE_MAX_TIME)
+	{
+		double inttime = snapToRefresh(SETTLE_INTTIME, refreshRate);
+		double counts[3];
+
+		if(i1d3Measure(dev, &inttime, counts) < 0) return false;
+		elapsed += inttime;
+
+		double cur = counts[0] + counts[1] + counts[2];
+
+		// +/-2 counts of slack so a near black patch doesn't chase quantization noise
+		if(prev >= 0.0 && fabs(cur - prev) <= SETTLE_TOL * (cur > prev ? cur : prev) + 2.0) return true;
+
+		prev = cur;
+	}
+
+	return false;
+}
+
+
+class prepJob
+{
+	public:
+	patchSource*	src;
+	int				index;
+	double			rgb[3];
+	bool			ok;
+};
+
+
+DWORD WINAPI prepJobThread(LPVOID param)
+{
+	prepJob* job = (prepJob*)param;
+
+	job->ok = job->src->prepare(job->index, job->rgb);
+
+	return 0;
+}
+
+
+// Show, settle and measure every patch, preparing the next patch while the current one is measured.
+// Writes "index R G B Hz_R Hz_G Hz_B X Y Z" lines to hd, XYZ is zero without a CCSS correction.
+int runSequence(hidIdevice* dev, const char* serNum, patchSource* src, HANDLE hd, double refreshRate, bool haveXYZ, double mat[3][3])
+{
+	int num = src->numPatches();
+
+	prepJob job;
+	job.src = src;
+	job.index = 0;
+	job.ok = src->prepare(0, job.rgb);
+
+	double t0 = timeNow();
+
+	for(int i(0); i < num; i++)
+	{
+		if(!job.ok || !src->show())
+		{
+			cout << "Error: Failed to show patch " << i << endl;
+			return -1;
+		}
+
+		double rgb[3];
+		memcpy(rgb, job.rgb, sizeof(rgb));
+
+		if(!waitSettled(dev, refreshRate)) cout << "Warning: patch " << i << " did not settle" << endl;
+
+		HANDLE th(0);
+		if(i + 1 < num)
+		{
+			job.index = i + 1;
+			th = CreateThread(NULL, 0, prepJobThread, &job, 0, NULL);
+		}
+
+		double hz[3], xyz[3] = { 0.0, 0.0, 0.0 };
+		double inttime(0.0);
+		int res = i1d3MeasureAuto(dev, hz, &inttime, refreshRate);
+
+		if(th)
+		{
+			WaitForSingleObject(th, INFINITE);
+			CloseHandle(th);
+		}
+
+		if(res < 0)
+		{
+			cout << "Error: Measurement of patch " << i << " failed" << endl;
+			return -1;
+		}
+
+		if(haveXYZ) applyMatrix(mat, hz, xyz);
+
+		recordReading(serNum, i, hz, xyz);
+
+		char line[256];
+		int len = sprintf(line, "%d %f %f %f %f %f %f %f %f %f\r\n", i, rgb[0], rgb[1], rgb[2], hz[0], hz[1], hz[2], xyz[0], xyz[1], xyz[2]);
+
+		DWORD noWritten(0);
+		if(!WriteFile(hd, line, len, &noWritten, NULL) || noWritten != (DWORD)len) return -1;
+	}
+
+	publishStatus("idle");
+
+	cout << num << " patches measured in " << timeNow() - t0 << " s" << endl;
+
+	return 0;
+}
+
+
+/* 3D LUT builder */
+#define LUT_DEFAULT_SIZE	33
+#define LUT_MAX_SIZE		65
+#define LUT_BLOCK			8		// lattice points per side of a block handed to a worker
+#define LUT_TARGET_GAMMA	2.4
+
+// Rec. 709 / sRGB primaries with a D65 white, linear RGB to XYZ
+const double rec709ToXYZ[3][3] =
+{
+	{ 0.4124, 0.3576, 0.1805 },
+	{ 0.2126, 0.7152, 0.0722 },
+	{ 0.0193, 0.1192, 0.9505 }
+};
+
+
+// Display model: XYZ = black + M * (R^gamma[0], G^gamma[1], B^gamma[2])
+class displayModel
+{
+	public:
+	double			mat[3][3];
+	double			inv[3][3];
+	double			gamma[3];
+	double			black[3];
+};
+
+
+// Least squares fit of the primaries matrix for a given set of channel gammas, returns the squared error
+double fitPrimaries(double* rgb, double* xyz, int num, displayModel* dm)
+{
+	double ll[3][3], xl[3][3];
+	memset(ll, 0, sizeof(ll));
+	memset(xl, 0, sizeof(xl));
+
+	for(int i(0); i < num; i++)
+	{
+		double lin[3];
+		for(int k(0); k < 3; k++) lin[k] = pow(rgb[i * 3 + k], dm->gamma[k]);
+
+		for(int r(0); r < 3; r++)
+		{
+			for(int c(0); c < 3; c++)
+			{
+				ll[r][c] += lin[r] * lin[c];
+				xl[r][c] += (xyz[i * 3 + r] - dm->black[r]) * lin[c];
+			}
+		}
+	}
+
+	double lli[3][3];
+	if(!invert3x3(ll, lli)) return 1e300;
+
+	for(int r(0); r < 3; r++)
+	{
+		for(int c(0); c < 3; c++)
+		{
+			dm->mat[r][c] = xl[r][0] * lli[0][c] + xl[r][1] * lli[1][c] + xl[r][2] * lli[2][c];
+		}
+	}
+
+	double err(0.0);
+	for(int i(0); i < num; i++)
+	{
+		double lin[3], est[3];
+		for(int k(0); k < 3; k++) lin[k] = pow(rgb[i * 3 + k], dm->gamma[k]);
+		applyMatrix(dm->mat, lin, est);
+
+		for(int k(0); k < 3; k++)
+		{
+			double d = xyz[i * 3 + k] - dm->black[k] - est[k];
+			err += d * d;
+		}
+	}
+
+	return err;
+}
+
+
+bool fitDisplayModel(double* rgb, double* xyz, int num, displayModel* dm)
+{
+	// the darkest patch stands in for the black level
+	int darkest(0);
+	for(int i(1); i < num; i++)
+	{
+		if(rgb[i * 3] + rgb[i * 3 + 1] + rgb[i * 3 + 2] < rgb[darkest * 3] + rgb[darkest * 3 + 1] + rgb[darkest * 3 + 2]) darkest = i;
+	}
+
+	for(int k(0); k < 3; k++)
+	{
+		dm->black[k] = (rgb[darkest * 3] + rgb[darkest * 3 + 1] + rgb[darkest * 3 + 2] == 0.0) ? xyz[darkest * 3 + k] : 0.0;
+		dm->gamma[k] = 2.2;
+	}
+
+	// coordinate descent on the gammas, refitting the matrix for each candidate
+	double best = fitPrimaries(rgb, xyz, num, dm);
+
+	for(int pass(0); pass < 3; pass++)
+	{
+		for(int k(0); k < 3; k++)
+		{
+			double bestGamma = dm->gamma[k];
+
+			for(double g(1.0); g <= 3.5; g += 0.01)
+			{
+				dm->gamma[k] = g;
+				double err = fitPrimaries(rgb, xyz, num, dm);
+
+				if(err < best)
+				{
+					best = err;
+					bestGamma = g;
+				}
+			}
+
+			dm->gamma[k] = bestGamma;
+		}
+	}
+
+	fitPrimaries(rgb, xyz, num, dm);
+
+	return invert3x3(dm->mat, dm->inv);
+}
+
+
+class lutJob
+{
+	public:
+	int				size;
+	double			toDev[3][3];	// target linear RGB to display linear RGB
+	double			invGamma[3];
+	float*			lut;			// size^3 x 3, red fastest as in a .cube file
+	volatile LONG*	nextBlock;
+	int				blocksPerSide;
+};
+
+
+// Workers take LUT_BLOCK^3 blocks of the lattice in turn, so each one works on a compact region of the
+// output rather than striding across whole planes
+DWORD WINAPI lutJobThread(LPVOID param)
+{
+	lutJob* job = (lutJob*)param;
+	int n = job->size;
+	int bps = job->blocksPerSide;
+
+	while(true)
+	{
+		LONG blk = InterlockedIncrement(job->nextBlock) - 1;
+		if(blk >= bps * bps * bps) break;
+
+		int b0 = (blk / (bps * bps)) * LUT_BLOCK;
+		int g0 = ((blk / bps) % bps) * LUT_BLOCK;
+		int r0 = (blk % bps) * LUT_BLOCK;
+
+		for(int b(b0); b < b0 + LUT_BLOCK && b < n; b++)
+		{
+			for(int g(g0); g < g0 + LUT_BLOCK && g < n; g++)
+			{
+				for(int r(r0); r < r0 + LUT_BLOCK && r < n; r++)
+				{
+					double tgt[3], dev[3];
+					tgt[0] = pow((double)r / (n - 1), LUT_TARGET_GAMMA);
+					tgt[1] = pow((double)g / (n - 1), LUT_TARGET_GAMMA);
+					tgt[2] = pow((double)b / (n - 1), LUT_TARGET_GAMMA);
+
+					applyMatrix(job->toDev, tgt, dev);
+
+					// Gamut map by desaturating towards the grey of the same luminance until the colour
+					// fits the display, so hue and luminance are kept and only chroma is lost
+					double grey = 0.2126 * tgt[0] + 0.7152 * tgt[1] + 0.0722 * tgt[2];
+					double greyDev[3];
+					double ones[3] = { grey, grey, grey };
+					applyMatrix(job->toDev, ones, greyDev);
+
+					double t(1.0);
+					for(int k(0); k < 3; k++)
+					{
+						if(dev[k] < 0.0 && dev[k] < greyDev[k]) t = min(t, greyDev[k] / (greyDev[k] - dev[k]));
+						if(dev[k] > 1.0 && dev[k] > greyDev[k]) t = min(t, (1.0 - greyDev[k]) / (dev[k] - greyDev[k]));
+					}
+
+					float* out = job->lut + ((b * n + g) * n + r) * 3;
+					for(int k(0); k < 3; k++)
+					{
+						double v = greyDev[k] + t * (dev[k] - greyDev[k]);
+						if(v < 0.0) v = 0.0;
+						if(v > 1.0) v = 1.0;
+						out[k] = (float)pow(v, job->invGamma[k]);
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+// Build a Rec. 709 / gamma 2.4 calibration LUT from a -p results file and write it as a .cube file
+int buildLut(const char* resultsFile, const char* outFile, bool force, int size)
+{
+	unsigned int fsize(0);
+	unsigned char* buf = readWholeFile(resultsFile, &fsize);
+	if(!buf)
+	{
+		cout << "Error: Failed to read measurements from " << resultsFile << endl;
+		return 1;
+	}
+
+	// index R G B Hz_R Hz_G Hz_B X Y Z per line
+	double* rgb = new double[fsize / 10 * 3 + 3];
+	double* xyz = new double[fsize / 10 * 3 + 3];
+	int num(0);
+
+	char* cPtr = (char*)buf;
+	while(true)
+	{
+		double vals[10];
+		int got(0);
+		char* ePtr;
+
+		for(; got < 10; got++)
+		{
+			vals[got] = strtod(cPtr, &ePtr);
+			if(ePtr == cPtr) break;
+			cPtr = ePtr;
+		}
+
+		if(got < 10) break;
+		if(vals[7] == 0.0 && vals[8] == 0.0 && vals[9] == 0.0) continue;
+
+		memcpy(rgb + num * 3, vals + 1, 3 * sizeof(double));
+		memcpy(xyz + num * 3, vals + 7, 3 * sizeof(double));
+		num++;
+	}
+
+	delete[] buf;
+
+	displayModel dm;
+	if(num < 4 || !fitDisplayModel(rgb, xyz, num, &dm))
+	{
+		delete[] rgb;
+		delete[] xyz;
+		cout << "Error: need at least 4 patches with XYZ (measure with a CCSS -c) to fit the display" << endl;
+		return 1;
+	}
+
+	delete[] rgb;
+	delete[] xyz;
+
+	cout << "Display gamma " << dm.gamma[0] << "  " << dm.gamma[1] << "  " << dm.gamma[2] << endl;
+
+	// Scale the target so its D65 white is the brightest white the display can reach
+	lutJob proto;
+	double t2d[3][3];
+	for(int r(0); r < 3; r++)
+	{
+		for(int c(0); c < 3; c++)
+		{
+			t2d[r][c] = dm.inv[r][0] * rec709ToXYZ[0][c] + dm.inv[r][1] * rec709ToXYZ[1][c] + dm.inv[r][2] * rec709ToXYZ[2][c];
+		}
+	}
+
+	double white[3], whiteDev[3];
+	white[0] = white[1] = white[2] = 1.0;
+	applyMatrix(t2d, white, whiteDev);
+
+	double peak = max(whiteDev[0], max(whiteDev[1], whiteDev[2]));
+	for(int r(0); r < 3; r++)
+	{
+		for(int c(0); c < 3; c++) proto.toDev[r][c] = t2d[r][c] / peak;
+		proto.invGamma[r] = 1.0 / dm.gamma[r];
+	}
+
+	LONG nextBlock(0);
+	proto.size = size;
+	proto.lut = new float[size * size * size * 3];
+	proto.nextBlock = &nextBlock;
+	proto.blocksPerSide = (size + LUT_BLOCK - 1) / LUT_BLOCK;
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	int numThreads = (int)si.dwNumberOfProcessors;
+	if(numThreads < 1) numThreads = 1;
+	if(numThreads > MAXIMUM_WAIT_OBJECTS) numThreads = MAXIMUM_WAIT_OBJECTS;
+
+	double t0 = timeNow();
+
+	HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+	for(int i(0); i < numThreads; i++)
+	{
+		threads[i] = CreateThread(NULL, 0, lutJobThread, &proto, 0, NULL);
+	}
+
+	WaitForMultipleObjects(numThreads, threads, TRUE, INFINITE);
+	for(int i(0); i < numThreads; i++) CloseHandle(threads[i]);
+
+	cout << size << "^3 LUT built on " << numThreads << " threads in " << timeNow() - t0 << " s" << endl;
+
+	HANDLE hd = CreateFile(outFile, GENERIC_WRITE, 0, NULL, force ? CREATE_ALWAYS : CREATE_NEW, 0, NULL);
+	if(hd == INVALID_HANDLE_VALUE)
+	{
+		delete[] proto.lut;
+		cout << "Error: Failed to open file " << outFile << " for writing" << endl;
+		return 1;
+	}
+
+	// format the whole file in memory, a 65^3 LUT is only a few MB
+	int numPoints = size * size * size;
+	char* text = new char[numPoints * 32 + 256];
+	char* tPtr = text;
+
+	tPtr += sprintf(tPtr, "TITLE \"i1d3util Rec709 gamma 2.4\"\r\nLUT_3D_SIZE %d\r\n", size);
+	for(int i(0); i < numPoints; i++)
+	{
+		tPtr += sprintf(tPtr, "%.6f %.6f %.6f\r\n", proto.lut[i * 3], proto.lut[i * 3 + 1], proto.lut[i * 3 + 2]);
+	}
+
+	DWORD len = (DWORD)(tPtr - text);
+	DWORD noWritten(0);
+	bool ok = WriteFile(hd, text, len, &noWritten, NULL) && noWritten == len;
+
+	CloseHandle(hd);
+	delete[] text;
+	delete[] proto.lut;
+
+	if(!ok)
+	{
+		cout << "Error: Failed to write file " << outFile << endl;
+		return 1;
+	}
+
+	cout << "3D LUT written to file " << outFile << endl;
+
+	return 0;
+}
+
+
+/* Reference matrix fitting */
+#define FIT_FOLDS			5		// cross validation folds
+#define FIT_MIN_PATCHES		6		// at least two per unknown in each row of the matrix
+#define FIT_WEIGHT_FLOOR	0.01	// fraction of the brightest Y below which a patch's weight stops growing
+
+
+// Reads the first num numbers of each line of a file that has at least that many, returns them num to a line or
+// 0 if the file can't be read.  Anything after them on a line is ignored.
+double* readNumberLines(const char* fileName, int num, int* numLines)
+{
+	unsigned int size(0);
+	unsigned char* buf = readWholeFile(fileName, &size);
+	if(!buf) return 0;
+
+	// every number takes at least two characters
+	double* vals = new double[(size / (num * 2) + 1) * num];
+
+	*numLines = 0;
+	char* cPtr = (char*)buf;
+	char* end = cPtr + size;
+
+	while(cPtr < end)
+	{
+		char* eol = cPtr;
+		while(eol < end && *eol != '\n') eol++;
+		*eol = 0;
+
+		double* row = vals + *numLines * num;
+		int got(0);
+		char* ePtr;
+
+		for(; got < num; got++)
+		{
+			row[got] = strtod(cPtr, &ePtr);
+			if(ePtr == cPtr) break;
+			cPtr = ePtr;
+		}
+
+		if(got == num) (*numLines)++;
+		cPtr = eol + 1;
+	}
+
+	delete[] buf;
+
+	return vals;
+}
+
+
+// Least squares fit of XYZ = M * Hz over the patches with use[i] set, optionally weighting each patch by
+// 1 / Y^2 so that the error is relative and the dark patches count as much as the bright ones
+bool fitMatrix(double* hz, double* xyz, bool* use, int num, bool weighted, double mat[3][3])
+{
+	double maxY(0.0);
+	for(int i(0); i < num; i++) if(use[i] && xyz[i * 3 + 1] > maxY) maxY = xyz[i * 3 + 1];
+
+	double hh[3][3], xh[3][3];
+	memset(hh, 0, sizeof(hh));
+	memset(xh, 0, sizeof(xh));
+
+	for(int i(0); i < num; i++)
+	{
+		if(!use[i]) continue;
+
+		double w(1.0);
+		if(weighted)
+		{
+			double y = xyz[i * 3 + 1];
+			if(y < FIT_WEIGHT_FLOOR * maxY) y = FIT_WEIGHT_FLOOR * maxY;
+			w = 1.0 / (y * y);
+		}
+
+		for(int r(0); r < 3; r++)
+		{
+			for(int c(0); c < 3; c++)
+			{
+				hh[r][c] += w * hz[i * 3 + r] * hz[i * 3 + c];
+				xh[r][c] += w * xyz[i * 3 + r] * hz[i * 3 + c];
+			}
+		}
+	}
+
+	double hhi[3][3];
+	if(!invert3x3(hh, hhi)) return false;
+
+	for(int r(0); r < 3; r++)
+	{
+		for(int c(0); c < 3; c++)
+		{
+			mat[r][c] = xh[r][0] * hhi[0][c] + xh[r][1] * hhi[1][c] + xh[r][2] * hhi[2][c];
+		}
+	}
+
+	return true;
+}
+
+
+// Error of a patch relative to its reference luminance, so it means the same on a dark patch as a bright one
+double fitError(double mat[3][3], double* hz, double* xyz)
+{
+	double est[3];
+	applyMatrix(mat, hz, est);
+
+	double dx = est[0] - xyz[0];
+	double dy = est[1] - xyz[1];
+	double dz = est[2] - xyz[2];
+
+	return sqrt(dx * dx + dy * dy + dz * dz) / (xyz[1] > 0.0 ? xyz[1] : 1.0);
+}
+
+
+// One fit: every patch when fold is -1, otherwise all but one fold, scored on the fold left out
+class fitJob
+{
+	public:
+	double*			hz;
+	double*			xyz;
+	int				num;
+	int				fold;
+	bool			weighted;
+	bool			ok;
+	double			mat[3][3];
+	double			sumSq;		// squared errors on the patches left out
+	int				numTest;
+};
+
+
+struct fitJobList
+{
+	fitJob*			jobs;
+	int				numJobs;
+	volatile LONG*	nextJob;
+};
+
+
+DWORD WINAPI fitJobThread(LPVOID param)
+{
+	fitJobList* list = (fitJobList*)param;
+
+	while(true)
+	{
+		LONG j = InterlockedIncrement(list->nextJob) - 1;
+		if(j >= list->numJobs) break;
+
+		fitJob* job = &list->jobs[j];
+		bool* use = new bool[job->num];
+		for(int i(0); i < job->num; i++) use[i] = (job->fold < 0) || (i % FIT_FOLDS != job->fold);
+
+		job->sumSq = 0.0;
+		job->numTest = 0;
+		job->ok = fitMatrix(job->hz, job->xyz, use, job->num, job->weighted, job->mat);
+
+		for(int i(0); i < job->num && job->ok && job->fold >= 0; i++)
+		{
+			if(use[i]) continue;
+
+			double e = fitError(job->mat, job->hz + i * 3, job->xyz + i * 3);
+			job->sumSq += e * e;
+			job->numTest++;
+		}
+
+		delete[] use;
+	}
+
+	return 0;
+}
+
+
+// Fits the probe's frequencies in a -p results file to the XYZ a reference instrument measured for the same
+// patches, and stores the matrix for the probe's serial number.  The reference file has an "index X Y Z" line
+// per patch, matched to the results by index.  Plain and luminance weighted least squares are both fitted, and
+// both cross validated over FIT_FOLDS subsets of the patches, all on worker threads, and the one that predicts
+// the patches it was not fitted to better is kept.
+int fitReference(const char* serNum, const char* refFile, const char* resultsFile)
+{
+	// index R G B Hz_R Hz_G Hz_B X Y Z per line
+	int numRes(0);
+	double* res = readNumberLines(resultsFile, 10, &numRes);
+	if(!res)
+	{
+		cout << "Error: Failed to read measurements from " << resultsFile << endl;
+		return 1;
+	}
+
+	int numRef(0);
+	double* ref = readNumberLines(refFile, 4, &numRef);
+	if(!ref)
+	{
+		cout << "Error: Failed to read reference values from " << refFile << endl;
+		delete[] res;
+		return 1;
+	}
+
+	// pair the two by patch index
+	double* hz = new double[numRes * 3 + 3];
+	double* xyz = new double[numRes * 3 + 3];
+	int num(0);
+
+	for(int i(0); i < numRes; i++)
+	{
+		for(int j(0); j < numRef; j++)
+		{
+			if(ref[j * 4] != res[i * 10]) continue;
+
+			memcpy(hz + num * 3, res + i * 10 + 4, 3 * sizeof(double));
+			memcpy(xyz + num * 3, ref + j * 4 + 1, 3 * sizeof(double));
+			num++;
+			break;
+		}
+	}
+
+	delete[] res;
+	delete[] ref;
+
+	if(num < FIT_MIN_PATCHES * 2)
+	{
+		cout << "Error: Only " << num << " patches are in both files, at least " << FIT_MIN_PATCHES * 2 << " are needed" << endl;
+		delete[] hz;
+		delete[] xyz;
+		return 1;
+	}
+
+	// a full fit and FIT_FOLDS validation fits for each method
+	int numJobs = 2 * (FIT_FOLDS + 1);
+	fitJob* jobs = new fitJob[numJobs];
+
+	for(int j(0); j < numJobs; j++)
+	{
+		jobs[j].hz = hz;
+		jobs[j].xyz = xyz;
+		jobs[j].num = num;
+		jobs[j].weighted = (j >= FIT_FOLDS + 1);
+		jobs[j].fold = j % (FIT_FOLDS + 1) - 1;
+	}
+
+	LONG nextJob(0);
+	fitJobList list;
+	list.jobs = jobs;
+	list.numJobs = numJobs;
+	list.nextJob = &nextJob;
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	int numThreads = (int)si.dwNumberOfProcessors;
+	if(numThreads < 1) numThreads = 1;
+	if(numThreads > numJobs) numThreads = numJobs;
+
+	HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+	for(int i(0); i < numThreads; i++)
+	{
+		threads[i] = CreateThread(NULL, 0, fitJobThread, &list, 0, NULL);
+	}
+
+	WaitForMultipleObjects(numThreads, threads, TRUE, INFINITE);
+	for(int i(0); i < numThreads; i++) CloseHandle(threads[i]);
+
+	const char* methodName[2] = { "Least squares", "Weighted" };
+	double cvErr[2];
+	int best(-1);
+
+	for(int m(0); m < 2; m++)
+	{
+		fitJob* full = &jobs[m * (FIT_FOLDS + 1)];
+		double sumSq(0.0);
+		int numTest(0);
+		bool ok = full->ok;
+
+		for(int f(1); f <= FIT_FOLDS; f++)
+		{
+			ok = ok && full[f].ok;
+			sumSq += full[f].sumSq;
+			numTest += full[f].numTest;
+		}
+
+		if(!ok || numTest == 0)
+		{
+			cout << methodName[m] << "  failed, the readings do not determine a matrix" << endl;
+			continue;
+		}
+
+		cvErr[m] = sqrt(sumSq / numTest);
+
+		double fitSq(0.0);
+		for(int i(0); i < num; i++)
+		{
+			double e = fitError(full->mat, hz + i * 3, xyz + i * 3);
+			fitSq += e * e;
+		}
+
+		cout << methodName[m] << "  fit " << 100.0 * sqrt(fitSq / num) << " %  cross validated " << 100.0 * cvErr[m] << " %" << endl;
+
+		if(best < 0 || cvErr[m] < cvErr[best]) best = m;
+	}
+
+	delete[] hz;
+	delete[] xyz;
+
+	if(best < 0)
+	{
+		delete[] jobs;
+		cout << "Error: Failed to fit a matrix" << endl;
+		return 1;
+	}
+
+	double mat[3][3];
+	memcpy(mat, jobs[best * (FIT_FOLDS + 1)].mat, sizeof(mat));
+	delete[] jobs;
+
+	cout << methodName[best] << " matrix for " << serNum << " from " << num << " patches" << endl;
+	for(int r(0); r < 3; r++)
+	{
+		cout << "  " << mat[r][0] << "  " << mat[r][1] << "  " << mat[r][2] << endl;
+	}
+
+	if(!i1d3StoreFit(serNum, mat))
+	{
+		cout << "Error: Failed to store the matrix in " << CORR_CACHE_FILE << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/* Warm-up and drift */
+#define DRIFT_INTTIME		1.0		// seconds per reading of the reference patch
+#define DRIFT_WINDOW		120		// readings in the sliding fit, two minutes at DRIFT_INTTIME
+#define DRIFT_READY_RATE	0.05	// percent per minute, on every channel, that counts as stable
+#define DRIFT_READY_HOLD	30		// consecutive stable fits before the probe is declared ready
+#define DRIFT_MAX_TIME		1800.0	// give up after half an hour
+#define DRIFT_MIN_HZ		1000.0	// below this the patch is too dim for a useful estimate
+#define DRIFT_REPORT_TIME	10.0
+#define DRIFT_HISTORY_MAX	256		// runs kept per probe when judging the latest one
+#define DRIFT_FLAG_RUNS		3		// previous runs needed before a probe can be flagged
+#define DRIFT_FLAG_RATIO	2.0		// flagged when a run takes this much longer than the probe's median
+
+
+// Least squares slope of each channel over the last DRIFT_WINDOW readings, kept as running sums so each reading
+// costs the same however long the warm-up runs.  Times are relative to the first reading to keep the sums exact
+// enough.
+class driftEstimator
+{
+	public:
+					driftEstimator():n(0), next(0), st(0.0), stt(0.0) { for(int ch(0); ch < 3; ch++) sy[ch] = sty[ch] = 0.0; };
+
+	void			add(double t, double hz[3]);
+	double			rate(int ch);
+	double			maxRate();
+	bool			full() { return n == DRIFT_WINDOW; };
+
+	int				n;
+	int				next;
+	double			t[DRIFT_WINDOW];
+	double			y[DRIFT_WINDOW][3];
+	double			st, stt;
+	double			sy[3], sty[3];
+};
+
+
+void driftEstimator::add(double tNew, double hz[3])
+{
+	// the oldest reading drops out of the sums once the window is full
+	if(n == DRIFT_WINDOW)
+	{
+		double tOld = t[next];
+		st -= tOld;
+		stt -= tOld * tOld;
+		for(int ch(0); ch < 3; ch++)
+		{
+			sy[ch] -= y[next][ch];
+			sty[ch] -= tOld * y[next][ch];
+		}
+	}
+	else n++;
+
+	t[next] = tNew;
+	st += tNew;
+	stt += tNew * tNew;
+	for(int ch(0); ch < 3; ch++)
+	{
+		y[next][ch] = hz[ch];
+		sy[ch] += hz[ch];
+		sty[ch] += tNew * hz[ch];
+	}
+
+	next = (next + 1) % DRIFT_WINDOW;
+}
+
+
+// Slope relative to the mean level, in percent per minute
+double driftEstimator::rate(int ch)
+{
+	double den = n * stt - st * st;
+	if(n < 2 || den <= 0.0 || sy[ch] <= 0.0) return 0.0;
+
+	double slope = (n * sty[ch] - st * sy[ch]) / den;
+
+	return slope / (sy[ch] / n) * 60.0 * 100.0;
+}
+
+
+double driftEstimator::maxRate()
+{
+	double worst(0.0);
+
+	for(int ch(0); ch < 3; ch++)
+	{
+		double r = fabs(rate(ch));
+		if(r > worst) worst = r;
+	}
+
+	return worst;
+}
+
+
+// The history file gets one line per warm-up, tab separated, and is only ever appended to
+struct driftRun
+{
+	long long		when;		// seconds since 1970
+	double			warmup;		// seconds until ready, or until given up
+	double			initial;	// drift over the first full window, percent per minute
+	double			final;
+	int				ready;
+};
+
+
+int loadDriftHistory(const char* histFile, const char* serNum, driftRun* runs)
+{
+	FILE* fp = fopen(histFile, "r");
+	if(!fp) return 0;
+
+	char line[256];
+	int numRuns(0);
+
+	while(fgets(line, sizeof(line), fp))
+	{
+		if(line[0] == '#') continue;
+
+		char ser[21];
+		driftRun run;
+		if(sscanf(line, "%20[^\t]\t%lld\t%lf\t%lf\t%lf\t%d", ser, &run.when, &run.warmup, &run.initial, &run.final, &run.ready) != 6) continue;
+		if(strcmp(ser, serNum) != 0) continue;
+
+		// keep the most recent runs
+		if(numRuns == DRIFT_HISTORY_MAX)
+		{
+			memmove(runs, runs + 1, (DRIFT_HISTORY_MAX - 1) * sizeof(driftRun));
+			numRuns--;
+		}
+		runs[numRuns++] = run;
+	}
+
+	fclose(fp);
+
+	return numRuns;
+}
+
+
+bool appendDriftHistory(const char* histFile, const char* serNum, driftRun& run)
+{
+	FILE* fp = fopen(histFile, "r");
+	bool newFile = (fp == 0);
+	if(fp) fclose(fp);
+
+	fp = fopen(histFile, "a");
+	if(!fp) return false;
+
+	if(newFile) fprintf(fp, "# serial\twhen\twarm-up s\tinitial %%/min\tfinal %%/min\tready\n");
+	fprintf(fp, "%s\t%lld\t%.1f\t%.4f\t%.4f\t%d\n", serNum, run.when, run.warmup, run.initial, run.final, run.ready);
+
+	fclose(fp);
+
+	return true;
+}
+
+
+int compareDouble(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+
+// Sorts v in place
+double medianOf(double* v, int n)
+{
+	qsort(v, n, sizeof(double), compareDouble);
+
+	return (n % 2) ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+
+// Measures the patch in front of the probe, which should be a steady bright reference such as full white, until
+// the drift of its raw frequencies settles, instead of waiting a fixed time.  Each reading also goes to the live
+// ring and the log.  The run is added to the probe's history, and compared with its earlier runs so a probe that
+// has started to take unusually long to settle, or drifts unusually hard when cold, gets flagged.
+int warmUpProbe(hidIdevice* dev, const char* histFile)
+{
+	if(i1d3UnLock(dev) < 0)
+	{
+		cout << "Error: Failed to unlock the i1d3" << endl;
+		return 1;
+	}
+
+	char serNum[21];
+	i1d3ReadSerial(dev, serNum);
+
+	driftRun* runs = new driftRun[DRIFT_HISTORY_MAX];
+	int numRuns = loadDriftHistory(histFile, serNum, runs);
+
+	cout << "Warming up " << serNum << ", ready below " << DRIFT_READY_RATE << " %/min" << endl;
+	publishStatus("warming up");
+
+	driftEstimator est;
+	driftRun run;
+	run.when = wallTimeUs() / 1000000;
+	run.initial = -1.0;
+	run.final = 0.0;
+	run.ready = 0;
+
+	int stable(0);
+	double start = timeNow();
+	double nextReport = start + DRIFT_REPORT_TIME;
+	double xyz[3] = { 0.0, 0.0, 0.0 };
+
+	for(;;)
+	{
+		double inttime(DRIFT_INTTIME);
+		double counts[3];
+
+		if(i1d3Measure(dev, &inttime, counts) < 0)
+		{
+			cout << "Error: Measurement failed" << endl;
+			delete[] runs;
+			return 1;
+		}
+
+		double now = timeNow();
+		double hz[3];
+		for(int ch(0); ch < 3; ch++) hz[ch] = counts[ch] / inttime;
+
+		if(est.n == 0 && (hz[0] < DRIFT_MIN_HZ || hz[1] < DRIFT_MIN_HZ || hz[2] < DRIFT_MIN_HZ))
+		{
+			cout << "Warning: the reference patch is dim, the drift estimate will be noisy" << endl;
+		}
+
+		est.add(now - start, hz);
+		recordReading(serNum, -1, hz, xyz);
+
+		if(est.full())
+		{
+			run.final = est.maxRate();
+			if(run.initial < 0.0) run.initial = run.final;
+
+			stable = (run.final < DRIFT_READY_RATE) ? stable + 1 : 0;
+		}
+
+		if(now >= nextReport)
+		{
+			cout << "  " << (int)(now - start) << " s";
+			if(est.full()) cout << "  drift " << est.rate(0) << "  " << est.rate(1) << "  " << est.rate(2) << " %/min";
+			cout << endl;
+			nextReport += DRIFT_REPORT_TIME;
+		}
+
+		run.warmup = now - start;
+
+		if(stable >= DRIFT_READY_HOLD)
+		{
+			run.ready = 1;
+			break;
+		}
+
+		if(run.warmup >= DRIFT_MAX_TIME) break;
+	}
+
+	if(run.initial < 0.0) run.initial = run.final;
+
+	if(run.ready)
+	{
+		cout << "Ready after " << (int)run.warmup << " s, drift " << run.final << " %/min" << endl;
+		publishStatus("ready");
+	}
+	else
+	{
+		cout << "Not settled after " << (int)run.warmup << " s, drift still " << run.final << " %/min" << endl;
+		publishStatus("not settled");
+	}
+
+	int res = run.ready ? 0 : 1;
+
+	if(numRuns >= DRIFT_FLAG_RUNS)
+	{
+		double* v = new double[numRuns];
+
+		for(int i(0); i < numRuns; i++) v[i] = runs[i].warmup;
+		double medWarmup = medianOf(v, numRuns);
+
+		for(int i(0); i < numRuns; i++) v[i] = runs[i].initial;
+		double medInitial = medianOf(v, numRuns);
+
+		delete[] v;
+
+		if(!run.ready || run.warmup > DRIFT_FLAG_RATIO * medWarmup || run.initial > DRIFT_FLAG_RATIO * medInitial)
+		{
+			cout << "Warning: " << serNum << " is drifting abnormally, usually ready after " << (int)medWarmup
+				 << " s starting at " << medInitial << " %/min" << endl;
+			res = 2;
+		}
+	}
+
+	if(!appendDriftHistory(histFile, serNum, run))
+	{
+		cout << "Warning: Failed to update the drift history " << histFile << endl;
+	}
+
+	delete[] runs;
+
+	return res;
+}
+
+
+/* Soak test */
+#define SOAK_REPORT_TIME	10.0		// seconds between progress lines
+#define SOAK_MAX_LATENCIES	(1 << 24)	// transactions whose latency is kept for the percentiles
+
+
+class soakStats
+{
+	public:
+					soakStats():transactions(0), timeouts(0), resyncs(0), rejected(0), mismatches(0),
+								latency(0), numLatency(0), maxLatency(0) {};
+				   ~soakStats() { if(latency) delete[] latency; };
+
+	void			addLatency(double secs);
+	double			percentile(double p);
+
+	unsigned int	transactions;
+	unsigned int	timeouts;
+	unsigned int	resyncs;	// replies to an earlier command that had timed out
+	unsigned int	rejected;	// replies with an error code
+	unsigned int	mismatches;	// replies that differ from the first read
+
+	float*			latency;
+	unsigned int	numLatency;
+	unsigned int	maxLatency;
+};
+
+
+void soakStats::addLatency(double secs)
+{
+	if(numLatency == maxLatency)
+	{
+		if(maxLatency == SOAK_MAX_LATENCIES) return;
+
+		unsigned int grow = maxLatency ? maxLatency * 2 : 65536;
+		float* nl = new float[grow];
+		if(latency)
+		{
+			memcpy(nl, latency, numLatency * sizeof(float));
+			delete[] latency;
+		}
+
+		latency = nl;
+		maxLatency = grow;
+	}
+
+	latency[numLatency++] = (float)secs;
+}
+
+
+int compareFloat(const void* a, const void* b)
+{
+	float fa = *(const float*)a;
+	float fb = *(const float*)b;
+
+	return (fa < fb) ? -1 : (fa > fb) ? 1 : 0;
+}
+
+
+// Call once all latencies are in, p from 0 to 1
+double soakStats::percentile(double p)
+{
+	if(numLatency == 0) return 0.0;
+
+	unsigned int i = (unsigned int)(p * (numLatency - 1) + 0.5);
+
+	return latency[i];
+}
+
+
+// Like i1d3Command, but counts what went wrong.  A reply to a different command is the late answer to one that
+// timed out, it is skipped to get the probe and host back in step.
+int soakCommand(hidIdevice* dev, unsigned short cmdCode, unsigned char* tBuf, unsigned char* fBuf, soakStats* st)
+{
+	unsigned char cmd = (cmdCode >> 8) & 0xff;
+
+	tBuf[0] = cmd;
+	if(cmd == 0x00) tBuf[1] = (cmdCode & 0xff);
+
+	st->transactions++;
+	double t0 = timeNow();
+
+	if(writeHIDdevice(dev, tBuf, 64) < 0)
+	{
+		st->timeouts++;
+		return -1;
+	}
+
+	for(int tries(0); ; tries++)
+	{
+		if(readHIDdevice(dev, fBuf, 64, 1.0) < 0)
+		{
+			st->timeouts++;
+			return -1;
+		}
+
+		if(fBuf[1] == cmd) break;
+
+		st->resyncs++;
+		if(tries == 3) return -1;
+	}
+
+	st->addLatency(timeNow() - t0);
+
+	if(fBuf[0] != 0x00)
+	{
+		st->rejected++;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void soakProgress(soakStats* st, double elapsed)
+{
+	cout << (int)elapsed << " s  " << st->transactions << " transactions  " << st->transactions / elapsed << "/s  "
+		 << st->timeouts << " timeouts  " << st->resyncs << " resyncs  " << st->rejected << " rejected  " << st->mismatches << " mismatches" << endl;
+}
+
+
+// Loops read only commands for count transactions or secs seconds, whichever is given: the information string, the
+// external eeprom a packet at a time, and the unlock exchange.  Every reply is checked against the first reading.
+int soakTest(hidIdevice* dev, unsigned int count, double secs)
+{
+	unsigned char tBuf[64];
+	unsigned char fBuf[64];
+
+	int key = i1d3UnLock(dev);
+	if(key < 0)
+	{
+		cout << "Error: Failed to unlock the i1d3" << endl;
+		return 1;
+	}
+
+	char info[64];
+	memset(info, 0x00, 64);
+	unsigned char* ref = new unsigned char[8192];
+
+	if(i1d3GetInfo(dev, info) < 0 || i1d3ReadExternalEeprom(dev, ref) < 0)
+	{
+		cout << "Error: Failed to read the reference data" << endl;
+		delete[] ref;
+		return 1;
+	}
+
+	if(count) cout << "Soak test, " << count << " transactions" << endl;
+	else cout << "Soak test, " << secs << " seconds" << endl;
+
+	soakStats st;
+	unsigned int addr(0);
+
+	double start = timeNow();
+	double nextReport = start + SOAK_REPORT_TIME;
+
+	for(int op(0); ; op++)
+	{
+		if(count && st.transactions >= count) break;
+		if(!count && timeNow() - start >= secs) break;
+
+		memset(tBuf, 0, 64);
+		memset(fBuf, 0, 64);
+
+		switch(op % 3)
+		{
+			case 0:
+			{
+				if(soakCommand(dev, 0x0000, tBuf, fBuf, &st) == 0 && strncmp((char*)fBuf + 2, info, 62) != 0) st.mismatches++;
+			}
+			break;
+
+			case 1:
+			{
+				unsigned int inc = dev->caps.extRead;
+				if(addr + inc > 8192) inc = 8192 - addr;
+
+				tBuf[1]	= (addr >> 8) & 0xff;
+				tBuf[2] = addr & 0xff;
+				tBuf[3] = (unsigned char)inc;
+
+				if(soakCommand(dev, 0x1200, tBuf, fBuf, &st) == 0 && memcmp(fBuf + 5, ref + addr, inc) != 0) st.mismatches++;
+
+				addr = (addr + inc) % 8192;
+			}
+			break;
+
+			case 2:
+			{
+				// only the key that worked, the others are expected to fail
+				if(soakCommand(dev, 0x9900, tBuf, fBuf, &st) == 0)
+				{
+					unsigned char rBuf[64];
+					memset(rBuf, 0, 64);
+					i1d3CreateUnLockResponse(i1d3UnLockKeys[key][0], i1d3UnLockKeys[key][1], fBuf, rBuf);
+
+					if(soakCommand(dev, 0x9a00, rBuf, fBuf, &st) == 0 && fBuf[2] != 0x77) st.mismatches++;
+				}
+			}
+			break;
+		}
+
+		if(timeNow() >= nextReport)
+		{
+			soakProgress(&st, timeNow() - start);
+			nextReport += SOAK_REPORT_TIME;
+		}
+	}
+
+	double elapsed = timeNow() - start;
+
+	delete[] ref;
+
+	qsort(st.latency, st.numLatency, sizeof(float), compareFloat);
+
+	soakProgress(&st, elapsed);
+	cout << "Latency ms  p50 " << st.percentile(0.5) * 1000.0 << "  p90 " << st.percentile(0.9) * 1000.0
+		 << "  p99 " << st.percentile(0.99) * 1000.0 << "  p99.9 " << st.percentile(0.999) * 1000.0
+		 << "  max " << st.percentile(1.0) * 1000.0 << endl;
+
+	return (st.timeouts || st.resyncs || st.rejected || st.mismatches) ? 1 : 0;
+}
+
+
+//extern char *optarg;
+//extern int optind, opterr, optopt;
+
+int main(int argc, char **argv)
+{
+	cout << "i1d3util ver 1.0" << endl;
+
+
+    char* fileName(0);
 	bool verNum(false);
 	bool forceOverWrite(false);
 	bool enableEEPROMwrite(false);
@@ -777,11 +3839,34 @@ int main(int argc, char **argv)
 	bool wEeeprom(false);
 	bool rSig(false);
 	bool wSig(false);
+	bool rSpectral(false);
+	char* corrFile(0);
+	bool measure(false);
+	bool refresh(false);
+	bool allProbes(false);
+	char* seqFile(0);
+	bool publish(false);
+	bool tail(false);
+	char* logFile(0);
+	char* queryFile(0);
+	long long queryFrom(0);
+	long long queryTo(LOG_TIME_MAX);
+	char* lutFile(0);
+	int lutSize(LUT_DEFAULT_SIZE);
+	char* recordFile(0);
+	char* replayFile(0);
+	bool emulate(false);
+	char* registryFile(0);
+	char* driftFile(0);
+	char* fitFile(0);
+	bool dark(false);
+	unsigned int soakCount(0);
+	double soakTime(0.0);
 
     int   opt(0);
     while(1)
     {
-        opt = getopt(argc, argv, "fwvnNiIeEsS");
+        opt = getopt(argc, argv, "fwvnNiIeEsSxc:mrap:lto:q:T:u:z:y:j:b:k:h:d:g:K");
         
         if(opt == -1) break;
                 
@@ -853,12 +3938,173 @@ int main(int argc, char **argv)
             }
             break;
             
+            case 'x':
+            {
+				rSpectral = true;
+            }
+            break;
+            
+            case 'c':
+            {
+				corrFile = optarg;
+            }
+            break;
+            
+            case 'm':
+            {
+				measure = true;
+            }
+            break;
+            
+            case 'r':
+            {
+				refresh = true;
+            }
+            break;
+            
+            case 'a':
+            {
+				allProbes = true;
+            }
+            break;
+            
+            case 'p':
+            {
+				seqFile = optarg;
+            }
+            break;
+            
+            case 'l':
+            {
+				publish = true;
+            }
+            break;
+            
+            case 't':
+            {
+				tail = true;
+            }
+            break;
+            
+            case 'o':
+            {
+				logFile = optarg;
+            }
+            break;
+            
+            case 'q':
+            {
+				queryFile = optarg;
+            }
+            break;
+            
+            case 'T':
+            {
+				// seconds since 1970 as -q prints them, either end may be left open
+				double from, to;
+				char* comma = strchr(optarg, ',');
+
+				if(!comma || (comma != optarg && sscanf(optarg, "%lf", &from) != 1) || (comma[1] && sscanf(comma + 1, "%lf", &to) != 1))
+				{
+					cout << "Error: time range must be <from>,<to> in seconds since 1970, either may be left out" << endl;
+					exit(1);
+				}
+
+				if(comma != optarg) queryFrom = (long long)(from * 1e6);
+				if(comma[1]) queryTo = (long long)(to * 1e6);
+            }
+            break;
+            
+            case 'u':
+            {
+				lutFile = optarg;
+            }
+            break;
+            
+            case 'y':
+            {
+				recordFile = optarg;
+            }
+            break;
+            
+            case 'j':
+            {
+				replayFile = optarg;
+            }
+            break;
+            
+            case 'b':
+            {
+				if(strcmp(optarg, "queued") == 0) hidQueueDepth = HID_QUEUE_DEPTH;
+				else if(strcmp(optarg, "hid") == 0) hidQueueDepth = 0;
+				else if(strcmp(optarg, "emu") == 0) emulate = true;
+				else
+				{
+					cout << "Error: Unknown transport " << optarg << ", use hid, queued or emu" << endl;
+					exit(1);
+				}
+            }
+            break;
+            
+            case 'h':
+            {
+				registryFile = optarg;
+            }
+            break;
+            
+            case 'd':
+            {
+				driftFile = optarg;
+            }
+            break;
+            
+            case 'g':
+            {
+				fitFile = optarg;
+            }
+            break;
+            
+            case 'K':
+            {
+				dark = true;
+            }
+            break;
+            
+            case 'k':
+            {
+				// a number of transactions, or of seconds with an s on the end
+				char* end;
+				double n = strtod(optarg, &end);
+
+				if(*end == 's') soakTime = n;
+				else soakCount = (unsigned int)n;
+
+				if(soakTime <= 0.0 && soakCount == 0)
+				{
+					cout << "Error: Soak test needs a number of transactions or seconds, e.g. -k 100000 or -k 600s" << endl;
+					exit(1);
+				}
+            }
+            break;
+            
+            case 'z':
+            {
+				lutSize = atoi(optarg);
+				if(lutSize < 2 || lutSize > LUT_MAX_SIZE)
+				{
+					cout << "Error: LUT size must be between 2 and " << LUT_MAX_SIZE << endl;
+					exit(1);
+				}
+            }
+            break;
+            
             case '?':
             {
  	        cout																			<< endl;
 	        cout << "i1d3util <options> <filename>"											<< endl;
 	        cout																			<< endl;
             cout << " -v              read the i1d3 firmware version information"			<< endl;
+            cout << "                 firmware past 2.99 uses slow 16 byte eeprom transfers"<< endl;
 	        cout																			<< endl;
             cout << " -n              read the i1d3 serial number"							<< endl;
             cout << " -N              write the i1d3 serial number"							<< endl;
@@ -872,6 +4118,31 @@ int main(int argc, char **argv)
             cout << " -s              read external eeprom signature and write to a file"	<< endl;
             cout << " -S              read a signature file and update the external eeprom"	<< endl;
 	        cout																			<< endl;
+            cout << " -x              integrate the sensor sensitivities against the CIE observers"	<< endl;
+            cout << " -c <file>       load a CCSS display correction, or a CCMX applied to the -g fit"	<< endl;
+            cout << " -g <reference>  fit this probe's -p results to reference XYZ and keep the matrix"	<< endl;
+	        cout																			<< endl;
+            cout << " -m              take an auto-ranged measurement (XYZ with -c or -g)"	<< endl;
+            cout << " -r              detect the display refresh rate (syncs -m to it)"		<< endl;
+            cout << " -a              measure (-m) or write (-E -I -S) all attached probes at once"	<< endl;
+            cout << " -d <history>    warm up until the drift settles, keeping a history per probe"	<< endl;
+            cout << " -K              check a capped probe's cached dark offset, recalibrate if needed"	<< endl;
+            cout << " -h <registry>   inventory all attached probes into a registry file"		<< endl;
+            cout << " -p <patches>    measure a patch sequence and write the results to a file"	<< endl;
+            cout << " -l              publish readings to shared memory for other processes"	<< endl;
+            cout << " -t              print the readings published by another i1d3util -l"	<< endl;
+            cout << " -o <log>        append every reading to a measurement log"			<< endl;
+            cout << " -q <log>        print the readings in a log, optionally for one serial"	<< endl;
+            cout << " -T <from>,<to>  only the readings of -q between these times, as it prints them"	<< endl;
+	        cout																			<< endl;
+            cout << " -u <results>    build a 3D LUT (.cube) from -p results with XYZ"		<< endl;
+            cout << " -z <size>       3D LUT size, 2 to 65, usually 17, 33 (default) or 65"	<< endl;
+	        cout																			<< endl;
+            cout << " -y <trace>      record every HID report to a trace file"				<< endl;
+            cout << " -j <trace>      run against a recorded trace instead of a probe"		<< endl;
+            cout << " -b <transport>  hid (default), queued which keeps reads posted ahead, or emu"	<< endl;
+            cout << " -k <n>|<n>s     soak test with read only commands, n transactions or seconds"	<< endl;
+	        cout																			<< endl;
             cout << " -f              force file overwrite"									<< endl;
             cout << " -w              enable eeprom writing"								<< endl;
 	        exit(1);
@@ -891,7 +4162,7 @@ int main(int argc, char **argv)
         fileName = new char[strlen(argv[optind]) + 1];
 		strcpy(fileName, argv[optind]);
     }
-	else if(rIeeprom || wIeeprom || rEeeprom || wEeeprom || rSig || wSig)
+	else if(rIeeprom || wIeeprom || rEeeprom || wEeeprom || rSig || wSig || seqFile || lutFile || fitFile)
 	{
 		cout << "Error: missing filename" << endl;
 		exit(1);
@@ -903,31 +4174,163 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-    if(!fileName && !verNum && !rSerNum && !wSerNum && !rIeeprom && !wIeeprom && !rEeeprom && !wEeeprom && !rSig && !wSig)
+    if(!fileName && !verNum && !rSerNum && !wSerNum && !rIeeprom && !wIeeprom && !rEeeprom && !wEeeprom && !rSig && !wSig && !rSpectral && !corrFile && !measure && !refresh && !seqFile && !tail && !queryFile && !soakCount && soakTime == 0.0 && !registryFile && !driftFile && !fitFile && !dark)
 	{
         cout << "i1d3util -? for help" << endl;
 	}
 
 
- 	if(loadDLLfuncs() == 0)// load the DLL functions
+	if(tail)
+	{
+		if(fileName) delete[] fileName;
+		return tailLiveReadings();
+	}
+
+	if(lutFile)
+	{
+		int res = buildLut(lutFile, fileName, forceOverWrite, lutSize);
+
+		if(fileName) delete[] fileName;
+		return res;
+	}
+
+	if(queryFile)
+	{
+		int res = scanLog(queryFile, fileName, queryFrom, queryTo);
+
+		if(fileName) delete[] fileName;
+		return res;
+	}
+
+	// before the multi-probe modes, which open their own probes.  The product id is filled in once a single probe
+	// is open, and the firmware check at the start is recorded so that a replay makes the same transfer size choice.
+	if(recordFile)
+	{
+		hidRecord = new hidTrace;
+		if(!hidRecord->create(recordFile, 0x5020))
+		{
+			cout << "Error: Failed to create HID trace " << recordFile << endl;
+			exit(1);
+		}
+
+		atexit(closeTrace);
+	}
+
+	if(logFile)
+	{
+		logOut = new logWriter;
+		if(!logOut->open(logFile))
+		{
+			cout << "Error: Failed to open log " << logFile << endl;
+			if(fileName) delete[] fileName;
+			exit(1);
+		}
+
+		atexit(closeLog);
+	}
+
+	if(publish)
+	{
+		livePub = new livePublisher;
+		if(!livePub->open())
+		{
+			cout << "Warning: failed to create the live readings shared memory, is another i1d3util publishing?" << endl;
+			delete livePub;
+			livePub = 0;
+		}
+	}
+
+ 	if(loadDLLfuncs() == 0)// load the DLL functions
+	{
+        cout << "Error: failed to load USB DLL functions" << endl;
+        exit(1);
+	}
+
+	if(registryFile)
+	{
+		int res = inventoryProbes(registryFile);
+
+		if(fileName) delete[] fileName;
+		if(livePub) delete livePub;
+		return res;
+	}
+
+	if(allProbes && (wEeeprom || wIeeprom || wSig))
+	{
+		int mode = wEeeprom ? FLASH_EXTERNAL : wIeeprom ? FLASH_INTERNAL : FLASH_SIGNATURE;
+		int res = flashAllProbes(mode, fileName, enableEEPROMwrite);
+
+		if(fileName) delete[] fileName;
+		if(livePub) delete livePub;
+		return res;
+	}
+
+	if(allProbes)
+	{
+		if(!measure)
+		{
+			cout << "Error: -a is only supported with -m, -E, -I or -S" << endl;
+			exit(1);
+		}
+
+		int res = measureAllProbes(corrFile, refresh);
+
+		if(fileName) delete[] fileName;
+		if(livePub) delete livePub;
+		return res;
+	}
+
+	hidIdevice* hidDev(0);
+
+	if(replayFile)
 	{
-        cout << "Error: failed to load USB DLL functions" << endl;
-        exit(1);
-	}
+		// The trace stands in for the probe, played back at its recorded timing
+		hidTrace* trace = new hidTrace;
+		if(!trace->load(replayFile, true))
+		{
+			cout << "Error: Failed to load HID trace " << replayFile << endl;
+			exit(1);
+		}
 
-	hidIdevice* hidDev = findHIDdevice();
-	if(!hidDev)
+		hidDev = new hidIdevice;
+		hidDev->replay = trace;
+		hidDev->ProductID = trace->ProductID;
+
+		// traces since i1d3trc2 start with the firmware check
+		if(trace->recHdr == 7) i1d3DetectCaps(hidDev);
+	}
+	else if(emulate)
 	{
-        cout << "Error: failed to find USB HID device" << endl;
-        exit(1);
+		hidDev = new hidIdevice;
+		hidDev->emu = new hidEmulator;
+		hidDev->ProductID = 0x5020;
 	}
-
-	if(!openHIDdevice(hidDev))
+	else
 	{
-        cout << "Error: failed to find USB HID device" << endl;
-        exit(1);
+		hidDev = findHIDdevice();
+		if(!hidDev)
+		{
+	        cout << "Error: failed to find USB HID device" << endl;
+	        exit(1);
+		}
+
+		if(!openHIDdevice(hidDev))
+		{
+	        cout << "Error: failed to find USB HID device" << endl;
+	        exit(1);
+		}
+
+		int version = i1d3DetectCaps(hidDev);
+		if(hidDev->caps.maxVersion == 0)
+		{
+			cout << "Warning: Unknown firmware version " << version / 100 << "." << version % 100 / 10 << version % 10
+				 << ", using " << hidDev->caps.extRead << " byte reads and " << hidDev->caps.extWrite << " byte writes"
+				 << ", larger reads are tried once the probe is unlocked" << endl;
+		}
 	}
 
+	if(hidRecord) hidRecord->setProductID(hidDev->ProductID);
+
 	if(hidDev->ProductID == 0x5021)
 	{
         cout << "Warning: The product ID is 0x5021!  This may mean you internal eeprom is corrupt." << endl;
@@ -944,82 +4347,72 @@ int main(int argc, char **argv)
 		memset(fBuf, 0x00, 256);
 		i1d3ReadInternalEeprom(hidDev, fBuf);
 
-		if(fileName) delete[] fileName;
-        cout << "Please disconnect then reconnect the USB before re-running this program" << endl;
-		exit(1);
+		if(i1d3Reenumerate(&hidDev) && hidDev->ProductID == 0x5020)
+		{
+			cout << "The probe has been reset" << endl;
+		}
+		else
+		{
+			if(fileName) delete[] fileName;
+			cout << "Please disconnect then reconnect the USB before re-running this program" << endl;
+			exit(1);
+		}
 	}
 
-	if(verNum)
+	if(soakCount || soakTime > 0.0)
 	{
-		char rBuf[64];
-		memset(rBuf, 0x00, 64);
-		i1d3GetInfo(hidDev, rBuf);
-        cout << rBuf << endl;
-
-		int id = i1d3UnLock(hidDev);
-
-		switch(id)
-		{
-			case 0:
-			{
-				cout << "I1D3 Retail" << endl;
-			}
-			break;
-
-			case 1:
-			{
-				cout << "I1D3 ColorMunkie" << endl;
-			}
-			break;
-
-			case 2:
-			{
-				cout << "I1D3 OEM" << endl;
-			}
-			break;
+		int res = soakTest(hidDev, soakCount, soakTime);
 
-			case 3:
-			{
-				cout << "I1D3 NEC" << endl;
-			}
-			break;
+		if(fileName) delete[] fileName;
+		closeHIDdevice(hidDev);
+		return res;
+	}
+	else if(driftFile)
+	{
+		int res = warmUpProbe(hidDev, driftFile);
 
-			case 4:
-			{
-				cout << "I1D3 Quato" << endl;
-			}
-			break;
+		if(fileName) delete[] fileName;
+		if(livePub) delete livePub;
+		closeHIDdevice(hidDev);
+		return res;
+	}
+	else if(dark)
+	{
+		int res = darkCalibrate(hidDev, forceOverWrite);
 
-			case 5:
-			{
-				cout << "I1D3 HP Dreamcolor" << endl;
-			}
-			break;
+		if(fileName) delete[] fileName;
+		closeHIDdevice(hidDev);
+		return res;
+	}
+	else if(fitFile)
+	{
+		if(i1d3UnLock(hidDev) < 0)
+		{
+			if(fileName) delete[] fileName;
+			cout << "Error: Failed to unlock the i1d3" << endl;
+			exit(1);
+		}
 
-			case 6:
-			{
-				cout << "I1D3 Wacom" << endl;
-			}
-			break;
+		char serNum[21];
+		i1d3ReadSerial(hidDev, serNum);
 
-			case 7:
-			{
-				cout << "I1D3 SpectraCal C6" << endl;
-			}
-			break;
+		int res = fitReference(serNum, fitFile, fileName);
 
-			case 8:
-			{
-				cout << "I1D3 Tpa3" << endl;
-			}
-			break;
+		if(fileName) delete[] fileName;
+		closeHIDdevice(hidDev);
+		return res;
+	}
+	else if(verNum)
+	{
+		char rBuf[64];
+		memset(rBuf, 0x00, 64);
+		i1d3GetInfo(hidDev, rBuf);
+        cout << rBuf << endl;
 
+		int id = i1d3UnLock(hidDev);
 
-			default:
-			{
-				cout << "Unknown signiture" << endl;
-			}
-		}
+		if(id >= 0) cout << i1d3KeyNames[id] << endl;
+		else cout << "Unknown signiture" << endl;
 	}
 	else if(rSerNum)
 	{
@@ -1030,18 +4423,10 @@ int main(int argc, char **argv)
 			exit(1);
 		}
 
-		unsigned char* eBuf = new unsigned char[256];
-		memset(eBuf, 0x00, 256);
-		i1d3ReadInternalEeprom(hidDev, eBuf);
-
 		char serNum[21];
-		memset(serNum, 0x00, 21);
-
-		memcpy(serNum, &eBuf[16], 20);
+		i1d3ReadSerial(hidDev, serNum);
 
 		cout << serNum << endl;
-
-		delete[] eBuf;
 	}
 	else if(wSerNum)
 	{
@@ -1068,7 +4453,7 @@ int main(int argc, char **argv)
 		else cout << "EEPROM write not enabled, use -w" << endl;
 
 		cout << "Serial number " << fileName << " successfully written to the internal eeprom" << endl;
-		cout << "Now unplug and plugin the USB connection" << endl;
+		if(enableEEPROMwrite) i1d3ResetAfterWrite(&hidDev);
 
 		delete[] eBuf;
 	}
@@ -1183,7 +4568,7 @@ int main(int argc, char **argv)
 		else cout << "EEPROM write not enabled, use -w" << endl;
 
 		cout << "File " << fileName << " successfully written to the internal eeprom" << endl;
-		cout << "Now unplug and plugin the USB connection" << endl;
+		if(enableEEPROMwrite) i1d3ResetAfterWrite(&hidDev);
 
 		delete[] eBuf;
 	}
@@ -1292,7 +4677,7 @@ int main(int argc, char **argv)
 		else cout << "EEPROM write not enabled, use -w" << endl;
 
 		cout << "File " << fileName << " successfully written to the external eeprom" << endl;
-		cout << "Now unplug and plugin the USB connection" << endl;
+		if(enableEEPROMwrite) i1d3ResetAfterWrite(&hidDev);
 
 		delete[] eBuf;
 	}
@@ -1426,13 +4811,258 @@ int main(int argc, char **argv)
 		else cout << "EEPROM write not enabled, use -w" << endl;
 
 		cout << "File " << fileName << " signature successfully written to the external eeprom" << endl;
-		cout << "Now unplug and plugin the USB connection" << endl;
+		if(enableEEPROMwrite) i1d3ResetAfterWrite(&hidDev);
 
 		delete[] buf;
 		delete[] eBuf;
 	}
+	else if(rSpectral)
+	{
+		if(i1d3UnLock(hidDev) < 0)
+		{
+			if(fileName) delete[] fileName;
+			cout << "Error: Failed to unlock the i1d3" << endl;
+			exit(1);
+		}
+
+		unsigned char* eBuf = new unsigned char[8192];
+		memset(eBuf, 0x00, 8192);
+		i1d3ReadExternalEeprom(hidDev, eBuf);
+
+		unsigned int fsum(0);
+		fsum =  eBuf[2] | (eBuf[3] << 8);
+
+		if(calcCsum(eBuf) != fsum && calcCsum(eBuf, true) != fsum)
+		{
+			if(fileName) delete[] fileName;
+			delete[] eBuf;
+			cout << "Error: Checksum of i1d3 external eeprom failed, the calibration data is not valid" << endl;
+			exit(1);
+		}
+
+		float sens[3][SENS_BANDS];
+		i1d3ReadSensitivities(eBuf, sens);
+		delete[] eBuf;
+
+		const char* chName[3] = { "R", "G", "B" };
+
+		for(int obs(0); obs < CMF_NUM_OBSERVERS; obs++)
+		{
+			double mat[3][3];
+			if(!i1d3IntegrateCMF(sens, obs, mat))
+			{
+				cout << cmfNames[obs] << ": no table, " << cmfFiles[obs] << " was not found" << endl;
+				continue;
+			}
+
+			cout << cmfNames[obs];
+			if(i1d3LoadCMF(obs) == CMF_FIT) cout << ", from an analytic fit as " << cmfFiles[obs] << " was not found";
+			cout << endl;
+			for(int ch(0); ch < 3; ch++)
+			{
+				cout << "  " << chName[ch] << "  " << mat[ch][0] << "  " << mat[ch][1] << "  " << mat[ch][2] << endl;
+			}
+		}
+	}
+	else if(seqFile)
+	{
+		filePatchSource patches;
+		if(!patches.load(seqFile))
+		{
+			cout << "Error: Failed to read patches from " << seqFile << endl;
+			if(fileName) delete[] fileName;
+			exit(1);
+		}
+
+		if(i1d3UnLock(hidDev) < 0)
+		{
+			if(fileName) delete[] fileName;
+			cout << "Error: Failed to unlock the i1d3" << endl;
+			exit(1);
+		}
+
+		char serNum[21];
+		i1d3ReadSerial(hidDev, serNum);
+
+		if(i1d3LoadDark(hidDev, serNum) < 0) cout << "Warning: the dark offset for " << serNum << " has expired and is still applied, run -K with the probe capped" << endl;
+
+		double mat[3][3];
+		bool haveXYZ(false);
+
+		if(corrFile)
+		{
+			bool cached(false);
+			int type = i1d3LoadCorrection(hidDev, serNum, corrFile, mat, &cached);
+
+			if(type == CORR_CCSS) haveXYZ = true;
+			else if(type == CORR_CCMX) haveXYZ = i1d3ApplyCCMX(serNum, mat);
+
+			if(type < 0) cout << "Warning: Failed to load display correction " << corrFile << ", XYZ will not be reported" << endl;
+			else if(!haveXYZ) cout << "Warning: a CCMX correction needs a -g fit for " << serNum << ", XYZ will not be reported" << endl;
+		}
+		else if(i1d3LoadFit(serNum, mat))
+		{
+			haveXYZ = true;
+			cout << "Using the fitted matrix for " << serNum << endl;
+		}
+
+		double refreshRate(0.0);
+		if(refresh)
+		{
+			double confidence(0.0);
+			i1d3DetectRefresh(hidDev, &refreshRate, &confidence);
+			cout << "Refresh rate " << refreshRate << " Hz (confidence " << confidence << ")" << endl;
+		}
+
+		HANDLE hd;
+		if(forceOverWrite)
+		{
+			hd = CreateFile(fileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+		}
+		else
+		{
+			hd = CreateFile(fileName, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+		}
+
+		if(hd == INVALID_HANDLE_VALUE)
+		{
+			cout << "Error: Failed to open file " << fileName << " for writing" << endl;
+			if(fileName) delete[] fileName;
+			exit(1);
+		}
+
+		int res = runSequence(hidDev, serNum, &patches, hd, refreshRate, haveXYZ, mat);
+
+		if(!CloseHandle(hd) || res < 0)
+		{
+			cout << "Error: Failed to complete the patch sequence" << endl;
+			if(fileName) delete[] fileName;
+			exit(1);
+		}
+
+		cout << "Patch measurements written to file " << fileName << endl;
+	}
+	else if(measure || refresh)
+	{
+		if(i1d3UnLock(hidDev) < 0)
+		{
+			if(fileName) delete[] fileName;
+			cout << "Error: Failed to unlock the i1d3" << endl;
+			exit(1);
+		}
+
+		double refreshRate(0.0);
+
+		if(refresh)
+		{
+			double confidence(0.0);
+
+			if(i1d3DetectRefresh(hidDev, &refreshRate, &confidence) < 0)
+			{
+				if(fileName) delete[] fileName;
+				cout << "Error: Measurement failed" << endl;
+				exit(1);
+			}
+
+			if(refreshRate > 0.0) cout << "Refresh rate " << refreshRate << " Hz (confidence " << confidence << ")" << endl;
+			else cout << "No refresh rate detected (confidence " << confidence << ")" << endl;
+
+			if(!measure)
+			{
+				if(fileName) delete[] fileName;
+				closeHIDdevice(hidDev);
+				return 0;
+			}
+		}
+
+		char serNum[21];
+		i1d3ReadSerial(hidDev, serNum);
+
+		if(i1d3LoadDark(hidDev, serNum) < 0) cout << "Warning: the dark offset for " << serNum << " has expired and is still applied, run -K with the probe capped" << endl;
+
+		double mat[3][3];
+		bool haveXYZ(false);
+
+		if(corrFile)
+		{
+			bool cached(false);
+			int type = i1d3LoadCorrection(hidDev, serNum, corrFile, mat, &cached);
+
+			if(type == CORR_CCSS) haveXYZ = true;
+			else if(type == CORR_CCMX) haveXYZ = i1d3ApplyCCMX(serNum, mat);
+
+			if(type < 0) cout << "Warning: Failed to load display correction " << corrFile << endl;
+			else if(!haveXYZ) cout << "Warning: a CCMX correction needs a -g fit for " << serNum << ", reporting sensor frequencies only" << endl;
+		}
+		else if(i1d3LoadFit(serNum, mat))
+		{
+			haveXYZ = true;
+			cout << "Using the fitted matrix for " << serNum << endl;
+		}
+
+		double rgb[3];
+		double inttime(0.0);
+		measStats ms;
+
+		if(i1d3MeasureAuto(hidDev, rgb, &inttime, refreshRate, MEAS_PRECISION, MEAS_MAX_TIME, &ms) < 0)
+		{
+			if(fileName) delete[] fileName;
+			cout << "Error: Measurement failed" << endl;
+			exit(1);
+		}
+
+		cout << "RGB Hz " << rgb[0] << "  " << rgb[1] << "  " << rgb[2] << "  (" << inttime << " s)" << endl;
+		cout << "StdErr " << ms.stdErr[0] << "  " << ms.stdErr[1] << "  " << ms.stdErr[2]
+			 << "  (" << ms.numUsed << " x " << ms.inttime << " s, " << ms.numRejected << " rejected)" << endl;
+
+		double xyz[3] = { 0.0, 0.0, 0.0 };
+
+		if(haveXYZ)
+		{
+			applyMatrix(mat, rgb, xyz);
+			cout << "XYZ    " << xyz[0] << "  " << xyz[1] << "  " << xyz[2] << endl;
+		}
+
+		recordReading(serNum, -1, rgb, xyz);
+	}
+	else if(corrFile)
+	{
+		if(i1d3UnLock(hidDev) < 0)
+		{
+			if(fileName) delete[] fileName;
+			cout << "Error: Failed to unlock the i1d3" << endl;
+			exit(1);
+		}
+
+		char serNum[21];
+		i1d3ReadSerial(hidDev, serNum);
+
+		double mat[3][3];
+		bool cached(false);
+		int type = i1d3LoadCorrection(hidDev, serNum, corrFile, mat, &cached);
+
+		if(type < 0)
+		{
+			if(fileName) delete[] fileName;
+			cout << "Error: Failed to load display correction " << corrFile << endl;
+			exit(1);
+		}
+
+		cout << (type == CORR_CCSS ? "CCSS" : "CCMX") << " correction for " << serNum << (cached ? " (cached)" : "") << endl;
+		for(int r(0); r < 3; r++)
+		{
+			cout << "  " << mat[r][0] << "  " << mat[r][1] << "  " << mat[r][2] << endl;
+		}
+
+		if(type == CORR_CCMX)
+		{
+			if(i1d3ApplyCCMX(serNum, mat)) cout << "Applied on top of the -g fit for " << serNum << endl;
+			else cout << "Warning: " << serNum << " has no -g fit, the CCMX will not be applied" << endl;
+		}
+	}
 
 	if(fileName) delete[] fileName;
+	if(livePub) delete livePub;
 
 	closeHIDdevice(hidDev);
 